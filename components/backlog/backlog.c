@@ -0,0 +1,93 @@
+#include "math.h"
+#include "time.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+
+#include "backlog.h"
+#include "block.h"
+#include "rollup.h"
+
+static const char *TAG = "MODULE[backlog]";
+
+static int32_t temperature_value(const shared_data_t *data) { return isnan(data->temperature) ? BACKLOG_MISSING : lroundf(data->temperature * 10); }
+static int32_t humidity_value(const shared_data_t *data) { return isnan(data->humidity) ? BACKLOG_MISSING : lroundf(data->humidity * 10); }
+static int32_t pm25_value(const shared_data_t *data) { return data->pm25 == READING_PM_MISSING ? BACKLOG_MISSING : data->pm25; }
+static int32_t pm10_value(const shared_data_t *data) { return data->pm10 == READING_PM_MISSING ? BACKLOG_MISSING : data->pm10; }
+
+const backlog_column_t backlog_columns[BACKLOG_COLUMN_COUNT] = {
+	{0x01, 0x01, 1, temperature_value},
+	{0x01, 0x02, 1, humidity_value},
+	{0x02, 0x01, 0, pm25_value},
+	{0x02, 0x02, 0, pm10_value}};
+
+// Ring of readings that survives deep sleep - oldest entry at `backlog_head`
+RTC_DATA_ATTR static backlog_entry_t backlog_entries[CONFIG_BACKLOG_CAPACITY];
+RTC_DATA_ATTR static size_t backlog_head = 0;
+RTC_DATA_ATTR static size_t backlog_size = 0;
+
+void backlog_push(const shared_data_t *data) {
+	uint32_t timestamp = (uint32_t)time(NULL);
+
+	backlog_store(timestamp, data);
+	rollup_add(timestamp, data);
+}
+
+void backlog_store(uint32_t timestamp, const shared_data_t *data) {
+	size_t index = (backlog_head + backlog_size) % CONFIG_BACKLOG_CAPACITY;
+
+	if (backlog_size == CONFIG_BACKLOG_CAPACITY) {
+		ESP_LOGW(TAG, "Backlog full, dropping oldest reading");
+		backlog_head = (backlog_head + 1) % CONFIG_BACKLOG_CAPACITY;
+	} else {
+		backlog_size++;
+	}
+
+	backlog_entries[index].timestamp = timestamp;
+	backlog_entries[index].data = *data;
+}
+
+size_t backlog_count() {
+	return backlog_size;
+}
+
+const backlog_entry_t *backlog_peek(size_t index) {
+	if (index >= backlog_size)
+		return NULL;
+
+	return &backlog_entries[(backlog_head + index) % CONFIG_BACKLOG_CAPACITY];
+}
+
+void backlog_drop(size_t count) {
+	if (count > backlog_size)
+		count = backlog_size;
+
+	backlog_head = (backlog_head + count) % CONFIG_BACKLOG_CAPACITY;
+	backlog_size -= count;
+}
+
+size_t backlog_encode(const uint8_t device_id[6], size_t offset, size_t count, uint8_t *buffer, size_t capacity) {
+	block_encoder_t encoder;
+	block_encoder_init(&encoder, buffer, capacity, device_id, BACKLOG_COLUMN_COUNT);
+
+	for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++) {
+		const backlog_column_t *column = &backlog_columns[c];
+
+		// Sensors run at different rates - a column only holds the readings that measured it
+		uint32_t present = 0;
+		for (size_t i = offset; i < offset + count; i++)
+			present += column->value(&backlog_peek(i)->data) != BACKLOG_MISSING;
+
+		block_encoder_begin_column(&encoder, column->sensor, column->parameter, column->scale, present);
+
+		for (size_t i = offset; i < offset + count; i++) {
+			const backlog_entry_t *entry = backlog_peek(i);
+			int32_t value = column->value(&entry->data);
+
+			if (value != BACKLOG_MISSING)
+				block_encoder_append(&encoder, entry->timestamp, value);
+		}
+	}
+
+	return block_encoder_finish(&encoder);
+}
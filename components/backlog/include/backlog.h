@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shared.h"
+
+typedef struct {
+	uint32_t timestamp;
+	shared_data_t data;
+} backlog_entry_t;
+
+// A reading parameter as a fixed-point value - shared by block uploads and rollups
+typedef struct {
+	uint16_t sensor;
+	uint8_t parameter;
+	uint8_t scale; // Decimal digits kept in the fixed-point value
+	int32_t (*value)(const shared_data_t *data);
+} backlog_column_t;
+
+#define BACKLOG_COLUMN_COUNT 4
+#define BACKLOG_MISSING INT32_MIN // value() of a parameter missing from the reading
+
+extern const backlog_column_t backlog_columns[BACKLOG_COLUMN_COUNT];
+
+void backlog_push(const shared_data_t *data);
+void backlog_store(uint32_t timestamp, const shared_data_t *data); // A reading already added to the rollups
+size_t backlog_count();
+const backlog_entry_t *backlog_peek(size_t index);
+void backlog_drop(size_t count);
+
+// Encodes `count` readings starting at `offset` as one columnar block, returns its length or 0 if it didn't fit
+size_t backlog_encode(const uint8_t device_id[6], size_t offset, size_t count, uint8_t *buffer, size_t capacity);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "backlog.h"
+
+typedef enum {
+	ROLLUP_HOUR,
+	ROLLUP_DAY,
+	ROLLUP_PERIOD_COUNT
+} rollup_period_t;
+
+// Aggregate of one parameter in backlog_columns fixed-point units
+typedef struct {
+	uint16_t count;
+	int16_t min;
+	int16_t max;
+	int32_t sum;
+} rollup_stats_t;
+
+typedef struct {
+	uint32_t start; // Aligned to the period
+	rollup_stats_t stats[BACKLOG_COLUMN_COUNT];
+} rollup_bucket_t;
+
+void rollup_add(uint32_t timestamp, const shared_data_t *data);
+uint32_t rollup_period_seconds(rollup_period_t period);
+
+// Closed buckets not yet uploaded - 0 = oldest
+size_t rollup_pending(rollup_period_t period);
+const rollup_bucket_t *rollup_peek_pending(rollup_period_t period, size_t index);
+void rollup_mark_uploaded(rollup_period_t period, size_t count);
@@ -0,0 +1,99 @@
+#include "string.h"
+
+#include "esp_attr.h"
+
+#include "backlog.h"
+#include "rollup.h"
+
+// Ring of buckets per period - the newest bucket is open, the `pending` ones before it await upload
+typedef struct {
+	size_t head;
+	size_t size;
+	size_t pending;
+} rollup_ring_t;
+
+RTC_DATA_ATTR static rollup_bucket_t hour_buckets[CONFIG_ROLLUP_HOURS];
+RTC_DATA_ATTR static rollup_bucket_t day_buckets[CONFIG_ROLLUP_DAYS];
+RTC_DATA_ATTR static rollup_ring_t rings[ROLLUP_PERIOD_COUNT] = {0};
+
+static rollup_bucket_t *const buckets[ROLLUP_PERIOD_COUNT] = {hour_buckets, day_buckets};
+static const size_t capacities[ROLLUP_PERIOD_COUNT] = {CONFIG_ROLLUP_HOURS, CONFIG_ROLLUP_DAYS};
+static const uint32_t periods[ROLLUP_PERIOD_COUNT] = {60 * 60, 24 * 60 * 60};
+
+static rollup_bucket_t *bucket_at(rollup_period_t period, size_t index) {
+	return &buckets[period][(rings[period].head + index) % capacities[period]];
+}
+
+static rollup_bucket_t *open_bucket(rollup_period_t period, uint32_t start) {
+	rollup_ring_t *ring = &rings[period];
+
+	if (ring->size == capacities[period]) {
+		ring->head = (ring->head + 1) % capacities[period];
+	} else {
+		ring->size++;
+	}
+
+	// The previously open bucket is closed now
+	if (ring->size > 1)
+		ring->pending++;
+
+	if (ring->pending > ring->size - 1)
+		ring->pending = ring->size - 1;
+
+	rollup_bucket_t *bucket = bucket_at(period, ring->size - 1);
+	memset(bucket, 0, sizeof(rollup_bucket_t));
+	bucket->start = start;
+	return bucket;
+}
+
+static void add_sample(rollup_stats_t *stats, int32_t value) {
+	if (value == BACKLOG_MISSING)
+		return;
+
+	if (value < INT16_MIN) value = INT16_MIN;
+	if (value > INT16_MAX) value = INT16_MAX;
+
+	if (stats->count == 0 || value < stats->min) stats->min = value;
+	if (stats->count == 0 || value > stats->max) stats->max = value;
+
+	if (stats->count < UINT16_MAX) {
+		stats->count++;
+		stats->sum += value;
+	}
+}
+
+void rollup_add(uint32_t timestamp, const shared_data_t *data) {
+	for (int p = 0; p < ROLLUP_PERIOD_COUNT; p++) {
+		uint32_t start = timestamp - timestamp % periods[p];
+		rollup_ring_t *ring = &rings[p];
+
+		// A clock stepping back keeps adding to the open bucket
+		rollup_bucket_t *bucket = ring->size > 0 ? bucket_at(p, ring->size - 1) : NULL;
+		if (bucket == NULL || start > bucket->start)
+			bucket = open_bucket(p, start);
+
+		for (int c = 0; c < BACKLOG_COLUMN_COUNT; c++)
+			add_sample(&bucket->stats[c], backlog_columns[c].value(data));
+	}
+}
+
+uint32_t rollup_period_seconds(rollup_period_t period) {
+	return periods[period];
+}
+
+size_t rollup_pending(rollup_period_t period) {
+	return rings[period].pending;
+}
+
+const rollup_bucket_t *rollup_peek_pending(rollup_period_t period, size_t index) {
+	const rollup_ring_t *ring = &rings[period];
+	if (index >= ring->pending)
+		return NULL;
+
+	return bucket_at(period, ring->size - 1 - ring->pending + index);
+}
+
+void rollup_mark_uploaded(rollup_period_t period, size_t count) {
+	rollup_ring_t *ring = &rings[period];
+	ring->pending = count > ring->pending ? 0 : ring->pending - count;
+}
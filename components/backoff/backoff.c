@@ -0,0 +1,35 @@
+#include "sdkconfig.h"
+
+#include "backoff.h"
+
+backoff_action_t backoff_next(backoff_t *backoff) {
+	if (backoff->failures == 0)
+		return BACKOFF_ATTEMPT;
+
+	if (backoff->cycles_to_skip > 0) {
+		backoff->cycles_to_skip--;
+		return BACKOFF_SKIP;
+	}
+
+	return BACKOFF_PROBE;
+}
+
+void backoff_success(backoff_t *backoff) {
+	backoff->failures = 0;
+	backoff->cycles_to_skip = 0;
+}
+
+void backoff_failure(backoff_t *backoff) {
+	if (backoff->failures < UINT16_MAX)
+		backoff->failures++;
+
+	// Skip 1, 2, 4, ... cycles, capped at the configured maximum
+	uint32_t skip = CONFIG_BACKOFF_MAX_SKIPPED_CYCLES;
+	if (backoff->failures <= 16)
+		skip = 1UL << (backoff->failures - 1);
+
+	if (skip > CONFIG_BACKOFF_MAX_SKIPPED_CYCLES)
+		skip = CONFIG_BACKOFF_MAX_SKIPPED_CYCLES;
+
+	backoff->cycles_to_skip = skip;
+}
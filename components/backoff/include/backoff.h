@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+// Exponential backoff state - meant to be kept in RTC memory across deep sleep wakes
+
+typedef struct {
+	uint16_t failures;		 // Consecutive failed connection attempts
+	uint16_t cycles_to_skip; // Cycles left before the next probe
+} backoff_t;
+
+typedef enum {
+	BACKOFF_ATTEMPT, // No recent failures - connect with the regular timeout
+	BACKOFF_PROBE,	 // Backoff elapsed - connect with a short probe timeout
+	BACKOFF_SKIP	 // Still backing off - do not touch the radio this cycle
+} backoff_action_t;
+
+backoff_action_t backoff_next(backoff_t *backoff);
+void backoff_success(backoff_t *backoff);
+void backoff_failure(backoff_t *backoff);
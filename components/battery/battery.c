@@ -0,0 +1,145 @@
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "battery.h"
+#include "helpers.h"
+
+#define BATTERY_SAMPLES 16 // Averaged per measurement - the ADC alone is noisy to a few tens of mV
+
+// Band of the last wake - hysteresis needs the previous decision
+RTC_DATA_ATTR static battery_band_t band = BATTERY_NORMAL;
+static int millivolts = 0;
+
+#if CONFIG_BATTERY_MONITOR
+static const char *TAG = "MODULE[battery]";
+
+static esp_err_t create_calibration(adc_cali_handle_t *calibration) {
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+	adc_cali_curve_fitting_config_t config = {
+		.unit_id = ADC_UNIT_1,
+		.chan = CONFIG_BATTERY_ADC_CHANNEL,
+		.atten = ADC_ATTEN_DB_12,
+		.bitwidth = ADC_BITWIDTH_DEFAULT};
+	return adc_cali_create_scheme_curve_fitting(&config, calibration);
+#else
+	adc_cali_line_fitting_config_t config = {
+		.unit_id = ADC_UNIT_1,
+		.atten = ADC_ATTEN_DB_12,
+		.bitwidth = ADC_BITWIDTH_DEFAULT};
+	return adc_cali_create_scheme_line_fitting(&config, calibration);
+#endif
+}
+
+static void delete_calibration(adc_cali_handle_t calibration) {
+#if ADC_CALI_SCHEME_CURVE_FITTING_SUPPORTED
+	adc_cali_delete_scheme_curve_fitting(calibration);
+#else
+	adc_cali_delete_scheme_line_fitting(calibration);
+#endif
+}
+
+static esp_err_t read_pin_millivolts(int *pin_mv) {
+	adc_oneshot_unit_handle_t unit;
+	adc_oneshot_unit_init_cfg_t unit_config = {.unit_id = ADC_UNIT_1};
+	RETURN_ON_ERROR(adc_oneshot_new_unit(&unit_config, &unit));
+
+	adc_cali_handle_t calibration;
+	adc_oneshot_chan_cfg_t channel_config = {.atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_DEFAULT};
+	esp_err_t ret = adc_oneshot_config_channel(unit, CONFIG_BATTERY_ADC_CHANNEL, &channel_config);
+	if (ret == ESP_OK)
+		ret = create_calibration(&calibration);
+
+	if (ret != ESP_OK) {
+		adc_oneshot_del_unit(unit);
+		return ret;
+	}
+
+	int sum = 0;
+	for (int i = 0; i < BATTERY_SAMPLES && ret == ESP_OK; i++) {
+		int raw = 0;
+		ret = adc_oneshot_read(unit, CONFIG_BATTERY_ADC_CHANNEL, &raw);
+		sum += raw;
+	}
+
+	if (ret == ESP_OK)
+		ret = adc_cali_raw_to_voltage(calibration, sum / BATTERY_SAMPLES, pin_mv);
+
+	delete_calibration(calibration);
+	adc_oneshot_del_unit(unit);
+	return ret;
+}
+
+static battery_band_t next_band(int mv) {
+	// Falling through a threshold switches at once, rising needs the hysteresis on top
+	int critical = CONFIG_BATTERY_CRITICAL_MV + (band >= BATTERY_CRITICAL ? CONFIG_BATTERY_HYSTERESIS_MV : 0);
+	int low = CONFIG_BATTERY_LOW_MV + (band >= BATTERY_LOW ? CONFIG_BATTERY_HYSTERESIS_MV : 0);
+
+	if (mv < critical)
+		return BATTERY_CRITICAL;
+	if (mv < low)
+		return BATTERY_LOW;
+	return BATTERY_NORMAL;
+}
+#endif
+
+esp_err_t battery_measure() {
+#if CONFIG_BATTERY_MONITOR
+	int pin_mv;
+	RETURN_ON_ERROR(read_pin_millivolts(&pin_mv));
+
+	millivolts = pin_mv * CONFIG_BATTERY_DIVIDER_RATIO / 100;
+
+	battery_band_t previous = band;
+	band = next_band(millivolts);
+
+	if (band != previous)
+		ESP_LOGW(TAG, "Battery at %d mV, band %d -> %d", millivolts, previous, band);
+	else
+		ESP_LOGI(TAG, "Battery at %d mV, band %d", millivolts, band);
+#endif
+
+	return ESP_OK;
+}
+
+int battery_millivolts() {
+	return millivolts;
+}
+
+battery_band_t battery_band() {
+	return band;
+}
+
+int battery_interval_scale() {
+	switch (band) {
+#if CONFIG_BATTERY_MONITOR
+		case BATTERY_LOW:
+			return CONFIG_BATTERY_LOW_INTERVAL_SCALE;
+		case BATTERY_CRITICAL:
+			return CONFIG_BATTERY_CRITICAL_INTERVAL_SCALE;
+#endif
+		default:
+			return 1;
+	}
+}
+
+int battery_sync_scale() {
+	switch (band) {
+#if CONFIG_BATTERY_MONITOR
+		case BATTERY_LOW:
+			return CONFIG_BATTERY_LOW_SYNC_SCALE;
+		case BATTERY_CRITICAL:
+			return CONFIG_BATTERY_CRITICAL_SYNC_SCALE;
+#endif
+		default:
+			return 1;
+	}
+}
+
+int battery_bulk_size(int configured) {
+	int size = configured / battery_interval_scale();
+	return size > 0 ? size : 1;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Duty-cycle governor - the battery voltage selects a band that stretches the schedule
+
+typedef enum {
+	BATTERY_NORMAL,
+	BATTERY_LOW,
+	BATTERY_CRITICAL,
+} battery_band_t;
+
+// Samples the battery once per wake - before the radio or the SDS011 fan load it
+esp_err_t battery_measure();
+
+int battery_millivolts(); // 0 when not measured
+battery_band_t battery_band();
+
+// Multipliers of the configured intervals, 1 in the normal band
+int battery_interval_scale();
+int battery_sync_scale();
+
+// Configured bulk size reduced by the interval scale, at least 1
+int battery_bulk_size(int configured);
@@ -0,0 +1,145 @@
+#include "math.h"
+#include "string.h"
+
+#include "esp_attr.h"
+#include "esp_bt.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "beacon.h"
+#include "beacon_protocol.h"
+#include "helpers.h"
+
+// Advertises straight through the controller's HCI (VHCI) - no Bluedroid host to start for a broadcast
+
+static const char *TAG = "MODULE[beacon]";
+
+#define HCI_COMMAND_PACKET 0x01
+#define HCI_EVENT_PACKET 0x04
+#define HCI_EVENT_COMMAND_COMPLETE 0x0E
+
+#define HCI_OGF_CONTROLLER 0x03
+#define HCI_OGF_LE 0x08
+#define HCI_OPCODE(ogf, ocf) (((ogf) << 10) | (ocf))
+
+#define HCI_RESET HCI_OPCODE(HCI_OGF_CONTROLLER, 0x0003)
+#define HCI_LE_SET_ADV_PARAMS HCI_OPCODE(HCI_OGF_LE, 0x0006)
+#define HCI_LE_SET_ADV_DATA HCI_OPCODE(HCI_OGF_LE, 0x0008)
+#define HCI_LE_SET_ADV_ENABLE HCI_OPCODE(HCI_OGF_LE, 0x000A)
+
+#define HCI_ADV_NONCONN_IND 0x03
+#define HCI_ADV_CHANNELS_ALL 0x07
+#define HCI_COMMAND_TIMEOUT_MS 500
+
+#define ADV_INTERVAL_UNITS (CONFIG_BEACON_INTERVAL_MS * 1000 / 625) // 0.625 ms units
+
+// Wakes since power on - lets collectors drop repeated copies and count missed wakes
+RTC_DATA_ATTR static uint16_t sequence = 0;
+
+static SemaphoreHandle_t command_complete;
+static StaticSemaphore_t command_complete_buffer;
+static uint16_t completed_opcode;
+static uint8_t completed_status;
+
+static int hci_receive(uint8_t *data, uint16_t len) {
+	// Command Complete: packet type, event code, length, credits, opcode (2), status
+	if (len >= 7 && data[0] == HCI_EVENT_PACKET && data[1] == HCI_EVENT_COMMAND_COMPLETE) {
+		completed_opcode = data[4] | (data[5] << 8);
+		completed_status = data[6];
+		xSemaphoreGive(command_complete);
+	}
+
+	return 0;
+}
+
+static void hci_send_available() {}
+
+static const esp_vhci_host_callback_t vhci_callbacks = {
+	.notify_host_send_available = hci_send_available,
+	.notify_host_recv = hci_receive,
+};
+
+static esp_err_t hci_command(uint16_t opcode, const uint8_t *params, uint8_t len) {
+	uint8_t packet[4 + 32];
+	if (len > sizeof(packet) - 4)
+		return ESP_ERR_INVALID_SIZE;
+
+	packet[0] = HCI_COMMAND_PACKET;
+	packet[1] = opcode;
+	packet[2] = opcode >> 8;
+	packet[3] = len;
+	if (len > 0)
+		memcpy(packet + 4, params, len);
+
+	for (int i = 0; i < 100 && !esp_vhci_host_check_send_available(); i++)
+		vTaskDelay(1);
+
+	xSemaphoreTake(command_complete, 0);
+	esp_vhci_host_send_packet(packet, 4 + len);
+
+	if (xSemaphoreTake(command_complete, pdMS_TO_TICKS(HCI_COMMAND_TIMEOUT_MS)) == pdFALSE)
+		return ESP_ERR_TIMEOUT;
+
+	if (completed_opcode != opcode || completed_status != 0) {
+		ESP_LOGE(TAG, "HCI command 0x%04x failed with status 0x%02x", opcode, completed_status);
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t beacon_broadcast(const shared_data_t *reading) {
+	int64_t radio_on = esp_timer_get_time();
+
+	const beacon_reading_t beacon = {
+		.sequence = ++sequence,
+		.temperature = reading->temperature,
+		.humidity = reading->humidity,
+		.pm25 = reading->pm25,
+		.pm10 = reading->pm10};
+
+	// Length byte followed by the advertising data, zero padded to 31 bytes
+	uint8_t adv_data[1 + BEACON_ADV_MAX_LEN] = {0};
+	adv_data[0] = beacon_encode(&beacon, CONFIG_BEACON_COMPANY_ID, adv_data + 1, BEACON_ADV_MAX_LEN);
+
+	const uint8_t adv_params[15] = {
+		ADV_INTERVAL_UNITS & 0xFF, ADV_INTERVAL_UNITS >> 8, // Minimum interval
+		ADV_INTERVAL_UNITS & 0xFF, ADV_INTERVAL_UNITS >> 8, // Maximum interval
+		HCI_ADV_NONCONN_IND,
+		0x00,							// Own address: public
+		0x00, 0, 0, 0, 0, 0, 0,			// Peer address: unused
+		HCI_ADV_CHANNELS_ALL,
+		0x00};							// No filter
+
+	const uint8_t enable = 1;
+	const uint8_t disable = 0;
+
+	if (command_complete == NULL)
+		command_complete = xSemaphoreCreateBinaryStatic(&command_complete_buffer);
+
+	// The node sleeps right after - a failure leaves the controller to the deep sleep power down
+	esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT);
+
+	esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
+	RETURN_ON_ERROR(esp_bt_controller_init(&bt_cfg));
+	RETURN_ON_ERROR(esp_bt_controller_enable(ESP_BT_MODE_BLE));
+	RETURN_ON_ERROR(esp_vhci_host_register_callback(&vhci_callbacks));
+
+	RETURN_ON_ERROR(hci_command(HCI_RESET, NULL, 0));
+	RETURN_ON_ERROR(hci_command(HCI_LE_SET_ADV_PARAMS, adv_params, sizeof(adv_params)));
+	RETURN_ON_ERROR(hci_command(HCI_LE_SET_ADV_DATA, adv_data, sizeof(adv_data)));
+	RETURN_ON_ERROR(hci_command(HCI_LE_SET_ADV_ENABLE, &enable, sizeof(enable)));
+
+	vTaskDelay(pdMS_TO_TICKS(CONFIG_BEACON_BURST_MS));
+
+	RETURN_ON_ERROR(hci_command(HCI_LE_SET_ADV_ENABLE, &disable, sizeof(disable)));
+	RETURN_ON_ERROR(esp_bt_controller_disable());
+	RETURN_ON_ERROR(esp_bt_controller_deinit());
+
+	ESP_LOGI(TAG, "Reading %u advertised, radio on for %d ms", sequence, (int)((esp_timer_get_time() - radio_on) / 1000));
+	return ESP_OK;
+}
@@ -0,0 +1,85 @@
+#include "math.h"
+
+#include "beacon_protocol.h"
+
+#define AD_TYPE_FLAGS 0x01
+#define AD_TYPE_MANUFACTURER 0xFF
+#define AD_FLAG_BR_EDR_NOT_SUPPORTED 0x04
+
+static void put_u16(uint8_t *buffer, uint16_t value) {
+	buffer[0] = value;
+	buffer[1] = value >> 8;
+}
+
+static uint16_t get_u16(const uint8_t *buffer) {
+	return buffer[0] | (buffer[1] << 8);
+}
+
+// Fixed point with two decimals, saturated to the field range
+static uint16_t encode_hundredths(float value, float min, float max, uint16_t missing) {
+	if (isnan(value))
+		return missing;
+
+	if (value < min)
+		value = min;
+	if (value > max)
+		value = max;
+
+	return (uint16_t)(int16_t)lroundf(value * 100);
+}
+
+size_t beacon_encode(const beacon_reading_t *reading, uint16_t company_id, uint8_t *adv, size_t capacity) {
+	if (capacity < BEACON_ADV_LEN)
+		return 0;
+
+	adv[0] = 2;
+	adv[1] = AD_TYPE_FLAGS;
+	adv[2] = AD_FLAG_BR_EDR_NOT_SUPPORTED;
+
+	uint8_t *data = adv + 3;
+	data[0] = BEACON_MANUFACTURER_LEN + 1;
+	data[1] = AD_TYPE_MANUFACTURER;
+	put_u16(data + 2, company_id);
+	data[4] = BEACON_MAGIC;
+	data[5] = BEACON_VERSION;
+	put_u16(data + 6, reading->sequence);
+	put_u16(data + 8, encode_hundredths(reading->temperature, -327.67f, 327.67f, (uint16_t)BEACON_TEMPERATURE_MISSING));
+	put_u16(data + 10, encode_hundredths(reading->humidity, 0, 100, BEACON_VALUE_MISSING));
+	put_u16(data + 12, reading->pm25);
+	put_u16(data + 14, reading->pm10);
+
+	return BEACON_ADV_LEN;
+}
+
+// Walks the AD structures of any advertisement - collectors see the node's packets among others
+bool beacon_decode(const uint8_t *adv, size_t len, uint16_t company_id, beacon_reading_t *reading) {
+	size_t offset = 0;
+
+	while (offset < len) {
+		size_t field_len = adv[offset];
+		if (field_len == 0 || offset + 1 + field_len > len)
+			return false;
+
+		const uint8_t *field = adv + offset + 1;
+		offset += 1 + field_len;
+
+		if (field[0] != AD_TYPE_MANUFACTURER || field_len - 1 < BEACON_MANUFACTURER_LEN)
+			continue;
+
+		const uint8_t *data = field + 1;
+		if (get_u16(data) != company_id || data[2] != BEACON_MAGIC || data[3] != BEACON_VERSION)
+			continue;
+
+		int16_t temperature = (int16_t)get_u16(data + 6);
+		uint16_t humidity = get_u16(data + 8);
+
+		reading->sequence = get_u16(data + 4);
+		reading->temperature = temperature == BEACON_TEMPERATURE_MISSING ? NAN : temperature / 100.0f;
+		reading->humidity = humidity == BEACON_VALUE_MISSING ? NAN : humidity / 100.0f;
+		reading->pm25 = get_u16(data + 10);
+		reading->pm10 = get_u16(data + 12);
+		return true;
+	}
+
+	return false;
+}
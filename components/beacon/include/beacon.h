@@ -0,0 +1,8 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "shared.h"
+
+// Advertises the reading for CONFIG_BEACON_BURST_MS - the radio is off again when it returns
+esp_err_t beacon_broadcast(const shared_data_t *reading);
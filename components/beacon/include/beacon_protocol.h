@@ -0,0 +1,41 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+// Latest reading broadcast in one legacy advertising packet (non-connectable, 31 bytes max)
+//
+// Advertising data, AD structures as in the Bluetooth Core Specification:
+//   Flags: 0x02 0x01 0x04 (BR/EDR not supported)
+//   Manufacturer specific data: length, 0xFF, then (little endian)
+//     company ID (2 bytes), magic 'V' (1 byte), version (1 byte), sequence (2 bytes),
+//     temperature (int16, 0.01 C), humidity (uint16, 0.01 %), PM2.5 (uint16, ug/m3), PM10 (uint16, ug/m3)
+//
+// The node is identified by its public device address. The sequence increases by one per wake,
+// so a collector drops the repeated copies of a burst and counts the wakes it missed.
+// A parameter that was not measured is sent as 0x8000 (temperature) or 0xFFFF.
+//
+// Plain C without ESP-IDF dependencies - beacon_decode() is the parser for C collectors, tools/decode_beacon.py
+// the one for hosts. Both are checked against beacon_encode() in tools/tests.
+
+#define BEACON_MAGIC 'V'
+#define BEACON_VERSION 1
+
+#define BEACON_ADV_MAX_LEN 31
+#define BEACON_ADV_LEN 19
+#define BEACON_MANUFACTURER_LEN 14 // After the AD type
+
+#define BEACON_TEMPERATURE_MISSING INT16_MIN
+#define BEACON_VALUE_MISSING UINT16_MAX
+
+typedef struct {
+	uint16_t sequence;
+	float temperature; // NAN when missing
+	float humidity;	   // NAN when missing
+	uint16_t pm25;	   // BEACON_VALUE_MISSING when missing
+	uint16_t pm10;
+} beacon_reading_t;
+
+size_t beacon_encode(const beacon_reading_t *reading, uint16_t company_id, uint8_t *adv, size_t capacity);
+bool beacon_decode(const uint8_t *adv, size_t len, uint16_t company_id, beacon_reading_t *reading);
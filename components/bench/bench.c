@@ -0,0 +1,142 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "bench.h"
+#include "helpers.h"
+#include "sensors.h"
+#include "shared.h"
+#include "sync.h"
+
+static const char *TAG = "MODULE[bench]";
+
+#define BENCH_BULK_SIZE 10
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+static const char *BENCH_CONFIG_JSON =
+	"{\"measurement_interval\":10,"
+	"\"environmental_bulk_size\":10,\"environmental_bulk_sleep\":5,"
+	"\"particulate_warm_up\":10,\"particulate_bulk_size\":5,\"particulate_bulk_sleep\":10,"
+	"\"wifi_ssid\":\"vogon-bench\",\"wifi_password\":\"secret-password\",\"wifi_protocol\":\"wpa2\","
+	"\"mqtt_broker_url\":\"mqtt://192.168.1.10:1883\"}";
+#endif
+
+// Query data response as returned by the SDS011 over UART (PM2.5 = 12.3, PM10 = 45.6)
+static const uint8_t BENCH_SDS011_RESPONSE[10] = {0xAA, 0xC0, 0x7B, 0x00, 0xC8, 0x01, 0x01, 0x02, 0x47, 0xAB};
+
+// High pulse durations (us) of a DHT22 response as captured by RMT (humidity = 65.2%, temperature = 35.1C)
+static const uint16_t BENCH_DHT22_TRACE[2 + DHT22_BITS] = {
+	31, 81,
+	27, 28, 26, 27, 28, 27, 69, 28, 70, 28, 26, 27, 71, 70, 26, 28,
+	27, 28, 26, 27, 28, 27, 26, 71, 27, 71, 26, 70, 71, 70, 69, 71,
+	70, 71, 69, 27, 71, 70, 69, 28};
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+static void bench_config_parse() {
+	static shared_config_t config;
+	shared_config_parse(BENCH_CONFIG_JSON, &config);
+}
+#endif
+
+static void bench_serialize_reading() {
+	char message[SYNC_READING_MAX_LEN];
+	sync_serialize_reading(message, sizeof(message), "AA:BB:CC:DD:EE:FF", 1700000000, &backlog_columns[0], 123);
+}
+
+// Framing and checksum only - the UART round trip is not part of it
+static void bench_sds011_frame_and_check() {
+	static const uint8_t payload[13] = {0x04};
+	uint8_t command[19];
+
+	sds011_frame_command(payload, command);
+	sds011_check_response(BENCH_SDS011_RESPONSE);
+}
+
+static void bench_dht22_decode() {
+	float temperature;
+	float humidity;
+
+	dht22_decode(BENCH_DHT22_TRACE, sizeof(BENCH_DHT22_TRACE) / sizeof(uint16_t), &temperature, &humidity);
+}
+
+static void bench_bulk_aggregation() {
+	sample_stats_t stats;
+	sample_stats_reset(&stats);
+
+	for (int i = 0; i < BENCH_BULK_SIZE; i++)
+		sample_stats_add(&stats, 21.5f + i * 0.1f);
+
+	volatile float mean = sample_stats_mean(&stats);
+	(void)mean;
+}
+
+static void bench_sample_ring() {
+	static sample_ring_t ring;
+	const sensor_sample_t sample = {.timestamp = 1700000000, .values = {21.5f, 45.2f}};
+	sensor_sample_t popped;
+
+	sample_ring_push(&ring, &sample);
+	sample_ring_pop(&ring, &popped);
+}
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+static void bench_nvs_read_str() {
+	char *value = NULL;
+	size_t len = 0;
+
+	nvs_read_str(NVS_KEY_CONFIG, &value, &len, "{}");
+	free(value);
+}
+#endif
+
+static void bench_case(const char *name, void (*fn)()) {
+	alloc_stats_t before;
+	alloc_stats_t after;
+
+	fn(); // Warm up caches and lazily initialized state
+
+	alloc_stats_get(&before);
+	int64_t start = esp_timer_get_time();
+
+	for (int i = 0; i < CONFIG_BENCH_ITERATIONS; i++)
+		fn();
+
+	int64_t elapsed_us = esp_timer_get_time() - start;
+	alloc_stats_get(&after);
+
+	uint32_t allocs = after.count - before.count;
+	uint32_t bytes = after.bytes - before.bytes;
+
+	// Integers only - newlib nano printf has no float or 64-bit support. Allocations are per 1000 ops,
+	// a path allocating once every few calls would round to 0 per op.
+	printf("BENCH {\"version\":\"%s\",\"name\":\"%s\",\"iterations\":%d,"
+		   "\"ns_per_op\":%lu,\"allocs_per_1000_ops\":%lu,\"bytes_per_1000_ops\":%lu,"
+		   "\"allocs_total\":%lu,\"bytes_total\":%lu}\n",
+		   esp_app_get_description()->version, name, CONFIG_BENCH_ITERATIONS,
+		   (unsigned long)(elapsed_us * 1000 / CONFIG_BENCH_ITERATIONS),
+		   (unsigned long)((uint64_t)allocs * 1000 / CONFIG_BENCH_ITERATIONS),
+		   (unsigned long)((uint64_t)bytes * 1000 / CONFIG_BENCH_ITERATIONS),
+		   (unsigned long)allocs, (unsigned long)bytes);
+}
+
+void bench_run() {
+	ESP_LOGI(TAG, "Running %d iterations per benchmark...", CONFIG_BENCH_ITERATIONS);
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+	bench_case("shared_config_parse", bench_config_parse);
+#endif
+	bench_case("publish_serialize", bench_serialize_reading);
+	bench_case("sds011_frame_and_check", bench_sds011_frame_and_check);
+	bench_case("dht22_decode", bench_dht22_decode);
+	bench_case("bulk_aggregation", bench_bulk_aggregation);
+	bench_case("sample_ring", bench_sample_ring);
+#if !CONFIG_VOGON_BAKED_CONFIG
+	bench_case("nvs_read_str", bench_nvs_read_str);
+#endif
+
+	ESP_LOGI(TAG, "Benchmarks finished");
+}
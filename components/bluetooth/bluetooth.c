@@ -12,6 +12,7 @@
 #include "esp_log.h"
 #include "esp_system.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/queue.h"
 #include "nvs.h"
 #include "nvs_flash.h"
@@ -19,9 +20,11 @@
 #include "bluetooth.h"
 #include "internal/led.h"
 
+#include "helpers.h"
 #include "shared.h"
+#include "trace.h"
 
-// static const char *TAG = "MODULE[bluetooth]";
+static const char *TAG = "MODULE[bluetooth]";
 static const char *TAG_MAIN = "MODULE[bluetooth][main]";
 static const char *TAG_GATTS = "MODULE[bluetooth][gatts]";
 static const char *TAG_GATTS_PROFILE = "MODULE[bluetooth][gatts_profile]";
@@ -32,20 +35,16 @@ static const char *TAG_GAP = "MODULE[bluetooth][gap]";
 #define PROFILE_APP_IDX 0
 #define PROFILE_APP_ID 0x00
 
-// Type declaration
+// Application error (0x80-0x9F) returned for a configuration that doesn't parse or pass validation
+#define GATT_CONFIG_INVALID ((esp_gatt_status_t)0x80)
 
-static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
+#define CONFIG_APPLIED_BIT BIT0
+#define CLIENT_DISCONNECTED_BIT BIT1
+#define DISCONNECT_TIMEOUT_MS 1000
 
-typedef enum {
-	TYPE_INT,
-	TYPE_STR
-} handle_type_t;
+// Type declaration
 
-typedef struct {
-	uint16_t handle;
-	const char *key;
-	handle_type_t type;
-} handle_mapping_t;
+static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param);
 
 // Profiles setup
 
@@ -58,27 +57,42 @@ static struct gatts_profile_instance {
 		.gatts_if = ESP_GATT_IF_NONE,
 	}};
 
+static EventGroupHandle_t provisioning_events;
+static TaskHandle_t led_task_handle;
+static bool stopping = false;
+
+static esp_gatt_if_t client_gatts_if = ESP_GATT_IF_NONE;
+static uint16_t client_conn_id;
+static bool client_connected = false;
+
 // Configuration service constants
 
 static const uint16_t primary_service_uuid = ESP_GATT_UUID_PRI_SERVICE;
 static const uint16_t characteristic_declaration_uuid = ESP_GATT_UUID_CHAR_DECLARE;
 static const uint16_t characteristic_declaration_size = sizeof(uint8_t);
 static uint8_t characteristic_prop_read_write = ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_WRITE;
+static uint8_t characteristic_prop_read = ESP_GATT_CHAR_PROP_BIT_READ;
 
 static uint8_t config_service_uuid[ESP_UUID_LEN_128] = {
 	// Configuration service uuid: d0a823a6-fa98-4597-b0c1-d8577be0e158
 	0x58, 0xE1, 0xE0, 0x7B, 0x57, 0xD8, 0xC1, 0xB0, 0x97, 0x45, 0x98, 0xFA, 0xA6, 0x23, 0xA8, 0xD0};
 
-#define NUM_CHARACTERISTICS 1
+#define NUM_CHARACTERISTICS 2
 static const uint16_t config_characteristic_uuid = 0x0101;
 static const size_t config_characteristic_value_size = 1024;
 
+// Trace ring dump (see trace.h) - read in slices with increasing offsets
+static const uint16_t trace_characteristic_uuid = 0x0102;
+
 enum {
 	CONFIG_SERVICE_DECLARATION_IDX,
 
 	CONFIG_CHARACTERISTIC_IDX,
 	CONFIG_VALUE_IDX,
 
+	TRACE_CHARACTERISTIC_IDX,
+	TRACE_VALUE_IDX,
+
 	CONFIG_SERVICE_IDX_MAX
 };
 
@@ -167,6 +181,9 @@ static const esp_gatts_attr_db_t gatts_attr_db[CONFIG_SERVICE_IDX_MAX] =
 		[CONFIG_CHARACTERISTIC_IDX] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&characteristic_declaration_uuid, ESP_GATT_PERM_READ, characteristic_declaration_size, characteristic_declaration_size, &characteristic_prop_read_write}},
 		[CONFIG_VALUE_IDX] = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16, (uint8_t *)&config_characteristic_uuid, ESP_GATT_PERM_READ | ESP_GATT_PERM_WRITE, config_characteristic_value_size, 0, NULL}},
 
+		[TRACE_CHARACTERISTIC_IDX] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&characteristic_declaration_uuid, ESP_GATT_PERM_READ, characteristic_declaration_size, characteristic_declaration_size, &characteristic_prop_read}},
+		[TRACE_VALUE_IDX] = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16, (uint8_t *)&trace_characteristic_uuid, ESP_GATT_PERM_READ, TRACE_DUMP_MAX_LEN, 0, NULL}},
+
 		// Characteristic user description (user-readable name) descriptor
 		// [XXXXX] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, (uint8_t *)&characteristic_description_uuid, ESP_GATT_PERM_READ, sizeof(characteristic_name), sizeof(characteristic_name) - 1, characteristic_name}},
 };
@@ -224,10 +241,22 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 			ESP_LOGI(TAG_GATTS_PROFILE, "[ESP_GATTS_CONNECT_EVT]: Client %02x:%02x:%02x:%02x:%02x:%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
 			esp_ble_gap_stop_advertising();
 			bt_led_state = LED_ON;
+
+			client_gatts_if = gatts_if;
+			client_conn_id = param->connect.conn_id;
+			client_connected = true;
+			xEventGroupClearBits(provisioning_events, CLIENT_DISCONNECTED_BIT);
 			break;
 		}
 
 		case ESP_GATTS_DISCONNECT_EVT:
+			client_connected = false;
+			xEventGroupSetBits(provisioning_events, CLIENT_DISCONNECTED_BIT);
+
+			// The configuration is applied - the server is being torn down
+			if (stopping)
+				break;
+
 			ESP_LOGI(TAG_GATTS_PROFILE, "[ESP_GATTS_DISCONNECT_EVT]: Restarting advertising");
 			esp_ble_gap_start_advertising(&adv_params);
 			bt_led_state = LED_BLINK_SLOW;
@@ -264,7 +293,7 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 				rsp.attr_value.len = len;
 				rsp.attr_value.handle = handle;
 
-				ESP_LOG_BUFFER_HEXDUMP(TAG_GATTS_PROFILE, data, len, ESP_LOG_INFO);
+				TRACE(TRACE_BLE_CONFIG_READ, offset, len);
 
 				esp_ble_gatts_send_response(gatts_if, conn_id, trans_id, ESP_GATT_OK, &rsp);
 				free(data);
@@ -276,6 +305,29 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 				return;
 			}
 
+			if (handle == config_service_handle_table[TRACE_VALUE_IDX]) {
+				static esp_gatt_rsp_t rsp;
+				static uint8_t dump[TRACE_DUMP_MAX_LEN];
+				static size_t dump_len;
+
+				// Snapshot on the first slice - the following slices are served from it
+				if (offset == 0)
+					dump_len = trace_dump(dump, sizeof(dump));
+
+				memset(&rsp, 0, sizeof(rsp));
+
+				size_t len = offset < dump_len ? dump_len - offset : 0;
+				if (len > sizeof(rsp.attr_value.value))
+					len = sizeof(rsp.attr_value.value);
+
+				memcpy(rsp.attr_value.value, dump + offset, len);
+				rsp.attr_value.len = len;
+				rsp.attr_value.handle = handle;
+
+				esp_ble_gatts_send_response(gatts_if, conn_id, trans_id, ESP_GATT_OK, &rsp);
+				return;
+			}
+
 			break;
 		}
 
@@ -288,8 +340,8 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 			uint16_t len = param->write.len;
 			const uint8_t *data = param->write.value;
 
-			ESP_LOGI(TAG_GATTS_PROFILE, "[ESP_GATTS_WRITE_EVT]: Length %d", len);
-			ESP_LOG_BUFFER_HEXDUMP(TAG_GATTS_PROFILE, data, len, ESP_LOG_INFO);
+			// The payload holds Wi-Fi credentials - only its length is recorded
+			TRACE(TRACE_BLE_CONFIG_WRITTEN, len);
 
 			if (param->write.is_prep) {
 				esp_ble_gatts_send_response(gatts_if, conn_id, trans_id, ESP_GATT_WRITE_NOT_PERMIT, NULL);
@@ -297,7 +349,7 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 			}
 
 			if (handle == config_service_handle_table[CONFIG_VALUE_IDX]) {
-				static char null_terminated_data[1024];
+				static char null_terminated_data[SHARED_CONFIG_MAX_LEN];
 
 				if (len >= sizeof(null_terminated_data)) {
 					ESP_LOGE(TAG_GATTS_PROFILE, "String data too long");
@@ -308,18 +360,19 @@ static void gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_
 				memcpy(null_terminated_data, data, len);
 				null_terminated_data[len] = '\0';
 
-				nvs_handle_t nvs_handle;
-				ret = nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
-				if (ret != ESP_OK) goto handle_write_error;
-
-				ret = nvs_set_str(nvs_handle, NVS_KEY_CONFIG, null_terminated_data);
-				if (ret != ESP_OK) goto handle_write_error;
+				// Rejected before it is stored - the client sees the error and the old configuration stays
+				static shared_config_t config;
+				if (shared_config_parse(null_terminated_data, &config) != ESP_OK) {
+					ESP_LOGE(TAG_GATTS_PROFILE, "Rejected invalid configuration");
+					esp_ble_gatts_send_response(gatts_if, conn_id, trans_id, GATT_CONFIG_INVALID, NULL);
+					return;
+				}
 
-				ret = nvs_commit(nvs_handle);
+				ret = shared_config_store(null_terminated_data);
 				if (ret != ESP_OK) goto handle_write_error;
 
-				nvs_close(nvs_handle);
 				esp_ble_gatts_send_response(gatts_if, conn_id, trans_id, ESP_GATT_OK, NULL);
+				xEventGroupSetBits(provisioning_events, CONFIG_APPLIED_BIT);
 				return;
 			}
 
@@ -377,6 +430,12 @@ static void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_
 
 void bluetooth_gatt_server_start() {
 	bt_led_state = LED_OFF;
+	stopping = false;
+
+	if (provisioning_events == NULL)
+		provisioning_events = xEventGroupCreate();
+	xEventGroupClearBits(provisioning_events, CONFIG_APPLIED_BIT);
+	xEventGroupSetBits(provisioning_events, CLIENT_DISCONNECTED_BIT);
 
 	xTaskCreatePinnedToCore(
 		led_task,
@@ -384,10 +443,14 @@ void bluetooth_gatt_server_start() {
 		configMINIMAL_STACK_SIZE * 8,
 		NULL,
 		10,
-		NULL,
+		&led_task_handle,
 		APP_CPU_NUM);
 
-	esp_err_t ret;
+	esp_err_t ret = shared_nvs_init_default();
+	if (ret) {
+		ESP_LOGE(TAG_MAIN, "%s init nvs failed", __func__);
+		return;
+	}
 
 	esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
 	ret = esp_bt_controller_init(&bt_cfg);
@@ -434,19 +497,38 @@ void bluetooth_gatt_server_start() {
 	return;
 }
 
+void bluetooth_wait_for_config() {
+	xEventGroupWaitBits(provisioning_events, CONFIG_APPLIED_BIT, pdTRUE, pdTRUE, portMAX_DELAY);
+}
+
+esp_err_t bluetooth_gatt_server_stop() {
+	stopping = true;
+
+	// Queued behind the write response - the client gets the acknowledgement first
+	if (client_connected)
+		esp_ble_gatts_close(client_gatts_if, client_conn_id);
+
+	xEventGroupWaitBits(provisioning_events, CLIENT_DISCONNECTED_BIT, pdFALSE, pdTRUE, pdMS_TO_TICKS(DISCONNECT_TIMEOUT_MS));
+
+	esp_ble_gap_stop_advertising();
+	RETURN_ON_ERROR(esp_bluedroid_disable());
+	RETURN_ON_ERROR(esp_bluedroid_deinit());
+	RETURN_ON_ERROR(esp_bt_controller_disable());
+	RETURN_ON_ERROR(esp_bt_controller_deinit());
+
+	if (led_task_handle != NULL) {
+		vTaskDelete(led_task_handle);
+		led_task_handle = NULL;
+	}
+	led_off();
+
+	ESP_LOGI(TAG_MAIN, "Bluetooth stopped");
+	return ESP_OK;
+}
+
 QueueHandle_t gpio_evt_queue;
 
 void IRAM_ATTR gpio_isr_handler(void *arg) {
 	int pin = (int)arg;
 	xQueueSendFromISR(gpio_evt_queue, &pin, NULL);
 }
-
-void bluetooth_gat_server_trigger_task() {
-	int pin;
-
-	while (true) {
-		if (xQueueReceive(gpio_evt_queue, &pin, portMAX_DELAY)) {
-			bluetooth_gatt_server_start();
-		}
-	}
-}
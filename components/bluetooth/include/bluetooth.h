@@ -2,5 +2,10 @@ extern QueueHandle_t gpio_evt_queue;
 
 void bluetooth_gatt_server_start();
 
+// Blocks until a configuration was validated and stored over GATT
+void bluetooth_wait_for_config();
+
+// Disconnects the client and frees the Bluetooth stack - the node continues with its first cycle
+esp_err_t bluetooth_gatt_server_stop();
+
 void gpio_isr_handler(void *arg);
-void bluetooth_gat_server_trigger_task();
@@ -47,3 +47,8 @@ void led_task() {
 		}
 	}
 }
+
+// After the task was deleted - it may have stopped with the LED on
+void led_off() {
+	gpio_set_level(LED_GPIO, 0);
+}
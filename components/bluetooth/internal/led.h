@@ -7,3 +7,4 @@ typedef enum {
 
 extern bt_led_state_t bt_led_state;
 void led_task();
+void led_off();
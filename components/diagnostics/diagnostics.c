@@ -0,0 +1,182 @@
+#include "stdint.h"
+#include "string.h"
+#include "sys/time.h"
+#include "time.h"
+
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "sdkconfig.h"
+
+#include "helpers.h"
+
+#include "diagnostics.h"
+
+#define DIAG_UNSET UINT32_MAX
+
+static const char *TAG = "MODULE[diagnostics]";
+
+RTC_DATA_ATTR diag_record_t diag_record = {0};
+
+// System time the timer wake-up is due at - RTC keeps the clock running in deep sleep
+RTC_DATA_ATTR static int64_t expected_wake_us = 0;
+
+static const char *phase_names[DIAG_PHASE_MAX] = {
+	[DIAG_PHASE_BOOT] = "boot",
+	[DIAG_PHASE_MEASURE] = "measure",
+	[DIAG_PHASE_SYNC] = "sync"};
+
+static const char *task_names[DIAG_TASK_MAX] = {
+	[DIAG_TASK_MAIN] = "main",
+	[DIAG_TASK_DHT22] = "dht22",
+	[DIAG_TASK_SDS011] = "sds011",
+	[DIAG_TASK_GPIO] = "gpio_task"};
+
+static inline void keep_min(uint32_t *current, uint32_t value) {
+	if (value < *current)
+		*current = value;
+}
+
+void diag_reset() {
+	memset(&diag_record, 0xFF, sizeof(diag_record));
+	diag_record.initialized = true;
+	diag_record.cycles = 0;
+	diag_record.wake_to_sample_ms = 0;
+	diag_record.last_wake_to_sample_ms = 0;
+	diag_record.battery_last_mv = 0;
+	diag_record.warm_up_ms = 0;
+	diag_record.last_warm_up_ms = 0;
+	diag_record.warm_up_total_ms = 0;
+	diag_record.warm_up_count = 0;
+}
+
+void diag_begin_cycle() {
+	if (!diag_record.initialized)
+		diag_reset();
+
+	diag_record.cycles++;
+}
+
+void diag_capture_phase(diag_phase_t phase) {
+	diag_heap_t *heap = &diag_record.phases[phase];
+
+	keep_min(&heap->free_heap, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+	keep_min(&heap->min_free_heap, heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+	keep_min(&heap->largest_free_block, heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+
+	diag_capture_task(DIAG_TASK_MAIN, NULL);
+}
+
+// Pass NULL from within the task itself, e.g. right before vTaskDelete(NULL)
+void diag_capture_task(diag_task_t task, TaskHandle_t handle) {
+	keep_min(&diag_record.stack_high_water[task], uxTaskGetStackHighWaterMark(handle));
+}
+
+static int64_t now_us() {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+// Covers ROM, bootloader and app start-up - everything esp_timer_get_time() misses
+void diag_capture_first_sample() {
+	if (expected_wake_us == 0 || esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER)
+		return;
+
+	int64_t latency_us = now_us() - expected_wake_us;
+	expected_wake_us = 0;
+
+	if (latency_us < 0)
+		return;
+
+	uint32_t latency_ms = latency_us / 1000;
+	ESP_LOGI(TAG, "Wake to first sample: %lu ms", (unsigned long)latency_ms);
+
+	diag_record.last_wake_to_sample_ms = latency_ms;
+	if (latency_ms > diag_record.wake_to_sample_ms)
+		diag_record.wake_to_sample_ms = latency_ms;
+}
+
+void diag_prepare_sleep(uint64_t sleep_us) {
+	expected_wake_us = now_us() + sleep_us;
+}
+
+void diag_capture_battery(uint32_t millivolts, uint32_t band) {
+	if (diag_record.battery_first_mv == DIAG_UNSET) {
+		diag_record.battery_first_mv = millivolts;
+		diag_record.battery_first_time = time(NULL);
+	}
+
+	keep_min(&diag_record.battery_min_mv, millivolts);
+	diag_record.battery_last_mv = millivolts;
+	diag_record.battery_band = band;
+}
+
+void diag_capture_warm_up(uint32_t warm_up_ms) {
+	if (warm_up_ms > diag_record.warm_up_ms)
+		diag_record.warm_up_ms = warm_up_ms;
+
+	diag_record.last_warm_up_ms = warm_up_ms;
+	diag_record.warm_up_total_ms += warm_up_ms;
+	diag_record.warm_up_count++;
+}
+
+bool diag_upload_due() {
+	return diag_record.cycles >= CONFIG_DIAGNOSTICS_UPLOAD_INTERVAL;
+}
+
+size_t diag_serialize(const char *address, char *buffer, size_t capacity) {
+	text_buffer_t text;
+	text_init(&text, buffer, capacity);
+	text_append(&text, "{\"address\":\"%s\",\"cycles\":%lu", address, (unsigned long)diag_record.cycles);
+
+	const char *separator = "";
+	text_append(&text, ",\"heap\":{");
+	for (int i = 0; i < DIAG_PHASE_MAX; i++) {
+		const diag_heap_t *heap = &diag_record.phases[i];
+		if (heap->free_heap == DIAG_UNSET) continue;
+
+		text_append(&text, "%s\"%s\":{\"free\":%lu,\"min_free\":%lu,\"largest_block\":%lu}",
+					separator, phase_names[i], (unsigned long)heap->free_heap, (unsigned long)heap->min_free_heap, (unsigned long)heap->largest_free_block);
+		separator = ",";
+	}
+
+	separator = "";
+	text_append(&text, "},\"stack_high_water\":{");
+	for (int i = 0; i < DIAG_TASK_MAX; i++) {
+		if (diag_record.stack_high_water[i] == DIAG_UNSET) continue;
+		text_append(&text, "%s\"%s\":%lu", separator, task_names[i], (unsigned long)diag_record.stack_high_water[i]);
+		separator = ",";
+	}
+	text_append(&text, "}");
+
+	if (diag_record.last_wake_to_sample_ms > 0) {
+		text_append(&text, ",\"wake_to_sample_ms\":{\"max\":%lu,\"last\":%lu}",
+					(unsigned long)diag_record.wake_to_sample_ms, (unsigned long)diag_record.last_wake_to_sample_ms);
+	}
+
+	if (diag_record.warm_up_count > 0) {
+		text_append(&text, ",\"warm_up_ms\":{\"max\":%lu,\"last\":%lu,\"mean\":%lu}",
+					(unsigned long)diag_record.warm_up_ms, (unsigned long)diag_record.last_warm_up_ms,
+					(unsigned long)(diag_record.warm_up_total_ms / diag_record.warm_up_count));
+	}
+
+	if (diag_record.battery_last_mv > 0) {
+		text_append(&text, ",\"battery\":{\"mv\":%lu,\"min_mv\":%lu,\"band\":%lu",
+					(unsigned long)diag_record.battery_last_mv, (unsigned long)diag_record.battery_min_mv, (unsigned long)diag_record.battery_band);
+
+		// Over at least an hour - shorter windows are ADC noise and the load of the last cycle
+		int64_t elapsed = (int64_t)time(NULL) - diag_record.battery_first_time;
+		if (elapsed >= 3600) {
+			int64_t change = (int64_t)diag_record.battery_last_mv - diag_record.battery_first_mv;
+			text_append(&text, ",\"trend_mv_per_day\":");
+			text_append_fixed(&text, (int32_t)(change * 864000 / elapsed), 1);
+		}
+
+		text_append(&text, "}");
+	}
+
+	text_append(&text, "}");
+	return text_overflowed(&text) ? 0 : text.length;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+typedef enum {
+	DIAG_PHASE_BOOT,	// Configuration loaded
+	DIAG_PHASE_MEASURE, // Sensor tasks finished
+	DIAG_PHASE_SYNC,	// Upload finished
+
+	DIAG_PHASE_MAX
+} diag_phase_t;
+
+typedef enum {
+	DIAG_TASK_MAIN,
+	DIAG_TASK_DHT22,
+	DIAG_TASK_SDS011,
+	DIAG_TASK_GPIO,
+
+	DIAG_TASK_MAX
+} diag_task_t;
+
+typedef struct {
+	uint32_t free_heap;
+	uint32_t min_free_heap;
+	uint32_t largest_free_block;
+} diag_heap_t;
+
+// Worst values observed since the last upload - kept in RTC memory
+typedef struct {
+	bool initialized; // RTC memory is zeroed on a cold boot only
+	uint32_t cycles;
+	diag_heap_t phases[DIAG_PHASE_MAX];
+	uint32_t stack_high_water[DIAG_TASK_MAX]; // Bytes of stack never used
+	uint32_t wake_to_sample_ms;				  // Timer wake-up to first sample, worst and latest
+	uint32_t last_wake_to_sample_ms;
+	uint32_t battery_first_mv; // Battery voltage over the upload window - first, lowest and latest
+	uint32_t battery_first_time;
+	uint32_t battery_min_mv;
+	uint32_t battery_last_mv;
+	uint32_t battery_band;
+	uint32_t warm_up_ms;	  // SDS011 warm-up - worst, latest and total over warm_up_count wakes
+	uint32_t last_warm_up_ms;
+	uint32_t warm_up_total_ms;
+	uint32_t warm_up_count;
+} diag_record_t;
+
+extern diag_record_t diag_record;
+
+void diag_begin_cycle();
+void diag_capture_phase(diag_phase_t phase);
+void diag_capture_task(diag_task_t task, TaskHandle_t handle);
+void diag_capture_first_sample();
+void diag_capture_battery(uint32_t millivolts, uint32_t band);
+void diag_capture_warm_up(uint32_t warm_up_ms);
+void diag_prepare_sleep(uint64_t sleep_us);
+
+bool diag_upload_due();
+// Writes the telemetry JSON into buffer, returns its length or 0 if it didn't fit
+size_t diag_serialize(const char *address, char *buffer, size_t capacity);
+// Starts a new upload window - figures captured afterwards, this cycle included, go out with the next telemetry
+void diag_reset();
@@ -0,0 +1,151 @@
+#include "block.h"
+
+static void put_byte(block_encoder_t *encoder, uint8_t byte) {
+	if (encoder->length >= encoder->capacity) {
+		encoder->overflow = true;
+		return;
+	}
+
+	encoder->buffer[encoder->length++] = byte;
+}
+
+static void put_varint(block_encoder_t *encoder, uint32_t value) {
+	while (value >= 0x80) {
+		put_byte(encoder, (uint8_t)(value | 0x80));
+		value >>= 7;
+	}
+
+	put_byte(encoder, (uint8_t)value);
+}
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+typedef struct {
+	const uint8_t *data;
+	size_t length;
+	size_t position;
+	bool error;
+} block_reader_t;
+
+static uint8_t get_byte(block_reader_t *reader) {
+	if (reader->position >= reader->length) {
+		reader->error = true;
+		return 0;
+	}
+
+	return reader->data[reader->position++];
+}
+
+static uint32_t get_varint(block_reader_t *reader) {
+	uint32_t value = 0;
+
+	for (int shift = 0; shift < 35; shift += 7) {
+		uint8_t byte = get_byte(reader);
+		value |= (uint32_t)(byte & 0x7F) << shift;
+
+		if (!(byte & 0x80))
+			return value;
+	}
+
+	reader->error = true;
+	return 0;
+}
+
+void block_encoder_init(block_encoder_t *encoder, uint8_t *buffer, size_t capacity, const uint8_t device_id[BLOCK_DEVICE_ID_LEN], uint8_t column_count) {
+	encoder->buffer = buffer;
+	encoder->capacity = capacity;
+	encoder->length = 0;
+	encoder->overflow = false;
+	encoder->remaining = 0;
+
+	put_byte(encoder, BLOCK_MAGIC_0);
+	put_byte(encoder, BLOCK_MAGIC_1);
+	put_byte(encoder, BLOCK_VERSION);
+
+	for (int i = 0; i < BLOCK_DEVICE_ID_LEN; i++)
+		put_byte(encoder, device_id[i]);
+
+	put_varint(encoder, column_count);
+}
+
+void block_encoder_begin_column(block_encoder_t *encoder, uint16_t sensor, uint8_t parameter, uint8_t scale, uint32_t count) {
+	if (encoder->remaining != 0)
+		encoder->overflow = true; // Previous column not complete
+
+	put_varint(encoder, sensor);
+	put_varint(encoder, parameter);
+	put_byte(encoder, scale);
+	put_varint(encoder, count);
+
+	encoder->remaining = count;
+	encoder->previous_timestamp = 0;
+	encoder->previous_value = 0;
+}
+
+void block_encoder_append(block_encoder_t *encoder, uint32_t timestamp, int32_t value) {
+	if (encoder->remaining == 0) {
+		encoder->overflow = true;
+		return;
+	}
+
+	// First sample of a column is stored as-is (deltas from zero)
+	put_varint(encoder, zigzag((int32_t)(timestamp - encoder->previous_timestamp)));
+	put_varint(encoder, zigzag(value - encoder->previous_value));
+
+	encoder->previous_timestamp = timestamp;
+	encoder->previous_value = value;
+	encoder->remaining--;
+}
+
+size_t block_encoder_finish(block_encoder_t *encoder) {
+	if (encoder->overflow || encoder->remaining != 0)
+		return 0;
+
+	return encoder->length;
+}
+
+size_t block_restamp(const uint8_t *block, size_t len, int32_t offset, uint8_t *buffer, size_t capacity) {
+	block_reader_t reader = {.data = block, .length = len};
+	block_encoder_t encoder = {.buffer = buffer, .capacity = capacity};
+
+	// Header and device id are copied as they are
+	for (int i = 0; i < 3 + BLOCK_DEVICE_ID_LEN; i++)
+		put_byte(&encoder, get_byte(&reader));
+
+	if (reader.error || block[0] != BLOCK_MAGIC_0 || block[1] != BLOCK_MAGIC_1 || block[2] != BLOCK_VERSION)
+		return 0;
+
+	uint32_t columns = get_varint(&reader);
+	put_varint(&encoder, columns);
+
+	for (uint32_t c = 0; c < columns && !reader.error; c++) {
+		put_varint(&encoder, get_varint(&reader)); // Sensor
+		put_varint(&encoder, get_varint(&reader)); // Parameter
+		put_byte(&encoder, get_byte(&reader));	   // Scale
+
+		uint32_t count = get_varint(&reader);
+		put_varint(&encoder, count);
+
+		for (uint32_t i = 0; i < count && !reader.error; i++) {
+			uint32_t timestamp_delta = get_varint(&reader);
+
+			// Later timestamps are deltas from the first, which carries the whole shift
+			if (i == 0)
+				timestamp_delta = zigzag((int32_t)((uint32_t)unzigzag(timestamp_delta) + (uint32_t)offset));
+
+			put_varint(&encoder, timestamp_delta);
+			put_varint(&encoder, get_varint(&reader)); // Value delta
+		}
+	}
+
+	if (reader.error || reader.position != len || encoder.overflow)
+		return 0;
+
+	return encoder.length;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+// Compact columnar time-series block used for backlog uploads
+//
+// Layout (all integers are LEB128 varints unless noted):
+//   magic "VB" (2 bytes), version (1 byte), device id (6 bytes), column count
+//   for each column:
+//     sensor, parameter, scale (1 byte, value = raw / 10^scale), sample count
+//     for each sample: timestamp delta, value delta (both zigzag, first sample relative to 0)
+//
+// Plain C without ESP-IDF dependencies so it builds on the host as well.
+// tools/decode_block.py is the reference decoder.
+
+#define BLOCK_MAGIC_0 'V'
+#define BLOCK_MAGIC_1 'B'
+#define BLOCK_VERSION 1
+#define BLOCK_DEVICE_ID_LEN 6
+
+// Worst case encoded size of a column / block, for sizing buffers
+#define BLOCK_HEADER_MAX_LEN (3 + BLOCK_DEVICE_ID_LEN + 5)
+#define BLOCK_COLUMN_MAX_LEN(samples) (3 + 2 + 1 + 5 + (samples) * (5 + 5))
+
+// Restamping rewrites the first timestamp of each column - from 1 byte to 5 at most
+#define BLOCK_RESTAMP_MAX_GROWTH(columns) ((columns) * 4)
+
+typedef struct {
+	uint8_t *buffer;
+	size_t capacity;
+	size_t length;
+	bool overflow;
+
+	uint32_t remaining; // Samples left in the current column
+	uint32_t previous_timestamp;
+	int32_t previous_value;
+} block_encoder_t;
+
+void block_encoder_init(block_encoder_t *encoder, uint8_t *buffer, size_t capacity, const uint8_t device_id[BLOCK_DEVICE_ID_LEN], uint8_t column_count);
+void block_encoder_begin_column(block_encoder_t *encoder, uint16_t sensor, uint8_t parameter, uint8_t scale, uint32_t count);
+void block_encoder_append(block_encoder_t *encoder, uint32_t timestamp, int32_t value);
+
+// Returns the encoded length, or 0 if the buffer overflowed or a column is incomplete
+size_t block_encoder_finish(block_encoder_t *encoder);
+
+// Copies `block` into `buffer` with every timestamp moved by `offset` seconds
+// Returns the new length, or 0 if the block is malformed or didn't fit
+size_t block_restamp(const uint8_t *block, size_t len, int32_t offset, uint8_t *buffer, size_t capacity);
@@ -1,6 +1,15 @@
 #include "stdarg.h"
 #include "stdint.h"
 #include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "helpers.h"
 
 #define MAC_LEN 18
 
@@ -23,3 +32,78 @@ char *dynamic_format(const char *fmt, ...) {
 
 	return buffer;
 }
+
+#if CONFIG_VOGON_ALLOC_CHECK
+#define ALLOC_SCOPE_TASKS 4
+
+// Tasks inside an allocation scope - main and the sensor tasks at most
+static TaskHandle_t scoped_tasks[ALLOC_SCOPE_TASKS];
+static uint32_t scoped_allocs;
+static portMUX_TYPE scope_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static IRAM_ATTR bool in_scope() {
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+	if (task == NULL)
+		return false;
+
+	for (int i = 0; i < ALLOC_SCOPE_TASKS; i++)
+		if (scoped_tasks[i] == task)
+			return true;
+
+	return false;
+}
+
+void alloc_scope_begin() {
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+	taskENTER_CRITICAL(&scope_lock);
+	for (int i = 0; i < ALLOC_SCOPE_TASKS; i++) {
+		if (scoped_tasks[i] == NULL || scoped_tasks[i] == task) {
+			scoped_tasks[i] = task;
+			break;
+		}
+	}
+	taskEXIT_CRITICAL(&scope_lock);
+}
+
+void alloc_scope_end() {
+	TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+	taskENTER_CRITICAL(&scope_lock);
+	for (int i = 0; i < ALLOC_SCOPE_TASKS; i++)
+		if (scoped_tasks[i] == task)
+			scoped_tasks[i] = NULL;
+	taskEXIT_CRITICAL(&scope_lock);
+}
+
+uint32_t alloc_scope_take() {
+	return __atomic_exchange_n(&scoped_allocs, 0, __ATOMIC_RELAXED);
+}
+#endif
+
+#if CONFIG_HEAP_USE_HOOKS
+// Counters fed by the heap allocator hooks, see CONFIG_HEAP_USE_HOOKS
+static alloc_stats_t alloc_stats = {0};
+
+void IRAM_ATTR esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps) {
+	__atomic_fetch_add(&alloc_stats.count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&alloc_stats.bytes, size, __ATOMIC_RELAXED);
+
+#if CONFIG_VOGON_ALLOC_CHECK
+	if (in_scope())
+		__atomic_fetch_add(&scoped_allocs, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+void IRAM_ATTR esp_heap_trace_free_hook(void *ptr) {
+}
+#endif
+
+void alloc_stats_get(alloc_stats_t *stats) {
+#if CONFIG_HEAP_USE_HOOKS
+	stats->count = __atomic_load_n(&alloc_stats.count, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&alloc_stats.bytes, __ATOMIC_RELAXED);
+#else
+	memset(stats, 0, sizeof(alloc_stats_t));
+#endif
+}
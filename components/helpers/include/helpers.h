@@ -1,3 +1,11 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "sdkconfig.h"
+
 #define RETURN_ON_ERROR(x)                                              \
 	do {                                                                \
 		esp_err_t __err = (x);                                          \
@@ -25,4 +33,35 @@
 		}                                                               \
 	} while (0)
 
+// Number and total size of heap allocations since boot (zero unless CONFIG_HEAP_USE_HOOKS is enabled)
+typedef struct {
+	uint32_t count;
+	uint32_t bytes;
+} alloc_stats_t;
+
+// Text built in a caller provided buffer - appends past the capacity are counted but not written
+typedef struct {
+	char *data;
+	size_t capacity;
+	size_t length;
+} text_buffer_t;
+
 char *dynamic_format(const char *fmt, ...);
+void alloc_stats_get(alloc_stats_t *stats);
+
+void text_init(text_buffer_t *text, char *data, size_t capacity);
+void text_append(text_buffer_t *text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void text_append_fixed(text_buffer_t *text, int32_t value, uint8_t scale);
+void text_truncate(text_buffer_t *text, size_t length);
+bool text_overflowed(const text_buffer_t *text);
+
+#if CONFIG_VOGON_ALLOC_CHECK
+// Heap allocations made by the calling task between begin and end are counted, see CONFIG_VOGON_ALLOC_CHECK
+void alloc_scope_begin();
+void alloc_scope_end();
+uint32_t alloc_scope_take(); // Count since the last take
+#else
+#define alloc_scope_begin() ((void)0)
+#define alloc_scope_end() ((void)0)
+#define alloc_scope_take() ((uint32_t)0)
+#endif
@@ -0,0 +1,57 @@
+#include "stdarg.h"
+#include "stdint.h"
+#include "stdio.h"
+
+#include "helpers.h"
+
+// Bounded text buffers - no IDF dependencies, the load generator compiles this file on the host
+
+void text_init(text_buffer_t *text, char *data, size_t capacity) {
+	text->data = data;
+	text->capacity = capacity;
+	text->length = 0;
+
+	if (capacity > 0)
+		data[0] = '\0';
+}
+
+void text_append(text_buffer_t *text, const char *fmt, ...) {
+	size_t available = text->length < text->capacity ? text->capacity - text->length : 0;
+
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(available > 0 ? text->data + text->length : NULL, available, fmt, args);
+	va_end(args);
+
+	if (len > 0)
+		text->length += len;
+}
+
+// `value` with `scale` decimal digits, printed without floating point - float formatting allocates in newlib
+void text_append_fixed(text_buffer_t *text, int32_t value, uint8_t scale) {
+	uint32_t magnitude = value < 0 ? -(uint32_t)value : (uint32_t)value;
+	const char *sign = value < 0 ? "-" : "";
+
+	uint32_t divisor = 1;
+	for (uint8_t i = 0; i < scale; i++)
+		divisor *= 10;
+
+	if (scale == 0)
+		text_append(text, "%s%lu", sign, (unsigned long)magnitude);
+	else
+		text_append(text, "%s%lu.%0*lu", sign, (unsigned long)(magnitude / divisor), scale, (unsigned long)(magnitude % divisor));
+}
+
+// Drops everything after `length` - undoes appends that overflowed
+void text_truncate(text_buffer_t *text, size_t length) {
+	if (length >= text->length)
+		return;
+
+	text->length = length;
+	if (length < text->capacity)
+		text->data[length] = '\0';
+}
+
+bool text_overflowed(const text_buffer_t *text) {
+	return text->length >= text->capacity;
+}
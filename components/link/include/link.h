@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+#include "esp_err.h"
+
+#include "backlog.h"
+#include "block.h"
+#include "link_protocol.h"
+
+// Leaf payload: the leaf's clock when sending (4 bytes, little endian), then a block of its readings
+#define LINK_CLOCK_LEN 4
+
+// Room for a leaf block restamped onto the gateway's clock
+#define LINK_RELAY_MAX_LEN (LINK_MAX_PAYLOAD_LEN - LINK_CLOCK_LEN + BLOCK_RESTAMP_MAX_GROWTH(BACKLOG_COLUMN_COUNT))
+
+// Block received from a leaf, forwarded by the gateway with its timestamps moved onto the gateway's clock
+// The block header carries the leaf's MAC address
+typedef struct {
+	size_t length;
+	uint8_t data[LINK_RELAY_MAX_LEN];
+} link_relay_t;
+
+// Leaf - sends the backlog to the gateway, dropping what was acknowledged
+esp_err_t link_leaf_sync();
+
+// Gateway - acknowledges leaf frames and queues their blocks for mqtt_sync()
+esp_err_t link_gateway_start();
+
+size_t link_relay_count();
+const link_relay_t *link_relay_peek(size_t index);
+void link_relay_drop(size_t count);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+// Acknowledged leaf -> gateway frames over a connectionless link (ESP-NOW)
+//
+// Frame layout: magic "VL" (2 bytes), version (1 byte), type (1 byte), sequence (2 bytes, little endian), payload
+//
+// Stop-and-wait: the leaf sends one DATA frame and waits for the ACK carrying the same sequence,
+// retransmitting on timeout. The gateway acknowledges every valid DATA frame, but delivers a
+// frame whose sequence equals the last accepted one of that sender only once.
+//
+// Plain C without ESP-IDF dependencies so it builds on the host with a simulated transport.
+
+#define LINK_MAGIC_0 'V'
+#define LINK_MAGIC_1 'L'
+#define LINK_VERSION 2 // 2: leaf payload starts with the leaf clock
+
+#define LINK_ADDRESS_LEN 6
+#define LINK_HEADER_LEN 6
+#define LINK_MAX_FRAME_LEN 250 // ESP-NOW v1 payload limit
+#define LINK_MAX_PAYLOAD_LEN (LINK_MAX_FRAME_LEN - LINK_HEADER_LEN)
+
+typedef enum {
+	LINK_FRAME_DATA = 1,
+	LINK_FRAME_ACK = 2
+} link_frame_type_t;
+
+size_t link_frame_encode(uint8_t *frame, link_frame_type_t type, uint16_t seq, const uint8_t *payload, size_t len);
+bool link_frame_decode(const uint8_t *frame, size_t len, link_frame_type_t *type, uint16_t *seq, const uint8_t **payload, size_t *payload_len);
+
+// ===== ===== ===== =====
+
+typedef struct {
+	bool (*send)(void *ctx, const uint8_t *frame, size_t len);
+
+	// Waits up to timeout_ms for a frame from the peer, returns its length or 0 on timeout
+	size_t (*receive)(void *ctx, uint8_t *frame, size_t capacity, uint32_t timeout_ms);
+
+	void *ctx;
+} link_transport_t;
+
+typedef enum {
+	LINK_DELIVERED,
+	LINK_NO_ACK,
+	LINK_TOO_LARGE
+} link_result_t;
+
+link_result_t link_send(const link_transport_t *transport, uint16_t seq, const uint8_t *payload, size_t len, int attempts, uint32_t ack_timeout_ms);
+
+// ===== ===== ===== =====
+
+typedef struct {
+	uint8_t address[LINK_ADDRESS_LEN];
+	uint16_t last_seq;
+	bool used;
+} link_peer_t;
+
+// Duplicate suppression per sender - the oldest peer is forgotten when the table is full
+typedef struct {
+	link_peer_t *peers;
+	size_t capacity;
+	size_t next_evict;
+} link_receiver_t;
+
+typedef enum {
+	LINK_RX_NEW,		// Delivered, acknowledge
+	LINK_RX_DUPLICATE,	// Retransmission of an accepted frame, acknowledge again
+	LINK_RX_REJECTED,	// Not delivered (no room), no ACK - the sender retries later
+	LINK_RX_INVALID		// Not a DATA frame of this protocol
+} link_rx_status_t;
+
+// Returns false when the payload can't be taken right now
+typedef bool (*link_deliver_fn)(void *ctx, const uint8_t address[LINK_ADDRESS_LEN], const uint8_t *payload, size_t len);
+
+void link_receiver_init(link_receiver_t *receiver, link_peer_t *peers, size_t capacity);
+
+// Writes the ACK to send back into `ack` for NEW and DUPLICATE frames
+link_rx_status_t link_receive(link_receiver_t *receiver, const uint8_t address[LINK_ADDRESS_LEN], const uint8_t *frame, size_t len,
+							  link_deliver_fn deliver, void *ctx, uint8_t ack[LINK_HEADER_LEN]);
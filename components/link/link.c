@@ -0,0 +1,316 @@
+#include "stdatomic.h"
+#include "stdio.h"
+#include "string.h"
+#include "time.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_now.h"
+#include "esp_random.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "backlog.h"
+#include "block.h"
+#include "helpers.h"
+#include "link.h"
+#include "shared.h"
+#include "wifi.h"
+
+#define FRAME_QUEUE_LEN 8
+#define GATEWAY_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 4)
+#define LINK_READINGS_PER_FRAME 16 // Fits with typical deltas, halved until the block fits
+#define LINK_BLOCK_MAX_LEN (LINK_MAX_PAYLOAD_LEN - LINK_CLOCK_LEN)
+#define CLOCK_SET_AFTER 1704067200 // 2024-01-01 - earlier times count from boot, the clock was never set over SNTP
+
+_Static_assert((CONFIG_LINK_RELAY_SLOTS & (CONFIG_LINK_RELAY_SLOTS - 1)) == 0, "Relay slots must be a power of two");
+
+static const char *TAG = "MODULE[link]";
+
+typedef struct {
+	uint8_t source[LINK_ADDRESS_LEN];
+	uint8_t length;
+	uint8_t data[LINK_MAX_FRAME_LEN];
+} link_frame_t;
+
+static QueueHandle_t frame_queue;
+static StaticQueue_t frame_queue_buffer;
+static uint8_t frame_queue_storage[FRAME_QUEUE_LEN * sizeof(link_frame_t)];
+
+// Leaf - the frame that wasn't acknowledged is retransmitted with the same sequence and readings,
+// so a gateway that got it but whose ACK was lost doesn't forward it twice
+RTC_DATA_ATTR static uint16_t link_seq = 0;
+RTC_DATA_ATTR static bool link_seq_initialized = false;
+RTC_DATA_ATTR static size_t pending_readings = 0;
+RTC_DATA_ATTR static uint32_t pending_timestamp = 0;
+
+// Gateway - single producer (receive task) / single consumer (mqtt_sync) queue
+static link_peer_t peers[CONFIG_LINK_MAX_LEAVES];
+static link_receiver_t receiver;
+static link_relay_t relay_slots[CONFIG_LINK_RELAY_SLOTS];
+static atomic_uint relay_head;
+static atomic_uint relay_tail;
+
+static void receive_callback(const esp_now_recv_info_t *info, const uint8_t *data, int len) {
+	if (len <= 0 || len > LINK_MAX_FRAME_LEN)
+		return;
+
+	link_frame_t frame;
+	memcpy(frame.source, info->src_addr, LINK_ADDRESS_LEN);
+	frame.length = len;
+	memcpy(frame.data, data, len);
+
+	// Wi-Fi task context - never block, the sender retransmits
+	xQueueSend(frame_queue, &frame, 0);
+}
+
+static esp_err_t link_start() {
+	frame_queue = xQueueCreateStatic(FRAME_QUEUE_LEN, sizeof(link_frame_t), frame_queue_storage, &frame_queue_buffer);
+
+	RETURN_ON_ERROR(esp_now_init());
+	return esp_now_register_recv_cb(receive_callback);
+}
+
+static void link_stop() {
+	esp_now_deinit();
+	vQueueDelete(frame_queue);
+	frame_queue = NULL;
+}
+
+static esp_err_t add_peer(const uint8_t address[LINK_ADDRESS_LEN], uint8_t channel) {
+	esp_now_peer_info_t peer = {
+		.channel = channel,
+		.ifidx = WIFI_IF_STA,
+		.encrypt = false};
+	memcpy(peer.peer_addr, address, LINK_ADDRESS_LEN);
+
+	return esp_now_add_peer(&peer);
+}
+
+// ===== ===== ===== =====
+
+static bool leaf_send(void *ctx, const uint8_t *frame, size_t len) {
+	return esp_now_send(ctx, frame, len) == ESP_OK;
+}
+
+static size_t leaf_receive(void *ctx, uint8_t *frame, size_t capacity, uint32_t timeout_ms) {
+	link_frame_t received;
+
+	while (xQueueReceive(frame_queue, &received, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+		if (memcmp(received.source, ctx, LINK_ADDRESS_LEN) != 0 || received.length > capacity)
+			continue;
+
+		memcpy(frame, received.data, received.length);
+		return received.length;
+	}
+
+	return 0;
+}
+
+// Encodes the next readings into at most one frame, returns how many fit
+static size_t encode_chunk(const uint8_t mac[LINK_ADDRESS_LEN], size_t offset, size_t count, uint8_t *payload, size_t *length) {
+	if (count > LINK_READINGS_PER_FRAME)
+		count = LINK_READINGS_PER_FRAME;
+
+	for (; count > 0; count /= 2) {
+		*length = backlog_encode(mac, offset, count, payload + LINK_CLOCK_LEN, LINK_BLOCK_MAX_LEN);
+		if (*length > 0)
+			return count;
+	}
+
+	return 0;
+}
+
+esp_err_t link_leaf_sync() {
+	uint8_t gateway[LINK_ADDRESS_LEN];
+	if (sscanf(shared_config.SYNC_LINK_GATEWAY, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+			   &gateway[0], &gateway[1], &gateway[2], &gateway[3], &gateway[4], &gateway[5]) != LINK_ADDRESS_LEN) {
+		ESP_LOGE(TAG, "Invalid gateway address: %s", shared_config.SYNC_LINK_GATEWAY);
+		return ESP_ERR_INVALID_ARG;
+	}
+
+	RETURN_ON_ERROR(wifi_start_radio(shared_config.SYNC_LINK_CHANNEL));
+	RETURN_ON_ERROR(link_start());
+	RETURN_ON_ERROR(add_peer(gateway, shared_config.SYNC_LINK_CHANNEL));
+
+	// Random start after power loss - the gateway may still remember the previous sequence
+	if (!link_seq_initialized) {
+		link_seq = esp_random();
+		link_seq_initialized = true;
+	}
+
+	uint8_t mac[LINK_ADDRESS_LEN];
+	RETURN_ON_ERROR(esp_wifi_get_mac(WIFI_IF_STA, mac));
+
+	const link_transport_t transport = {leaf_send, leaf_receive, gateway};
+	static uint8_t payload[LINK_MAX_PAYLOAD_LEN];
+
+	size_t count = backlog_count();
+	size_t delivered = 0;
+	esp_err_t ret = ESP_OK;
+
+	while (delivered < count) {
+		size_t length;
+		size_t chunk;
+		uint16_t seq;
+
+		const backlog_entry_t *first = backlog_peek(delivered);
+		bool retransmit = delivered == 0 && pending_readings > 0 && pending_readings <= count && first->timestamp == pending_timestamp;
+
+		if (retransmit) {
+			chunk = pending_readings;
+			length = backlog_encode(mac, 0, chunk, payload + LINK_CLOCK_LEN, LINK_BLOCK_MAX_LEN);
+			seq = link_seq;
+		} else {
+			chunk = encode_chunk(mac, delivered, count - delivered, payload, &length);
+			seq = ++link_seq;
+		}
+
+		if (chunk == 0 || length == 0) {
+			ESP_LOGE(TAG, "Failed to encode readings for the gateway");
+			ret = ESP_FAIL;
+			break;
+		}
+
+		// Leaf clock at sending - never set over SNTP, so the gateway moves the readings onto its own clock
+		uint32_t clock = (uint32_t)time(NULL);
+		for (int i = 0; i < LINK_CLOCK_LEN; i++)
+			payload[i] = (uint8_t)(clock >> (8 * i));
+
+		length += LINK_CLOCK_LEN;
+
+		pending_readings = chunk;
+		pending_timestamp = first->timestamp;
+
+		if (link_send(&transport, seq, payload, length, CONFIG_LINK_ATTEMPTS, CONFIG_LINK_ACK_TIMEOUT_MS) != LINK_DELIVERED) {
+			ESP_LOGW(TAG, "Gateway did not acknowledge frame %u, %d readings kept", seq, (int)(count - delivered));
+			ret = ESP_FAIL;
+			break;
+		}
+
+		pending_readings = 0;
+		delivered += chunk;
+	}
+
+	ESP_LOGI(TAG, "Sent %d of %d readings to the gateway", (int)delivered, (int)count);
+	backlog_drop(delivered);
+
+	link_stop();
+	esp_wifi_stop();
+	return ret;
+}
+
+// ===== ===== ===== =====
+
+static bool relay_push(void *ctx, const uint8_t address[LINK_ADDRESS_LEN], const uint8_t *payload, size_t len) {
+	const uint8_t *block = payload + LINK_CLOCK_LEN;
+
+	// Only blocks are forwarded - anything else is acknowledged and discarded
+	if (len < LINK_CLOCK_LEN + 3 + BLOCK_DEVICE_ID_LEN || block[0] != BLOCK_MAGIC_0 || block[1] != BLOCK_MAGIC_1) {
+		ESP_LOGW(TAG, "Discarding a frame that is not a block");
+		return true;
+	}
+
+	len -= LINK_CLOCK_LEN;
+
+	unsigned head = atomic_load_explicit(&relay_head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&relay_tail, memory_order_acquire);
+
+	if (head - tail == CONFIG_LINK_RELAY_SLOTS)
+		return false;
+
+	link_relay_t *slot = &relay_slots[head & (CONFIG_LINK_RELAY_SLOTS - 1)];
+	slot->length = 0;
+
+	// Leaf readings onto the gateway's clock - left as they are until the gateway's own clock is set
+	uint32_t leaf_clock = 0;
+	for (int i = 0; i < LINK_CLOCK_LEN; i++)
+		leaf_clock |= (uint32_t)payload[i] << (8 * i);
+
+	int64_t now = time(NULL);
+	if (now >= CLOCK_SET_AFTER) {
+		slot->length = block_restamp(block, len, (int32_t)(now - leaf_clock), slot->data, sizeof(slot->data));
+		if (slot->length == 0)
+			ESP_LOGW(TAG, "Failed to restamp the block of leaf " MACSTR ", forwarding it as is", MAC2STR(address));
+	}
+
+	if (slot->length == 0) {
+		memcpy(slot->data, block, len);
+		slot->length = len;
+	}
+
+	atomic_store_explicit(&relay_head, head + 1, memory_order_release);
+	return true;
+}
+
+static void gateway_task() {
+	link_frame_t frame;
+	uint8_t ack[LINK_HEADER_LEN];
+
+	for (;;) {
+		xQueueReceive(frame_queue, &frame, portMAX_DELAY);
+
+		link_rx_status_t status = link_receive(&receiver, frame.source, frame.data, frame.length, relay_push, NULL, ack);
+		if (status == LINK_RX_REJECTED)
+			ESP_LOGW(TAG, "Relay queue full, leaf " MACSTR " not acknowledged", MAC2STR(frame.source));
+
+		if (status != LINK_RX_NEW && status != LINK_RX_DUPLICATE)
+			continue;
+
+		if (!esp_now_is_peer_exist(frame.source)) {
+			// Peer table is small - forget the oldest leaf to make room
+			if (add_peer(frame.source, 0) == ESP_ERR_ESPNOW_FULL) {
+				esp_now_peer_info_t oldest;
+				if (esp_now_fetch_peer(true, &oldest) == ESP_OK)
+					esp_now_del_peer(oldest.peer_addr);
+
+				add_peer(frame.source, 0);
+			}
+		}
+
+		esp_now_send(frame.source, ack, LINK_HEADER_LEN);
+	}
+}
+
+esp_err_t link_gateway_start() {
+	link_receiver_init(&receiver, peers, CONFIG_LINK_MAX_LEAVES);
+
+	// Modem sleep would miss leaf frames between beacons
+	RETURN_ON_ERROR(esp_wifi_set_ps(WIFI_PS_NONE));
+	RETURN_ON_ERROR(link_start());
+
+	uint8_t channel;
+	wifi_second_chan_t second;
+	RETURN_ON_ERROR(esp_wifi_get_channel(&channel, &second));
+	ESP_LOGI(TAG, "Gateway listening on channel %d", channel);
+
+	static StaticTask_t task_buffer;
+	static StackType_t task_stack[GATEWAY_TASK_STACK_SIZE];
+
+	xTaskCreateStaticPinnedToCore(
+		gateway_task,
+		"link",
+		GATEWAY_TASK_STACK_SIZE,
+		NULL,
+		10,
+		task_stack,
+		&task_buffer,
+		APP_CPU_NUM);
+
+	return ESP_OK;
+}
+
+size_t link_relay_count() {
+	return atomic_load_explicit(&relay_head, memory_order_acquire) - atomic_load_explicit(&relay_tail, memory_order_relaxed);
+}
+
+const link_relay_t *link_relay_peek(size_t index) {
+	unsigned tail = atomic_load_explicit(&relay_tail, memory_order_relaxed);
+	return &relay_slots[(tail + index) & (CONFIG_LINK_RELAY_SLOTS - 1)];
+}
+
+void link_relay_drop(size_t count) {
+	unsigned tail = atomic_load_explicit(&relay_tail, memory_order_relaxed);
+	atomic_store_explicit(&relay_tail, tail + count, memory_order_release);
+}
@@ -0,0 +1,128 @@
+#include "string.h"
+
+#include "link_protocol.h"
+
+size_t link_frame_encode(uint8_t *frame, link_frame_type_t type, uint16_t seq, const uint8_t *payload, size_t len) {
+	if (len > LINK_MAX_PAYLOAD_LEN)
+		return 0;
+
+	frame[0] = LINK_MAGIC_0;
+	frame[1] = LINK_MAGIC_1;
+	frame[2] = LINK_VERSION;
+	frame[3] = type;
+	frame[4] = seq & 0xFF;
+	frame[5] = seq >> 8;
+
+	if (len > 0)
+		memcpy(&frame[LINK_HEADER_LEN], payload, len);
+
+	return LINK_HEADER_LEN + len;
+}
+
+bool link_frame_decode(const uint8_t *frame, size_t len, link_frame_type_t *type, uint16_t *seq, const uint8_t **payload, size_t *payload_len) {
+	if (len < LINK_HEADER_LEN || len > LINK_MAX_FRAME_LEN)
+		return false;
+
+	if (frame[0] != LINK_MAGIC_0 || frame[1] != LINK_MAGIC_1 || frame[2] != LINK_VERSION)
+		return false;
+
+	if (frame[3] != LINK_FRAME_DATA && frame[3] != LINK_FRAME_ACK)
+		return false;
+
+	*type = frame[3];
+	*seq = frame[4] | (frame[5] << 8);
+	*payload = &frame[LINK_HEADER_LEN];
+	*payload_len = len - LINK_HEADER_LEN;
+	return true;
+}
+
+link_result_t link_send(const link_transport_t *transport, uint16_t seq, const uint8_t *payload, size_t len, int attempts, uint32_t ack_timeout_ms) {
+	uint8_t frame[LINK_MAX_FRAME_LEN];
+	size_t frame_len = link_frame_encode(frame, LINK_FRAME_DATA, seq, payload, len);
+	if (frame_len == 0)
+		return LINK_TOO_LARGE;
+
+	uint8_t reply[LINK_MAX_FRAME_LEN];
+
+	for (int attempt = 0; attempt < attempts; attempt++) {
+		if (!transport->send(transport->ctx, frame, frame_len))
+			continue;
+
+		// Late ACKs of earlier frames are skipped, the timeout ends the attempt
+		size_t reply_len;
+		while ((reply_len = transport->receive(transport->ctx, reply, sizeof(reply), ack_timeout_ms)) > 0) {
+			link_frame_type_t type;
+			uint16_t ack_seq;
+			const uint8_t *ack_payload;
+			size_t ack_payload_len;
+
+			if (link_frame_decode(reply, reply_len, &type, &ack_seq, &ack_payload, &ack_payload_len) &&
+				type == LINK_FRAME_ACK && ack_seq == seq)
+				return LINK_DELIVERED;
+		}
+	}
+
+	return LINK_NO_ACK;
+}
+
+void link_receiver_init(link_receiver_t *receiver, link_peer_t *peers, size_t capacity) {
+	memset(peers, 0, capacity * sizeof(link_peer_t));
+	receiver->peers = peers;
+	receiver->capacity = capacity;
+	receiver->next_evict = 0;
+}
+
+static link_peer_t *find_peer(link_receiver_t *receiver, const uint8_t address[LINK_ADDRESS_LEN]) {
+	for (size_t i = 0; i < receiver->capacity; i++) {
+		link_peer_t *peer = &receiver->peers[i];
+		if (peer->used && memcmp(peer->address, address, LINK_ADDRESS_LEN) == 0)
+			return peer;
+	}
+
+	return NULL;
+}
+
+static link_peer_t *add_peer(link_receiver_t *receiver, const uint8_t address[LINK_ADDRESS_LEN]) {
+	link_peer_t *peer = NULL;
+
+	for (size_t i = 0; i < receiver->capacity && peer == NULL; i++)
+		if (!receiver->peers[i].used)
+			peer = &receiver->peers[i];
+
+	if (peer == NULL) {
+		peer = &receiver->peers[receiver->next_evict];
+		receiver->next_evict = (receiver->next_evict + 1) % receiver->capacity;
+	}
+
+	memcpy(peer->address, address, LINK_ADDRESS_LEN);
+	peer->used = true;
+	return peer;
+}
+
+link_rx_status_t link_receive(link_receiver_t *receiver, const uint8_t address[LINK_ADDRESS_LEN], const uint8_t *frame, size_t len,
+							  link_deliver_fn deliver, void *ctx, uint8_t ack[LINK_HEADER_LEN]) {
+	link_frame_type_t type;
+	uint16_t seq;
+	const uint8_t *payload;
+	size_t payload_len;
+
+	if (!link_frame_decode(frame, len, &type, &seq, &payload, &payload_len) || type != LINK_FRAME_DATA)
+		return LINK_RX_INVALID;
+
+	link_peer_t *peer = find_peer(receiver, address);
+	link_rx_status_t status = LINK_RX_DUPLICATE;
+
+	if (peer == NULL || peer->last_seq != seq) {
+		if (!deliver(ctx, address, payload, payload_len))
+			return LINK_RX_REJECTED;
+
+		if (peer == NULL)
+			peer = add_peer(receiver, address);
+
+		peer->last_seq = seq;
+		status = LINK_RX_NEW;
+	}
+
+	link_frame_encode(ack, LINK_FRAME_ACK, seq, NULL, 0);
+	return status;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "stdbool.h"
+
+#include "esp_err.h"
+
+esp_err_t ota_run();
+void ota_confirm(bool healthy);
+bool ota_pending_verify();
@@ -0,0 +1,520 @@
+#include "stdint.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+#include "cJSON.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_crt_bundle.h"
+#include "esp_delta_ota.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "mbedtls/sha256.h"
+#include "miniz.h"
+#include "nvs.h"
+
+#include "helpers.h"
+#include "shared.h"
+
+#include "ota.h"
+
+static const char *TAG = "MODULE[ota]";
+
+#define OTA_STAGE_PARTITION "ota_stage"
+#define OTA_BUFFER_SIZE 4096
+#define OTA_MANIFEST_MAX_LEN 1024
+#define OTA_HTTP_TIMEOUT_MS 10 * 1000
+#define OTA_SECTOR_SIZE 4096
+
+// NVS keys - max 15 characters
+#define NVS_KEY_OTA_MANIFEST "ota_manifest"
+#define NVS_KEY_OTA_OFFSET "ota_offset"
+
+typedef enum {
+	OTA_FORMAT_RAW,	 // Plain application image
+	OTA_FORMAT_ZLIB, // zlib (miniz) compressed image
+	OTA_FORMAT_DELTA // detools patch (heatshrink) against the running image
+} ota_format_t;
+
+typedef struct {
+	char version[32];
+	char url[256];
+	ota_format_t format;
+	uint32_t size;
+	uint8_t sha256[32];
+	uint8_t base_sha256[32];
+} ota_manifest_t;
+
+// Successful syncs left before the manifest is checked again - first check right after boot
+RTC_DATA_ATTR static uint32_t ota_syncs_until_check = 0;
+
+static uint8_t ota_buffer[OTA_BUFFER_SIZE];
+static char manifest_json[OTA_MANIFEST_MAX_LEN];
+
+static bool hex_decode(const char *hex, uint8_t *out, size_t out_len) {
+	if (hex == NULL || strlen(hex) != out_len * 2)
+		return false;
+
+	for (size_t i = 0; i < out_len; i++) {
+		unsigned int byte;
+		if (sscanf(&hex[i * 2], "%2x", &byte) != 1)
+			return false;
+
+		out[i] = (uint8_t)byte;
+	}
+
+	return true;
+}
+
+static esp_err_t parse_manifest(const char *json, ota_manifest_t *manifest) {
+	cJSON *root = cJSON_Parse(json);
+	if (root == NULL) {
+		ESP_LOGE(TAG, "Invalid manifest");
+		return ESP_FAIL;
+	}
+
+	esp_err_t ret = ESP_FAIL;
+	memset(manifest, 0, sizeof(ota_manifest_t));
+
+	cJSON *version = cJSON_GetObjectItemCaseSensitive(root, "version");
+	cJSON *url = cJSON_GetObjectItemCaseSensitive(root, "url");
+	cJSON *format = cJSON_GetObjectItemCaseSensitive(root, "format");
+	cJSON *size = cJSON_GetObjectItemCaseSensitive(root, "size");
+	cJSON *sha256 = cJSON_GetObjectItemCaseSensitive(root, "sha256");
+	cJSON *base_sha256 = cJSON_GetObjectItemCaseSensitive(root, "base_sha256");
+
+	if (!cJSON_IsString(version) || !cJSON_IsString(url) || !cJSON_IsString(format) || !cJSON_IsNumber(size))
+		goto cleanup;
+
+	if (strlen(version->valuestring) >= sizeof(manifest->version) || strlen(url->valuestring) >= sizeof(manifest->url))
+		goto cleanup;
+
+	strcpy(manifest->version, version->valuestring);
+	strcpy(manifest->url, url->valuestring);
+	manifest->size = (uint32_t)size->valuedouble;
+
+	if (!hex_decode(cJSON_GetStringValue(sha256), manifest->sha256, sizeof(manifest->sha256)))
+		goto cleanup;
+
+	if (strcmp(format->valuestring, "raw") == 0) {
+		manifest->format = OTA_FORMAT_RAW;
+	} else if (strcmp(format->valuestring, "zlib") == 0) {
+		manifest->format = OTA_FORMAT_ZLIB;
+	} else if (strcmp(format->valuestring, "delta") == 0) {
+		manifest->format = OTA_FORMAT_DELTA;
+
+		if (!hex_decode(cJSON_GetStringValue(base_sha256), manifest->base_sha256, sizeof(manifest->base_sha256)))
+			goto cleanup;
+	} else {
+		goto cleanup;
+	}
+
+	ret = ESP_OK;
+
+cleanup:
+	if (ret != ESP_OK) ESP_LOGE(TAG, "Invalid manifest");
+	cJSON_Delete(root);
+	return ret;
+}
+
+// Progress persistence
+
+static esp_err_t load_progress(ota_manifest_t *manifest, uint32_t *offset) {
+	nvs_handle_t nvs_handle;
+	RETURN_ON_ERROR_RET(nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle), ESP_ERR_NOT_FOUND);
+
+	size_t len = sizeof(manifest_json);
+	esp_err_t ret = nvs_get_str(nvs_handle, NVS_KEY_OTA_MANIFEST, manifest_json, &len);
+	if (ret == ESP_OK) ret = nvs_get_u32(nvs_handle, NVS_KEY_OTA_OFFSET, offset);
+	nvs_close(nvs_handle);
+
+	if (ret != ESP_OK)
+		return ESP_ERR_NOT_FOUND;
+
+	return parse_manifest(manifest_json, manifest);
+}
+
+static esp_err_t save_progress(const char *json, uint32_t offset) {
+	nvs_handle_t nvs_handle;
+	RETURN_ON_ERROR(nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle));
+
+	esp_err_t ret = ESP_OK;
+	if (json != NULL) ret = nvs_set_str(nvs_handle, NVS_KEY_OTA_MANIFEST, json);
+	if (ret == ESP_OK) ret = nvs_set_u32(nvs_handle, NVS_KEY_OTA_OFFSET, offset);
+	if (ret == ESP_OK) ret = nvs_commit(nvs_handle);
+
+	nvs_close(nvs_handle);
+	return ret;
+}
+
+static void clear_progress() {
+	nvs_handle_t nvs_handle;
+	if (nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK)
+		return;
+
+	nvs_erase_key(nvs_handle, NVS_KEY_OTA_MANIFEST);
+	nvs_erase_key(nvs_handle, NVS_KEY_OTA_OFFSET);
+	nvs_commit(nvs_handle);
+	nvs_close(nvs_handle);
+}
+
+// Download
+
+static esp_http_client_handle_t http_open(const char *url, uint32_t offset, int *status) {
+	esp_http_client_config_t config = {
+		.url = url,
+		.timeout_ms = OTA_HTTP_TIMEOUT_MS,
+		.crt_bundle_attach = esp_crt_bundle_attach};
+
+	esp_http_client_handle_t client = esp_http_client_init(&config);
+	if (client == NULL)
+		return NULL;
+
+	if (offset > 0) {
+		char range[32];
+		snprintf(range, sizeof(range), "bytes=%lu-", (unsigned long)offset);
+		esp_http_client_set_header(client, "Range", range);
+	}
+
+	if (esp_http_client_open(client, 0) != ESP_OK || esp_http_client_fetch_headers(client) < 0) {
+		ESP_LOGE(TAG, "Failed to open %s", url);
+		esp_http_client_cleanup(client);
+		return NULL;
+	}
+
+	*status = esp_http_client_get_status_code(client);
+	return client;
+}
+
+static esp_err_t fetch_manifest() {
+	int status;
+	esp_http_client_handle_t client = http_open(CONFIG_OTA_MANIFEST_URL, 0, &status);
+	if (client == NULL)
+		return ESP_FAIL;
+
+	int len = status == 200 ? esp_http_client_read_response(client, manifest_json, sizeof(manifest_json) - 1) : -1;
+	esp_http_client_cleanup(client);
+
+	if (len <= 0) {
+		ESP_LOGE(TAG, "Failed to fetch manifest (HTTP %d)", status);
+		return ESP_FAIL;
+	}
+
+	manifest_json[len] = '\0';
+	return ESP_OK;
+}
+
+// Downloads the next slice of the update into the staging partition, advancing `offset`
+static esp_err_t download_stage(const ota_manifest_t *manifest, const esp_partition_t *stage, uint32_t *offset) {
+	// A reset mid-slice may have programmed bytes past the saved offset - its sector is downloaded and erased again
+	*offset &= ~(OTA_SECTOR_SIZE - 1);
+
+	int status;
+	esp_http_client_handle_t client = http_open(manifest->url, *offset, &status);
+	if (client == NULL)
+		return ESP_FAIL;
+
+	if (*offset > 0 && status == 200) {
+		ESP_LOGW(TAG, "Server ignored range request, restarting download");
+		*offset = 0;
+	} else if (status != 200 && status != 206) {
+		ESP_LOGE(TAG, "Failed to download update (HTTP %d)", status);
+		esp_http_client_cleanup(client);
+		return ESP_FAIL;
+	}
+
+	// Everything from the sector boundary on is erased before it is written
+	uint32_t erased_until = *offset;
+	uint32_t downloaded = 0;
+	int64_t start = esp_timer_get_time();
+	esp_err_t ret = ESP_OK;
+
+	while (*offset < manifest->size && downloaded < CONFIG_OTA_MAX_BYTES_PER_CYCLE) {
+		uint32_t remaining = manifest->size - *offset;
+		int len = esp_http_client_read(client, (char *)ota_buffer, remaining < OTA_BUFFER_SIZE ? remaining : OTA_BUFFER_SIZE);
+
+		if (len <= 0) {
+			ret = len < 0 ? ESP_FAIL : ESP_OK; // Connection closed - resume on the next wake
+			break;
+		}
+
+		if (*offset + len > erased_until) {
+			uint32_t erase_end = (*offset + len + OTA_SECTOR_SIZE - 1) & ~(OTA_SECTOR_SIZE - 1);
+			BREAK_ON_ERROR(ret = esp_partition_erase_range(stage, erased_until, erase_end - erased_until));
+			erased_until = erase_end;
+		}
+
+		BREAK_ON_ERROR(ret = esp_partition_write(stage, *offset, ota_buffer, len));
+		*offset += len;
+		downloaded += len;
+	}
+
+	esp_http_client_cleanup(client);
+
+	ESP_LOGI(TAG, "Downloaded %lu bytes in %lu ms (%lu/%lu staged)",
+			 (unsigned long)downloaded, (unsigned long)((esp_timer_get_time() - start) / 1000),
+			 (unsigned long)*offset, (unsigned long)manifest->size);
+
+	return ret;
+}
+
+static esp_err_t verify_stage(const ota_manifest_t *manifest, const esp_partition_t *stage) {
+	uint8_t digest[32];
+	mbedtls_sha256_context ctx;
+	mbedtls_sha256_init(&ctx);
+	mbedtls_sha256_starts(&ctx, 0);
+
+	for (uint32_t offset = 0; offset < manifest->size; offset += OTA_BUFFER_SIZE) {
+		uint32_t len = manifest->size - offset < OTA_BUFFER_SIZE ? manifest->size - offset : OTA_BUFFER_SIZE;
+
+		if (esp_partition_read(stage, offset, ota_buffer, len) != ESP_OK) {
+			mbedtls_sha256_free(&ctx);
+			return ESP_FAIL;
+		}
+
+		mbedtls_sha256_update(&ctx, ota_buffer, len);
+	}
+
+	mbedtls_sha256_finish(&ctx, digest);
+	mbedtls_sha256_free(&ctx);
+
+	return memcmp(digest, manifest->sha256, sizeof(digest)) == 0 ? ESP_OK : ESP_ERR_INVALID_CRC;
+}
+
+// Decoding the staged update into the passive app partition
+
+static esp_err_t apply_raw(const esp_partition_t *stage, uint32_t size, esp_ota_handle_t handle) {
+	for (uint32_t offset = 0; offset < size; offset += OTA_BUFFER_SIZE) {
+		uint32_t len = size - offset < OTA_BUFFER_SIZE ? size - offset : OTA_BUFFER_SIZE;
+
+		RETURN_ON_ERROR(esp_partition_read(stage, offset, ota_buffer, len));
+		RETURN_ON_ERROR(esp_ota_write(handle, ota_buffer, len));
+	}
+
+	return ESP_OK;
+}
+
+static esp_err_t apply_zlib(const esp_partition_t *stage, uint32_t size, esp_ota_handle_t handle) {
+	tinfl_decompressor *decompressor = malloc(sizeof(tinfl_decompressor));
+	uint8_t *dictionary = malloc(TINFL_LZ_DICT_SIZE);
+
+	if (decompressor == NULL || dictionary == NULL) {
+		free(decompressor);
+		free(dictionary);
+		return ESP_ERR_NO_MEM;
+	}
+
+	tinfl_init(decompressor);
+
+	uint32_t in_offset = 0;
+	size_t in_pos = 0;
+	size_t in_available = 0;
+	size_t dictionary_pos = 0;
+	tinfl_status status;
+	esp_err_t ret = ESP_OK;
+
+	do {
+		if (in_available == 0 && in_offset < size) {
+			in_available = size - in_offset < OTA_BUFFER_SIZE ? size - in_offset : OTA_BUFFER_SIZE;
+			BREAK_ON_ERROR(ret = esp_partition_read(stage, in_offset, ota_buffer, in_available));
+			in_offset += in_available;
+			in_pos = 0;
+		}
+
+		size_t in_bytes = in_available;
+		size_t out_bytes = TINFL_LZ_DICT_SIZE - dictionary_pos;
+		mz_uint32 flags = TINFL_FLAG_PARSE_ZLIB_HEADER | (in_offset < size ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+
+		status = tinfl_decompress(decompressor, ota_buffer + in_pos, &in_bytes,
+								  dictionary, dictionary + dictionary_pos, &out_bytes, flags);
+
+		in_pos += in_bytes;
+		in_available -= in_bytes;
+
+		if (out_bytes > 0) {
+			BREAK_ON_ERROR(ret = esp_ota_write(handle, dictionary + dictionary_pos, out_bytes));
+			dictionary_pos = (dictionary_pos + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+		}
+	} while (status == TINFL_STATUS_NEEDS_MORE_INPUT || status == TINFL_STATUS_HAS_MORE_OUTPUT);
+
+	free(decompressor);
+	free(dictionary);
+
+	if (ret != ESP_OK)
+		return ret;
+
+	if (status != TINFL_STATUS_DONE) {
+		ESP_LOGE(TAG, "Decompression failed: %d", status);
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+static const esp_partition_t *delta_base_partition;
+
+static esp_err_t delta_read_cb(uint8_t *buf, size_t size, int src_offset) {
+	return esp_partition_read(delta_base_partition, src_offset, buf, size);
+}
+
+static esp_err_t delta_write_cb(const uint8_t *buf, size_t size, void *user_data) {
+	return esp_ota_write(*(esp_ota_handle_t *)user_data, buf, size);
+}
+
+static esp_err_t apply_delta(const esp_partition_t *stage, uint32_t size, esp_ota_handle_t handle) {
+	delta_base_partition = esp_ota_get_running_partition();
+
+	esp_delta_ota_cfg_t config = {
+		.user_data = &handle,
+		.read_cb = delta_read_cb,
+		.write_cb = delta_write_cb};
+
+	esp_delta_ota_handle_t delta = esp_delta_ota_init(&config);
+	if (delta == NULL)
+		return ESP_FAIL;
+
+	esp_err_t ret = ESP_OK;
+	for (uint32_t offset = 0; offset < size; offset += OTA_BUFFER_SIZE) {
+		uint32_t len = size - offset < OTA_BUFFER_SIZE ? size - offset : OTA_BUFFER_SIZE;
+
+		BREAK_ON_ERROR(ret = esp_partition_read(stage, offset, ota_buffer, len));
+		BREAK_ON_ERROR(ret = esp_delta_ota_feed_patch(delta, ota_buffer, len));
+	}
+
+	if (ret == ESP_OK) ret = esp_delta_ota_finalize(delta);
+	esp_delta_ota_deinit(delta);
+	return ret;
+}
+
+static esp_err_t apply_stage(const ota_manifest_t *manifest, const esp_partition_t *stage) {
+	const esp_partition_t *target = esp_ota_get_next_update_partition(NULL);
+	if (target == NULL)
+		return ESP_FAIL;
+
+	esp_ota_handle_t handle;
+	RETURN_ON_ERROR(esp_ota_begin(target, OTA_SIZE_UNKNOWN, &handle));
+
+	esp_err_t ret;
+	switch (manifest->format) {
+		case OTA_FORMAT_ZLIB:
+			ret = apply_zlib(stage, manifest->size, handle);
+			break;
+
+		case OTA_FORMAT_DELTA:
+			ret = apply_delta(stage, manifest->size, handle);
+			break;
+
+		default:
+			ret = apply_raw(stage, manifest->size, handle);
+			break;
+	}
+
+	if (ret != ESP_OK) {
+		esp_ota_abort(handle);
+		return ret;
+	}
+
+	RETURN_ON_ERROR(esp_ota_end(handle)); // Validates the image
+	RETURN_ON_ERROR(esp_ota_set_boot_partition(target));
+	return ESP_OK;
+}
+
+esp_err_t ota_run() {
+	if (strlen(CONFIG_OTA_MANIFEST_URL) == 0)
+		return ESP_OK;
+
+	// Download progress is kept in NVS
+	RETURN_ON_ERROR(shared_nvs_init());
+
+	const esp_partition_t *stage = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, OTA_STAGE_PARTITION);
+	if (stage == NULL) {
+		ESP_LOGE(TAG, "Partition %s not found", OTA_STAGE_PARTITION);
+		return ESP_FAIL;
+	}
+
+	ota_manifest_t manifest;
+	uint32_t offset = 0;
+
+	if (load_progress(&manifest, &offset) == ESP_OK) {
+		ESP_LOGI(TAG, "Resuming update to %s at %lu/%lu", manifest.version, (unsigned long)offset, (unsigned long)manifest.size);
+	} else {
+		if (ota_syncs_until_check > 0) {
+			ota_syncs_until_check--;
+			return ESP_OK;
+		}
+
+		ota_syncs_until_check = CONFIG_OTA_CHECK_INTERVAL - 1;
+
+		RETURN_ON_ERROR(fetch_manifest());
+		RETURN_ON_ERROR(parse_manifest(manifest_json, &manifest));
+
+		if (strcmp(manifest.version, esp_app_get_description()->version) == 0) {
+			ESP_LOGI(TAG, "Firmware %s is up to date", manifest.version);
+			return ESP_OK;
+		}
+
+		if (manifest.size > stage->size) {
+			ESP_LOGE(TAG, "Update of %lu bytes doesn't fit the staging partition", (unsigned long)manifest.size);
+			return ESP_FAIL;
+		}
+
+		if (manifest.format == OTA_FORMAT_DELTA) {
+			uint8_t running_sha256[32];
+			RETURN_ON_ERROR(esp_partition_get_sha256(esp_ota_get_running_partition(), running_sha256));
+
+			if (memcmp(running_sha256, manifest.base_sha256, sizeof(running_sha256)) != 0) {
+				ESP_LOGW(TAG, "Delta update %s doesn't apply to the running image", manifest.version);
+				return ESP_FAIL;
+			}
+		}
+
+		ESP_LOGI(TAG, "Starting update to %s (%lu bytes)", manifest.version, (unsigned long)manifest.size);
+		RETURN_ON_ERROR(save_progress(manifest_json, 0));
+	}
+
+	esp_err_t ret = download_stage(&manifest, stage, &offset);
+	save_progress(NULL, offset);
+
+	if (ret != ESP_OK || offset < manifest.size)
+		return ret; // Continue on the next wake
+
+	ret = verify_stage(&manifest, stage);
+	if (ret == ESP_OK) ret = apply_stage(&manifest, stage);
+	clear_progress();
+
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Update to %s failed: %s", manifest.version, esp_err_to_name(ret));
+		return ret;
+	}
+
+	// Restart rather than deep sleep so the new image starts with fresh RTC memory
+	ESP_LOGI(TAG, "Update to %s installed, restarting", manifest.version);
+	esp_restart();
+	return ESP_OK;
+}
+
+// Keeps a freshly updated image once it has proven it can reach the broker, rolls back otherwise
+// True on the first cycle of a new image - it must sync before the node sleeps
+bool ota_pending_verify() {
+	esp_ota_img_states_t state;
+	return esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+		   state == ESP_OTA_IMG_PENDING_VERIFY;
+}
+
+void ota_confirm(bool healthy) {
+	if (!ota_pending_verify())
+		return;
+
+	if (healthy) {
+		ESP_LOGI(TAG, "New firmware %s verified", esp_app_get_description()->version);
+		esp_ota_mark_app_valid_cancel_rollback();
+	} else {
+		ESP_LOGE(TAG, "New firmware %s failed to sync, rolling back", esp_app_get_description()->version);
+		esp_ota_mark_app_invalid_rollback_and_reboot();
+	}
+}
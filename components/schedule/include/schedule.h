@@ -0,0 +1,33 @@
+#pragma once
+
+#include "stdbool.h"
+#include "stdint.h"
+
+// Multi-rate wake scheduler - every job has its own interval, the node sleeps until the next one is due
+//
+// Due times lie on wall-clock multiples of the interval plus a per-device offset derived from the MAC address.
+// Every device samples on a fixed grid, shifted against the rest of the fleet, and uploads are spread over
+// the sync interval on slots that coincide with a measurement.
+
+typedef enum {
+	SCHEDULE_ENVIRONMENTAL, // DHT22
+	SCHEDULE_PARTICULATE,	// SDS011
+	SCHEDULE_SYNC,			// Upload of the backlog
+
+	SCHEDULE_JOB_COUNT
+} schedule_job_t;
+
+// Jobs ahead of the sync run one sensor task each
+#define SCHEDULE_SENSOR_JOB_COUNT SCHEDULE_SYNC
+
+// Decides which jobs are due on this wake
+void schedule_begin();
+bool schedule_due(schedule_job_t job);
+
+// Moves a due job to its next slot
+void schedule_done(schedule_job_t job);
+
+uint64_t schedule_sleep_us();
+
+// Makes every job due on the next schedule_begin() - after a new configuration
+void schedule_reset();
@@ -0,0 +1,141 @@
+#include "time.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+
+#include "battery.h"
+#include "schedule.h"
+#include "shared.h"
+
+// Jobs due this close to the wake run now - absorbs RTC drift and merges jobs on a common multiple
+#define SCHEDULE_SLACK_S 5
+
+static const char *TAG = "MODULE[schedule]";
+
+// Next due time per job (system time, kept by the RTC across deep sleep) - 0 = due on first boot
+RTC_DATA_ATTR static int64_t next_due[SCHEDULE_JOB_COUNT] = {0};
+
+static bool due[SCHEDULE_JOB_COUNT];
+static int64_t now;
+
+// 0 in the configuration falls back to the general measurement interval
+static int64_t interval_s(schedule_job_t job) {
+	int minutes = 0;
+
+	switch (job) {
+		case SCHEDULE_ENVIRONMENTAL:
+			minutes = shared_config.SENSORS_ENVIRONMENTAL_INTERVAL;
+			break;
+		case SCHEDULE_PARTICULATE:
+			minutes = shared_config.SENSORS_PARTICULATE_INTERVAL;
+			break;
+		case SCHEDULE_SYNC:
+			minutes = shared_config.SYNC_INTERVAL;
+			break;
+		default:
+			break;
+	}
+
+	if (minutes <= 0)
+		minutes = shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL;
+
+	// Stretched by the battery governor, uploads usually more than measurements
+	int scale = job == SCHEDULE_SYNC ? battery_sync_scale() : battery_interval_scale();
+
+	return (int64_t)minutes * scale * 60;
+}
+
+static uint32_t device_hash() {
+	static uint32_t hash = 0;
+
+	if (hash == 0) {
+		uint8_t mac[6] = {0};
+		esp_read_mac(mac, ESP_MAC_WIFI_STA);
+
+		// FNV-1a - neighbouring MAC addresses land far apart
+		hash = 2166136261u;
+		for (int i = 0; i < 6; i++)
+			hash = (hash ^ mac[i]) * 16777619u;
+	}
+
+	return hash;
+}
+
+// Stable per-device offset - spreads the fleet instead of waking it at once
+// Uploads pick one of the measurement slots of the sync interval, so they still share a wake with the sensors
+static int64_t device_offset_s(schedule_job_t job) {
+	uint32_t hash = device_hash();
+	int64_t general = (int64_t)shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL * 60;
+	int64_t offset = hash % general;
+
+	if (job == SCHEDULE_SYNC) {
+		int64_t slots = interval_s(job) / general;
+		if (slots > 1)
+			offset += general * ((hash / general) % slots); // Upper bits - independent of the offset above
+	}
+
+	return offset;
+}
+
+// First slot of the job after `after` - slots lie on multiples of the interval since the epoch, plus the device offset
+static int64_t next_slot(schedule_job_t job, int64_t after) {
+	int64_t interval = interval_s(job);
+	int64_t offset = device_offset_s(job) % interval;
+
+	int64_t slots = (after - offset) / interval;
+	if ((after - offset) % interval < 0)
+		slots--; // Floor for times before the first slot
+
+	return (slots + 1) * interval + offset;
+}
+
+void schedule_begin() {
+	now = time(NULL);
+
+	for (int job = 0; job < SCHEDULE_JOB_COUNT; job++) {
+		// A clock set backwards or a shortened interval must not postpone the job
+		if (next_due[job] - now > interval_s(job))
+			next_due[job] = now;
+
+		due[job] = next_due[job] <= now + SCHEDULE_SLACK_S;
+	}
+
+	ESP_LOGI(TAG, "Due: environmental=%d, particulate=%d, sync=%d",
+			 due[SCHEDULE_ENVIRONMENTAL], due[SCHEDULE_PARTICULATE], due[SCHEDULE_SYNC]);
+}
+
+bool schedule_due(schedule_job_t job) {
+	return due[job];
+}
+
+void schedule_done(schedule_job_t job) {
+	// Slots don't depend on when the job ran, so time spent awake never accumulates
+	next_due[job] = next_slot(job, now + SCHEDULE_SLACK_S);
+}
+
+uint64_t schedule_sleep_us() {
+	int64_t current = time(NULL);
+
+	// SNTP moved the clock during sync - due times from the old clock are moved to the next slot on the new one
+	for (int job = 0; job < SCHEDULE_JOB_COUNT; job++)
+		if (next_due[job] <= current)
+			next_due[job] = next_slot(job, current);
+
+	int64_t wake = next_due[0];
+	for (int job = 1; job < SCHEDULE_JOB_COUNT; job++)
+		if (next_due[job] < wake)
+			wake = next_due[job];
+
+	// Time spent awake since schedule_begin() is part of the sleep already elapsed
+	int64_t sleep_s = wake - current;
+	if (sleep_s < 1)
+		sleep_s = 1;
+
+	return (uint64_t)sleep_s * 1000000;
+}
+
+void schedule_reset() {
+	for (int job = 0; job < SCHEDULE_JOB_COUNT; job++)
+		next_due[job] = 0;
+}
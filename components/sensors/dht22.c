@@ -1,50 +1,125 @@
-#include "dht.h"
+#include "time.h"
+
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#if CONFIG_DHT22_DRIVER_LEGACY
+#include "dht.h"
+#endif
 
+#include "battery.h"
+#include "diagnostics.h"
+#include "helpers.h"
+#include "sensors.h"
 #include "shared.h"
+#include "trace.h"
 
 #define DHT22_PIN 23
+#define DHT22_MIN_INTERVAL_MS 2000 // Fastest rate the sensor supports
+
+#if CONFIG_SENSORS_SEQUENTIAL_SAMPLING
+#define SEQUENTIAL_TEMPERATURE_TARGET (CONFIG_SENSORS_SEQUENTIAL_TEMPERATURE_TARGET / 100.0f)
+#define SEQUENTIAL_HUMIDITY_TARGET (CONFIG_SENSORS_SEQUENTIAL_HUMIDITY_TARGET / 100.0f)
+#else
+#define SEQUENTIAL_TEMPERATURE_TARGET 0
+#define SEQUENTIAL_HUMIDITY_TARGET 0
+#endif
 
 static const char *TAG = "MODULE[dht22]";
 
+static esp_err_t dht22_read(float *temperature, float *humidity) {
+#if CONFIG_DHT22_DRIVER_LEGACY
+	return dht_read_float_data(
+		DHT_TYPE_AM2301, DHT22_PIN,
+		humidity, temperature);
+#else
+	return dht22_rmt_read(DHT22_PIN, temperature, humidity);
+#endif
+}
+
+static void dht22_push(float temperature, float humidity) {
+	const sensor_sample_t sample = {
+		.timestamp = (uint32_t)time(NULL),
+		.values = {temperature, humidity}};
+
+	if (!sample_ring_push(&dht22_ring, &sample))
+		ESP_LOGW(TAG, "Sample ring full, reading dropped");
+}
+
 void dht22_task() {
-	float temperature_total = 0;
-	float humidity_total = 0;
+	int measured = 0;
+
+	// Fewer samples per wake on a low battery
+	int bulk_size = battery_bulk_size(shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE);
 
-	for (int i = 0; i < shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE; i++) {
+	// Only decides when the bulk is precise enough - the reading is averaged by the consumer
+	sample_stats_t temperature_stats;
+	sample_stats_t humidity_stats;
+	sample_stats_reset(&temperature_stats);
+	sample_stats_reset(&humidity_stats);
+
+	for (int i = 0; i < bulk_size; i++) {
 		float temperature = 0;
 		float humidity = 0;
 
-		ESP_LOGI(TAG, "Measuring [%d/%d]", i + 1, shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE);
+		TRACE(TRACE_DHT22_MEASURING, i + 1, bulk_size);
 
-		esp_err_t result = dht_read_float_data(
-			DHT_TYPE_AM2301, DHT22_PIN,
-			&humidity, &temperature);
+		esp_err_t result = dht22_read(&temperature, &humidity);
 
+		// A failed read only costs this sample - the bulk mean uses the rest
 		if (result != ESP_OK) {
-			ESP_LOGW(TAG, "Temperature/humidity reading failed");
-			ESP_ERROR_CHECK(ESP_FAIL);
+			ESP_LOGW(TAG, "Temperature/humidity reading failed [%d/%d]",
+					 i + 1, bulk_size);
+			vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP * 1000));
+			continue;
 		}
 
-		ESP_LOGI(TAG, "Measured [%d/%d]: temperature=%.2fC, humidity=%.2f%%",
-				 i + 1, shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE,
-				 temperature, humidity);
+		TRACE(TRACE_DHT22_MEASURED, i + 1, bulk_size,
+			  trace_float(temperature), trace_float(humidity));
 
-		temperature_total += temperature;
-		humidity_total += humidity;
+		// The driver is left out of the heap check - its RMT channel is created on the first read
+		alloc_scope_begin();
+		dht22_push(temperature, humidity);
+		measured++;
 
-		vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP * 1000));
-	}
+		sample_stats_add(&temperature_stats, temperature);
+		sample_stats_add(&humidity_stats, humidity);
 
-	float temperature = temperature_total / shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE;
-	float humidity = humidity_total / shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE;
+		bool converged = sample_stats_converged(&temperature_stats, SEQUENTIAL_TEMPERATURE_TARGET) &&
+						 sample_stats_converged(&humidity_stats, SEQUENTIAL_HUMIDITY_TARGET);
+		alloc_scope_end();
 
-	ESP_LOGI(TAG, "Final measurements: temperature=%.2fC, humidity=%.2f%%", temperature, humidity);
+		if (converged) {
+			TRACE(TRACE_DHT22_CONVERGED, measured, bulk_size);
+			break;
+		}
 
-	shared_data.temperature = temperature;
-	shared_data.humidity = humidity;
+		vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP * 1000));
+	}
 
+	if (measured == 0)
+		ESP_LOGE(TAG, "All temperature/humidity readings failed");
+
+	diag_capture_task(DIAG_TASK_DHT22, NULL);
 	xSemaphoreGive(sync_mutex);
 	vTaskDelete(NULL);
 }
+
+// Continuous mode - sampled at the maximum rate for as long as the node runs
+void dht22_stream_task() {
+	TickType_t last_wake = xTaskGetTickCount();
+
+	for (;;) {
+		float temperature;
+		float humidity;
+
+		if (dht22_read(&temperature, &humidity) == ESP_OK) {
+			dht22_push(temperature, humidity);
+		} else {
+			ESP_LOGW(TAG, "Temperature/humidity reading failed");
+		}
+
+		vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(DHT22_MIN_INTERVAL_MS));
+	}
+}
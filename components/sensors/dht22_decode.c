@@ -0,0 +1,36 @@
+#include "stddef.h"
+#include "stdint.h"
+
+#include "sensors.h"
+
+// Bit timing (us) - every bit starts with a 50 us low, the following high lasts 26-28 us for 0 and 70 us for 1
+#define DHT22_BIT_THRESHOLD_US 48
+#define DHT22_BIT_MIN_US 10
+#define DHT22_BIT_MAX_US 100
+
+esp_err_t dht22_decode(const uint16_t *high_us, size_t count, float *temperature, float *humidity) {
+	if (count < DHT22_BITS)
+		return ESP_ERR_INVALID_SIZE;
+
+	// The last 40 high pulses are the data bits - anything before is the start handshake
+	const uint16_t *bits = high_us + count - DHT22_BITS;
+	uint8_t data[DHT22_BITS / 8] = {0};
+
+	for (int i = 0; i < DHT22_BITS; i++) {
+		if (bits[i] < DHT22_BIT_MIN_US || bits[i] > DHT22_BIT_MAX_US)
+			return ESP_ERR_INVALID_RESPONSE;
+
+		data[i / 8] = (data[i / 8] << 1) | (bits[i] > DHT22_BIT_THRESHOLD_US);
+	}
+
+	if ((uint8_t)(data[0] + data[1] + data[2] + data[3]) != data[4])
+		return ESP_ERR_INVALID_CRC;
+
+	*humidity = ((data[0] << 8) | data[1]) / 10.0f;
+	*temperature = (((data[2] & 0x7F) << 8) | data[3]) / 10.0f;
+
+	if (data[2] & 0x80)
+		*temperature = -*temperature;
+
+	return ESP_OK;
+}
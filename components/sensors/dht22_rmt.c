@@ -0,0 +1,98 @@
+#include "driver/gpio.h"
+#include "driver/rmt_rx.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+#include "helpers.h"
+#include "sensors.h"
+
+#define DHT22_RMT_RESOLUTION_HZ 1000000 // 1 tick = 1 us
+#define DHT22_RMT_SYMBOLS 64
+
+#define DHT22_START_PULSE_US 1100
+#define DHT22_GLITCH_FILTER_NS 1000
+#define DHT22_IDLE_THRESHOLD_NS 200000 // Line high for longer than any bit - end of transmission
+#define DHT22_RESPONSE_TIMEOUT_MS 50
+
+static const char *TAG = "MODULE[dht22]";
+
+static rmt_channel_handle_t rx_channel = NULL;
+static QueueHandle_t rx_queue = NULL;
+static StaticQueue_t rx_queue_buffer;
+static uint8_t rx_queue_storage[sizeof(rmt_rx_done_event_data_t)];
+static rmt_symbol_word_t rx_symbols[DHT22_RMT_SYMBOLS];
+
+static bool IRAM_ATTR on_receive_done(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata, void *user_data) {
+	BaseType_t high_task_wakeup = pdFALSE;
+	xQueueSendFromISR((QueueHandle_t)user_data, edata, &high_task_wakeup);
+	return high_task_wakeup == pdTRUE;
+}
+
+static esp_err_t dht22_rmt_init(int pin) {
+	rmt_rx_channel_config_t channel_config = {
+		.clk_src = RMT_CLK_SRC_DEFAULT,
+		.resolution_hz = DHT22_RMT_RESOLUTION_HZ,
+		.mem_block_symbols = DHT22_RMT_SYMBOLS,
+		.gpio_num = pin};
+
+	RETURN_ON_ERROR(rmt_new_rx_channel(&channel_config, &rx_channel));
+
+	rx_queue = xQueueCreateStatic(1, sizeof(rmt_rx_done_event_data_t), rx_queue_storage, &rx_queue_buffer);
+
+	rmt_rx_event_callbacks_t callbacks = {.on_recv_done = on_receive_done};
+	RETURN_ON_ERROR(rmt_rx_register_event_callbacks(rx_channel, &callbacks, rx_queue));
+	RETURN_ON_ERROR(rmt_enable(rx_channel));
+
+	// The RMT channel only listens - the start pulse is driven through the open-drain output
+	RETURN_ON_ERROR(gpio_set_direction(pin, GPIO_MODE_INPUT_OUTPUT_OD));
+	RETURN_ON_ERROR(gpio_pullup_en(pin));
+	return gpio_set_level(pin, 1);
+}
+
+esp_err_t dht22_rmt_read(int pin, float *temperature, float *humidity) {
+	if (rx_channel == NULL) {
+		RETURN_ON_ERROR(dht22_rmt_init(pin));
+	}
+
+	rmt_receive_config_t receive_config = {
+		.signal_range_min_ns = DHT22_GLITCH_FILTER_NS,
+		.signal_range_max_ns = DHT22_IDLE_THRESHOLD_NS};
+
+	xQueueReset(rx_queue);
+
+	// Start signal - interrupts stay enabled, the response is captured by the peripheral
+	gpio_set_level(pin, 0);
+	esp_rom_delay_us(DHT22_START_PULSE_US);
+	RETURN_ON_ERROR(rmt_receive(rx_channel, rx_symbols, sizeof(rx_symbols), &receive_config));
+	gpio_set_level(pin, 1);
+
+	rmt_rx_done_event_data_t event;
+	if (xQueueReceive(rx_queue, &event, pdMS_TO_TICKS(DHT22_RESPONSE_TIMEOUT_MS)) != pdTRUE) {
+		ESP_LOGW(TAG, "No response from sensor");
+		rmt_disable(rx_channel);
+		return rmt_enable(rx_channel) == ESP_OK ? ESP_ERR_TIMEOUT : ESP_FAIL;
+	}
+
+	// Durations of the high levels in capture order
+	uint16_t high_us[DHT22_RMT_SYMBOLS * 2];
+	size_t count = 0;
+
+	for (size_t i = 0; i < event.num_symbols; i++) {
+		const rmt_symbol_word_t *symbol = &event.received_symbols[i];
+
+		if (symbol->level0 && symbol->duration0)
+			high_us[count++] = symbol->duration0;
+
+		if (symbol->level1 && symbol->duration1)
+			high_us[count++] = symbol->duration1;
+	}
+
+	esp_err_t ret = dht22_decode(high_us, count, temperature, humidity);
+	if (ret != ESP_OK)
+		ESP_LOGW(TAG, "Invalid response (%d high pulses): %s", (int)count, esp_err_to_name(ret));
+
+	return ret;
+}
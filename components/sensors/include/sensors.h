@@ -2,5 +2,87 @@
 
 #pragma once
 
+#include "stdatomic.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+// Running aggregate of a bulk of samples of one parameter (Welford - no stored samples, no cancellation)
+typedef struct {
+	int count;
+	float mean;
+	float m2; // Sum of squared differences from the mean
+} sample_stats_t;
+
+void sample_stats_reset(sample_stats_t *stats);
+void sample_stats_add(sample_stats_t *stats, float value);
+float sample_stats_mean(const sample_stats_t *stats);
+float sample_stats_standard_error(const sample_stats_t *stats);
+
+// Sequential sampling - enough samples and the standard error of the mean within the target
+bool sample_stats_converged(const sample_stats_t *stats, float target);
+
+void sds011_frame_command(const uint8_t payload[13], uint8_t command[19]);
+esp_err_t sds011_check_response(const uint8_t response[10]);
+
+#define DHT22_BITS 40
+
+// Decodes the high pulse durations (us) of a DHT22 transmission, the last 40 being the data bits
+esp_err_t dht22_decode(const uint16_t *high_us, size_t count, float *temperature, float *humidity);
+esp_err_t dht22_rmt_read(int pin, float *temperature, float *humidity);
+
+// One timestamped reading of a sensor - DHT22: temperature, humidity / SDS011: PM2.5, PM10
+typedef struct {
+	uint32_t timestamp;
+	float values[2];
+} sensor_sample_t;
+
+// Lock-free single producer / single consumer ring with preallocated slots
+// Producer: the sensor task on APP_CPU, consumer: the main/sync task on PRO_CPU
+typedef struct {
+	sensor_sample_t slots[CONFIG_SENSORS_RING_SLOTS];
+	atomic_uint head;	 // Free running, written by the producer only
+	atomic_uint tail;	 // Free running, written by the consumer only
+	atomic_uint dropped; // Samples pushed into a full ring, never reset
+} sample_ring_t;
+
+extern sample_ring_t dht22_ring;
+extern sample_ring_t sds011_ring;
+
+bool sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample);
+bool sample_ring_pop(sample_ring_t *ring, sensor_sample_t *sample);
+
+// Parameters of the sensor rings - order matches backlog_columns
+typedef enum {
+	STREAM_TEMPERATURE,
+	STREAM_HUMIDITY,
+	STREAM_PM25,
+	STREAM_PM10,
+
+	STREAM_PARAMETER_COUNT
+} stream_parameter_t;
+
+typedef struct {
+	uint32_t timestamp;
+	float value;
+} stream_sample_t;
+
+// Continuous mode - samples of one publish interval
+typedef struct {
+	size_t count[STREAM_PARAMETER_COUNT];
+	stream_sample_t samples[STREAM_PARAMETER_COUNT][CONFIG_STREAM_WINDOW_SAMPLES];
+	uint32_t dropped; // Samples that did not fit the rings or the window
+} stream_window_t;
+
+// Consumer side only - moves pending ring samples into the window until stream_reset()
+void stream_drain();
+const stream_window_t *stream_window();
+void stream_reset();
+
 void dht22_task();
 void sds011_task();
+void dht22_stream_task();
+void sds011_stream_task();
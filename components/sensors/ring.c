@@ -0,0 +1,40 @@
+#include "string.h"
+
+#include "sensors.h"
+
+_Static_assert((CONFIG_SENSORS_RING_SLOTS & (CONFIG_SENSORS_RING_SLOTS - 1)) == 0, "Ring slots must be a power of two");
+
+#define RING_MASK (CONFIG_SENSORS_RING_SLOTS - 1)
+
+sample_ring_t dht22_ring;
+sample_ring_t sds011_ring;
+
+bool sample_ring_push(sample_ring_t *ring, const sensor_sample_t *sample) {
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail == CONFIG_SENSORS_RING_SLOTS) {
+		atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+		return false;
+	}
+
+	ring->slots[head & RING_MASK] = *sample;
+
+	// Publishes the slot - the consumer sees the new head only after the sample is written
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+bool sample_ring_pop(sample_ring_t *ring, sensor_sample_t *sample) {
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+		return false;
+
+	*sample = ring->slots[tail & RING_MASK];
+
+	// Releases the slot - the producer overwrites it only after the sample is read
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
@@ -1,17 +1,38 @@
 #include "stdint.h"
+#include "stdlib.h"
 #include "string.h"
+#include "time.h"
 
 #include "driver/gpio.h"
 #include "driver/uart.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 
+#include "battery.h"
+#include "diagnostics.h"
+#include "helpers.h"
 #include "sensors.h"
 #include "shared.h"
+#include "trace.h"
 
 #define TXD_PIN (GPIO_NUM_17) // Use GPIO17 for TX
 #define RXD_PIN (GPIO_NUM_16) // Use GPIO16 for RX
 #define UART_BUFFER (1024)
+#define RESPONSE_LEN (10)
+
+#define DATA_COMMAND_ID 0xC0
+#define FRAME_HEADER 0xAA
+#define SDS011_FRAME_TIMEOUT_MS 3000 // Frames are reported every second in ACTIVE mode
+#define SDS011_WARM_UP_POLL_MS 1000	 // The sensor updates its reading once a second
+#define SDS011_WARM_UP_FLOOR_RAW 10	 // 1 ug/m3 - below the noise of the sensor
+
+#if CONFIG_SENSORS_SEQUENTIAL_SAMPLING
+#define SEQUENTIAL_PM25_TARGET (CONFIG_SENSORS_SEQUENTIAL_PM25_TARGET / 10.0f)
+#define SEQUENTIAL_PM10_TARGET (CONFIG_SENSORS_SEQUENTIAL_PM10_TARGET / 10.0f)
+#else
+#define SEQUENTIAL_PM25_TARGET 0
+#define SEQUENTIAL_PM10_TARGET 0
+#endif
 
 static const char *TAG = "MODULE[sds011]";
 
@@ -21,12 +42,12 @@ static const uint8_t QUERY_MODE = 0x01;
 static const uint8_t WORK_STATE = 0x01;
 static const uint8_t SLEEP_STATE = 0x00;
 
-static esp_err_t sds011_send_command(const uint8_t payload[13], char *response) {
-	int len;
-	uint8_t command[] = {
+void sds011_frame_command(const uint8_t payload[13], uint8_t command[19]) {
+	static const uint8_t command_template[] = {
 		0xAA, 0xB4, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 		0x00, 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0x00, 0xAB};
 
+	memcpy(command, command_template, sizeof(command_template));
 	memcpy(&command[2], payload, 13);
 
 	// Checksum
@@ -35,16 +56,41 @@ static esp_err_t sds011_send_command(const uint8_t payload[13], char *response)
 		checksum += command[i];
 	}
 	command[17] = (uint8_t)(checksum & 0xFF);
+}
+
+esp_err_t sds011_check_response(const uint8_t response[10]) {
+	if (response[0] != 0xAA || response[9] != 0xAB) {
+		return ESP_FAIL;
+	}
+
+	// Checksum of the 6 data bytes
+	uint8_t checksum = 0;
+	for (int i = 2; i <= 7; i++) {
+		checksum += response[i];
+	}
+
+	return checksum == response[8] ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t sds011_send_command(const uint8_t payload[13], char *response) {
+	int len;
+	uint8_t command[19];
+	sds011_frame_command(payload, command);
 
 	uart_write_bytes(UART_NUM_2, (const char *)command, 19);
 	ESP_ERROR_CHECK(uart_wait_tx_done(UART_NUM_2, pdMS_TO_TICKS(250)));
-	len = uart_read_bytes(UART_NUM_2, response, 10, pdMS_TO_TICKS(250));
+	len = uart_read_bytes(UART_NUM_2, response, RESPONSE_LEN, pdMS_TO_TICKS(250));
 
-	if (len != 10) {
+	if (len != RESPONSE_LEN) {
 		ESP_LOGE(TAG, "Error reading response: %d", len);
 		return ESP_FAIL;
 	}
 
+	if (sds011_check_response((const uint8_t *)response) != ESP_OK) {
+		ESP_LOGE(TAG, "Invalid response frame");
+		return ESP_FAIL;
+	}
+
 	return ESP_OK;
 }
 
@@ -78,7 +124,8 @@ static esp_err_t sds011_write_reporting_mode(char *buffer, uint8_t mode) {
 	return ESP_OK;
 }
 
-static esp_err_t sds011_query_data(char *buffer, uint16_t *pm25, uint16_t *pm10) {
+// Concentrations in tenths of ug/m3, as reported
+static esp_err_t sds011_query_data(char *buffer, uint16_t *pm25_raw, uint16_t *pm10_raw) {
 	const uint8_t payload[] = {0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
 							   0x00, 0x00, 0x00, 0x00, 0x00};
 
@@ -86,11 +133,8 @@ static esp_err_t sds011_query_data(char *buffer, uint16_t *pm25, uint16_t *pm10)
 		return ESP_FAIL;
 	}
 
-	uint16_t pm25_raw = (buffer[3] << 8) | buffer[2];
-	uint16_t pm10_raw = (buffer[5] << 8) | buffer[4];
-
-	*pm25 = pm25_raw / 10;
-	*pm10 = pm10_raw / 10;
+	*pm25_raw = (buffer[3] << 8) | buffer[2];
+	*pm10_raw = (buffer[5] << 8) | buffer[4];
 
 	return ESP_OK;
 }
@@ -112,10 +156,7 @@ static esp_err_t sds011_write_state(char *buffer, uint8_t state) {
 	return ESP_OK;
 }
 
-/**
- * Protocol description: https://sensebox.kaufen/assets/datenblatt/SDS011_Control_Protocol.pdf
- */
-void sds011_task() {
+static void sds011_uart_init() {
 	const uart_config_t uart_config = {
 		.baud_rate = 9600,
 		.data_bits = UART_DATA_8_BITS,
@@ -127,16 +168,92 @@ void sds011_task() {
 	ESP_ERROR_CHECK(uart_param_config(UART_NUM_2, &uart_config));
 	ESP_ERROR_CHECK(uart_set_pin(UART_NUM_2, TXD_PIN, RXD_PIN, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 	ESP_ERROR_CHECK(uart_driver_install(UART_NUM_2, UART_BUFFER * 2, 0, 0, NULL, 0));
+}
+
+// Reads the next data frame reported in ACTIVE mode, resynchronizing on the frame header
+static esp_err_t sds011_read_frame(uint8_t frame[RESPONSE_LEN], TickType_t timeout) {
+	do {
+		if (uart_read_bytes(UART_NUM_2, frame, 1, timeout) != 1)
+			return ESP_ERR_TIMEOUT;
+	} while (frame[0] != FRAME_HEADER);
+
+	if (uart_read_bytes(UART_NUM_2, frame + 1, RESPONSE_LEN - 1, timeout) != RESPONSE_LEN - 1)
+		return ESP_ERR_TIMEOUT;
+
+	if (frame[1] != DATA_COMMAND_ID || sds011_check_response(frame) != ESP_OK)
+		return ESP_ERR_INVALID_RESPONSE;
+
+	return ESP_OK;
+}
+
+static void sds011_push(uint16_t pm25_raw, uint16_t pm10_raw) {
+	const sensor_sample_t sample = {
+		.timestamp = (uint32_t)time(NULL),
+		.values = {pm25_raw / 10.0f, pm10_raw / 10.0f}};
+
+	if (!sample_ring_push(&sds011_ring, &sample))
+		ESP_LOGW(TAG, "Sample ring full, reading dropped");
+}
+
+static bool readings_agree(uint16_t previous, uint16_t current) {
+	int difference = abs((int)current - (int)previous);
+	int tolerance = previous * CONFIG_SDS011_WARM_UP_TOLERANCE_PERCENT / 100;
+
+	return difference <= tolerance || difference <= SDS011_WARM_UP_FLOOR_RAW;
+}
+
+// Polls while the fan spins up and stops once consecutive readings agree - never beyond the configured warm-up
+static uint32_t sds011_warm_up(char *data) {
+	TickType_t start = xTaskGetTickCount();
+	TickType_t limit = pdMS_TO_TICKS(shared_config.SENSORS_PARTICULATE_WARM_UP * 1000);
+	TickType_t minimum = pdMS_TO_TICKS(CONFIG_SDS011_WARM_UP_MIN_S * 1000);
+
+	vTaskDelay(minimum < limit ? minimum : limit);
+
+	uint16_t previous_pm25 = 0;
+	uint16_t previous_pm10 = 0;
+	int stable = 0; // Readings in a row that agree with their predecessor
+
+	while (xTaskGetTickCount() - start < limit) {
+		uint16_t pm25_raw;
+		uint16_t pm10_raw;
+
+		if (sds011_query_data(data, &pm25_raw, &pm10_raw) == ESP_OK) {
+			if (stable > 0 && readings_agree(previous_pm25, pm25_raw) && readings_agree(previous_pm10, pm10_raw))
+				stable++;
+			else
+				stable = 1;
+
+			previous_pm25 = pm25_raw;
+			previous_pm10 = pm10_raw;
+
+			if (stable >= CONFIG_SDS011_WARM_UP_STABLE_READINGS)
+				break;
+		}
+
+		TickType_t remaining = limit - (xTaskGetTickCount() - start);
+		TickType_t poll = pdMS_TO_TICKS(SDS011_WARM_UP_POLL_MS);
+		vTaskDelay(poll < remaining ? poll : remaining);
+	}
+
+	return pdTICKS_TO_MS(xTaskGetTickCount() - start);
+}
+
+/**
+ * Protocol description: https://sensebox.kaufen/assets/datenblatt/SDS011_Control_Protocol.pdf
+ */
+void sds011_task() {
+	sds011_uart_init();
 
 	uint8_t reporting_mode;
 
-	char data[UART_BUFFER];
-	memset(&data, 0, UART_BUFFER);
+	char data[RESPONSE_LEN];
+	memset(&data, 0, RESPONSE_LEN);
 
 	ESP_LOGI(TAG, "Waking up SDS011");
 	sds011_write_state(data, WORK_STATE);
-	vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_PARTICULATE_WARM_UP * 1000));
 
+	// QUERY mode first - the warm-up polls the readings
 	if (sds011_read_reporting_mode(data, &reporting_mode) != ESP_OK) {
 		ESP_LOGE(TAG, "Unable to read SDS011 reporting mode! Commiting suicide...");
 		ESP_ERROR_CHECK(ESP_FAIL);
@@ -151,37 +268,89 @@ void sds011_task() {
 		}
 	}
 
-	uint16_t pm25_total = 0;
-	uint16_t pm10_total = 0;
+	uint32_t warm_up_ms = sds011_warm_up(data);
+	TRACE(TRACE_SDS011_WARMED_UP, warm_up_ms, shared_config.SENSORS_PARTICULATE_WARM_UP * 1000);
+	diag_capture_warm_up(warm_up_ms);
 
-	for (int i = 0; i < shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE; i++) {
-		uint16_t pm25 = 0;
-		uint16_t pm10 = 0;
+	// Fewer samples per wake on a low battery
+	int bulk_size = battery_bulk_size(shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE);
 
-		ESP_LOGI(TAG, "Measuring [%d/%d]", i + 1, shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE);
-		sds011_query_data(data, &pm25, &pm10);
+	// Only decides when the bulk is precise enough - the reading is averaged by the consumer
+	sample_stats_t pm25_stats;
+	sample_stats_t pm10_stats;
+	sample_stats_reset(&pm25_stats);
+	sample_stats_reset(&pm10_stats);
 
-		ESP_LOGI(TAG, "Measured [%d/%d]: PM2.5=%d, PM10=%d",
-				 i + 1, shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE,
-				 pm25, pm10);
+	for (int i = 0; i < bulk_size; i++) {
+		uint16_t pm25_raw = 0;
+		uint16_t pm10_raw = 0;
 
-		pm25_total += pm25;
-		pm10_total += pm10;
+		TRACE(TRACE_SDS011_MEASURING, i + 1, bulk_size);
 
-		vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP * 1000));
-	}
+		if (sds011_query_data(data, &pm25_raw, &pm10_raw) == ESP_OK) {
+			TRACE(TRACE_SDS011_MEASURED, i + 1, bulk_size,
+				  trace_float(pm25_raw / 10.0f), trace_float(pm10_raw / 10.0f));
+
+			alloc_scope_begin();
+			sds011_push(pm25_raw, pm10_raw);
 
-	uint16_t pm25 = pm25_total / shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE;
-	uint16_t pm10 = pm10_total / shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE;
+			sample_stats_add(&pm25_stats, pm25_raw / 10.0f);
+			sample_stats_add(&pm10_stats, pm10_raw / 10.0f);
 
-	ESP_LOGI(TAG, "Final measurements: PM2.5=%d, PM10=%d", pm25, pm10);
+			bool converged = sample_stats_converged(&pm25_stats, SEQUENTIAL_PM25_TARGET) &&
+							 sample_stats_converged(&pm10_stats, SEQUENTIAL_PM10_TARGET);
+			alloc_scope_end();
+
+			if (converged) {
+				TRACE(TRACE_SDS011_CONVERGED, pm25_stats.count, bulk_size);
+				break;
+			}
+		}
+
+		vTaskDelay(pdMS_TO_TICKS(shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP * 1000));
+	}
 
 	ESP_LOGI(TAG, "Setting SDS011 to sleep");
 	sds011_write_state(data, SLEEP_STATE);
 
-	shared_data.pm25 = pm25;
-	shared_data.pm10 = pm10;
-
+	diag_capture_task(DIAG_TASK_SDS011, NULL);
 	xSemaphoreGive(sync_mutex);
 	vTaskDelete(NULL);
 }
+
+// Continuous mode - the sensor stays awake in ACTIVE mode and every reported frame is streamed
+void sds011_stream_task() {
+	sds011_uart_init();
+
+	char data[RESPONSE_LEN];
+	memset(&data, 0, RESPONSE_LEN);
+
+	ESP_LOGI(TAG, "Waking up SDS011");
+	sds011_write_state(data, WORK_STATE);
+
+	if (sds011_write_reporting_mode(data, ACTIVE_MODE) != ESP_OK) {
+		ESP_LOGE(TAG, "Unable to set SDS011 ACTIVE reporting mode. Commiting suicide...");
+		ESP_ERROR_CHECK(ESP_FAIL);
+	}
+
+	// Frames reported while the fan spins up are not representative
+	TickType_t warm_up_end = xTaskGetTickCount() + pdMS_TO_TICKS(shared_config.SENSORS_PARTICULATE_WARM_UP * 1000);
+	uint8_t frame[RESPONSE_LEN];
+
+	for (;;) {
+		esp_err_t ret = sds011_read_frame(frame, pdMS_TO_TICKS(SDS011_FRAME_TIMEOUT_MS));
+
+		if (ret == ESP_ERR_TIMEOUT) {
+			ESP_LOGW(TAG, "No frame reported by SDS011");
+			continue;
+		}
+
+		if (ret != ESP_OK || (int32_t)(xTaskGetTickCount() - warm_up_end) < 0)
+			continue;
+
+		uint16_t pm25_raw = (frame[3] << 8) | frame[2];
+		uint16_t pm10_raw = (frame[5] << 8) | frame[4];
+
+		sds011_push(pm25_raw, pm10_raw);
+	}
+}
@@ -0,0 +1,36 @@
+#include "math.h"
+
+#include "sensors.h"
+
+void sample_stats_reset(sample_stats_t *stats) {
+	stats->count = 0;
+	stats->mean = 0;
+	stats->m2 = 0;
+}
+
+void sample_stats_add(sample_stats_t *stats, float value) {
+	stats->count++;
+
+	float delta = value - stats->mean;
+	stats->mean += delta / stats->count;
+	stats->m2 += delta * (value - stats->mean);
+}
+
+float sample_stats_mean(const sample_stats_t *stats) {
+	return stats->mean;
+}
+
+float sample_stats_standard_error(const sample_stats_t *stats) {
+	if (stats->count < 2)
+		return INFINITY;
+
+	return sqrtf(stats->m2 / ((stats->count - 1) * stats->count));
+}
+
+bool sample_stats_converged(const sample_stats_t *stats, float target) {
+#if CONFIG_SENSORS_SEQUENTIAL_SAMPLING
+	return stats->count >= CONFIG_SENSORS_SEQUENTIAL_MIN_SAMPLES && sample_stats_standard_error(stats) <= target;
+#else
+	return false;
+#endif
+}
@@ -0,0 +1,44 @@
+#include "stdatomic.h"
+
+#include "sensors.h"
+
+// Owned by the consumer - sensor tasks only ever touch their rings
+static stream_window_t window;
+static unsigned dropped_seen[2];
+
+static void drain_ring(sample_ring_t *ring, unsigned *seen, stream_parameter_t first) {
+	sensor_sample_t sample;
+
+	while (sample_ring_pop(ring, &sample)) {
+		for (int v = 0; v < 2; v++) {
+			stream_parameter_t parameter = first + v;
+
+			if (window.count[parameter] < CONFIG_STREAM_WINDOW_SAMPLES) {
+				stream_sample_t *slot = &window.samples[parameter][window.count[parameter]++];
+				slot->timestamp = sample.timestamp;
+				slot->value = sample.values[v];
+			} else {
+				window.dropped++;
+			}
+		}
+	}
+
+	unsigned dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+	window.dropped += dropped - *seen;
+	*seen = dropped;
+}
+
+void stream_drain() {
+	drain_ring(&dht22_ring, &dropped_seen[0], STREAM_TEMPERATURE);
+	drain_ring(&sds011_ring, &dropped_seen[1], STREAM_PM25);
+}
+
+const stream_window_t *stream_window() {
+	return &window;
+}
+
+void stream_reset() {
+	for (int p = 0; p < STREAM_PARAMETER_COUNT; p++)
+		window.count[p] = 0;
+	window.dropped = 0;
+}
@@ -0,0 +1,47 @@
+#include "sdkconfig.h"
+
+#include "shared.h"
+
+// Configuration baked into the image - checked here at build time instead of by ensure_config() on every boot
+
+#define FITS(value, field) (sizeof(value) <= sizeof(((shared_config_t *)0)->field))
+
+#define SCHEMA_INT(field, key, default_value, min, max) _Static_assert((default_value) >= (min) && (default_value) <= (max), "Invalid " key);
+#define SCHEMA_STRING(field, key, size, default_value) _Static_assert(FITS(default_value, field), key " too long");
+#include "config_schema.h"
+
+_Static_assert(CONFIG_SYNC_LINK_ROLE != SYNC_LINK_LEAF || sizeof(CONFIG_SYNC_LINK_GATEWAY) == 18, "Leaf nodes require the gateway MAC address");
+_Static_assert(CONFIG_SYNC_LINK_ROLE != SYNC_LINK_LEAF || !CONFIG_SENSORS_CONTINUOUS_MODE, "Leaf nodes can't stream continuously");
+_Static_assert(CONFIG_SYNC_LINK_ROLE != SYNC_LINK_BEACON || !CONFIG_SENSORS_CONTINUOUS_MODE, "Beacon nodes can't stream continuously");
+
+_Static_assert(CONFIG_SYNC_LINK_ROLE == SYNC_LINK_LEAF || CONFIG_SYNC_LINK_ROLE == SYNC_LINK_BEACON || sizeof(CONFIG_SYNC_MQTT_BROKER_URL) > 1, "MQTT broker URL is required");
+
+_Static_assert(CONFIG_SYNC_LINK_ROLE == SYNC_LINK_LEAF || CONFIG_SYNC_LINK_ROLE == SYNC_LINK_BEACON || sizeof(CONFIG_SYNC_WIFI_SSID) > 1, "Wi-Fi SSID is required");
+_Static_assert(FITS(CONFIG_SYNC_WIFI_SSID, SYNC_WIFI_NETWORKS[0].ssid), "Wi-Fi SSID too long");
+_Static_assert(FITS(CONFIG_SYNC_WIFI_USERNAME, SYNC_WIFI_NETWORKS[0].username), "Wi-Fi username too long");
+_Static_assert(FITS(CONFIG_SYNC_WIFI_PASSWORD, SYNC_WIFI_NETWORKS[0].password), "Wi-Fi password too long");
+
+_Static_assert(CONFIG_SYNC_WIFI_PROTOCOL == WIFI_AUTH_OPEN ||
+				   CONFIG_SYNC_WIFI_PROTOCOL == WIFI_AUTH_WPA2_PSK ||
+				   CONFIG_SYNC_WIFI_PROTOCOL == WIFI_AUTH_WPA2_ENTERPRISE,
+			   "Unsupported Wi-Fi protocol");
+
+_Static_assert(CONFIG_SYNC_WIFI_PROTOCOL != WIFI_AUTH_WPA2_PSK || sizeof(CONFIG_SYNC_WIFI_PASSWORD) > 1,
+			   "WPA2 requires a Wi-Fi password");
+
+_Static_assert(CONFIG_SYNC_WIFI_PROTOCOL != WIFI_AUTH_WPA2_ENTERPRISE ||
+				   (sizeof(CONFIG_SYNC_WIFI_USERNAME) > 1 && sizeof(CONFIG_SYNC_WIFI_PASSWORD) > 1),
+			   "WPA2 Enterprise requires a Wi-Fi username and password");
+
+const shared_config_t shared_config = {
+#define SCHEMA_INT(field, key, default_value, min, max) .field = (default_value),
+#define SCHEMA_STRING(field, key, size, default_value) .field = default_value,
+#include "config_schema.h"
+
+	.SYNC_WIFI_NETWORKS = {{
+		.ssid = CONFIG_SYNC_WIFI_SSID,
+		.username = CONFIG_SYNC_WIFI_USERNAME,
+		.password = CONFIG_SYNC_WIFI_PASSWORD,
+		.protocol = CONFIG_SYNC_WIFI_PROTOCOL,
+	}},
+	.SYNC_WIFI_NETWORK_COUNT = 1};
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Generates the perfect hash that maps configuration keys to their schema line.
+
+Reads include/config_schema.h and searches for a seed of the FNV-1a hash in
+shared.c (schema_key_hash) under which every key lands in its own slot of a
+power of two table. Writes the seed and the slot table as a C header:
+
+	gen_config_dispatch.py include/config_schema.h config_dispatch.h
+"""
+
+import re
+import sys
+
+SCHEMA_RE = re.compile(r'^SCHEMA_\w+\([^"]*"([^"]+)"', re.MULTILINE)
+
+FNV_PRIME = 16777619
+MAX_SEEDS = 1 << 20
+
+
+def load_keys(path):
+	with open(path) as f:
+		keys = SCHEMA_RE.findall(f.read())
+
+	if len(keys) != len(set(keys)):
+		raise ValueError("duplicate configuration key")
+	if len(keys) > 127:
+		raise ValueError("too many configuration keys for an int8_t table")
+
+	return keys
+
+
+def key_hash(key, seed):
+	h = seed
+	for byte in key.encode():
+		h = ((h ^ byte) * FNV_PRIME) & 0xFFFFFFFF
+	return h
+
+
+def find_seed(keys, slots):
+	for seed in range(MAX_SEEDS):
+		table = [-1] * slots
+		for index, key in enumerate(keys):
+			slot = key_hash(key, seed) & (slots - 1)
+			if table[slot] >= 0:
+				break
+			table[slot] = index
+		else:
+			return seed, table
+
+	return None
+
+
+def main():
+	if len(sys.argv) != 3:
+		sys.exit(__doc__)
+
+	keys = load_keys(sys.argv[1])
+
+	# Twice the keys, rounded up to a power of two - a seed is found within a few tries
+	slots = 1
+	while slots < 2 * len(keys):
+		slots *= 2
+
+	found = find_seed(keys, slots)
+	if found is None:
+		sys.exit("no perfect hash seed found")
+
+	seed, table = found
+	rows = [", ".join(f"{index:2d}" for index in table[i:i + 16]) for i in range(0, slots, 16)]
+
+	with open(sys.argv[2], "w") as f:
+		f.write("// Generated by gen_config_dispatch.py from config_schema.h - do not edit\n\n")
+		f.write("#pragma once\n\n")
+		f.write(f"#define CONFIG_DISPATCH_KEYS {len(keys)}\n")
+		f.write(f"#define CONFIG_DISPATCH_SEED {seed}u\n")
+		f.write(f"#define CONFIG_DISPATCH_SLOTS {slots}\n\n")
+		f.write("// Schema line of the key hashed to each slot, -1 = no key\n")
+		f.write("#define CONFIG_DISPATCH_TABLE {\\\n\t" + ",\\\n\t".join(rows) + "}\n")
+
+
+if __name__ == "__main__":
+	main()
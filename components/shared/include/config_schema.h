@@ -0,0 +1,50 @@
+// Runtime configuration schema - one JSON key per line, expanded with the SCHEMA_* macros the includer defines
+// SCHEMA_INT(field, key, default_value, min, max) - int field of shared_config_t, valid within [min, max]
+// SCHEMA_STRING(field, key, size, default_value) - char array field of shared_config_t
+// SCHEMA_NETWORK(member, key) - string member of the primary Wi-Fi network, empty by default
+// SCHEMA_PROTOCOL(member, key, default_value) - auth mode of the primary network, given as "open", "wpa2" or "wpa2e"
+// SCHEMA_NETWORKS(key) - array of fallback networks
+// Parsed by components/shared/gen_config_dispatch.py - keep one key per line
+
+#ifndef SCHEMA_INT
+#define SCHEMA_INT(field, key, default_value, min, max)
+#endif
+#ifndef SCHEMA_STRING
+#define SCHEMA_STRING(field, key, size, default_value)
+#endif
+#ifndef SCHEMA_NETWORK
+#define SCHEMA_NETWORK(member, key)
+#endif
+#ifndef SCHEMA_PROTOCOL
+#define SCHEMA_PROTOCOL(member, key, default_value)
+#endif
+#ifndef SCHEMA_NETWORKS
+#define SCHEMA_NETWORKS(key)
+#endif
+
+SCHEMA_INT(SENSORS_GENERAL_MEASUREMENT_INTERVAL, "measurement_interval", CONFIG_SENSORS_GENERAL_MEASUREMENT_INTERVAL, 1, INT_MAX)
+SCHEMA_INT(SENSORS_ENVIRONMENTAL_INTERVAL, "environmental_interval", CONFIG_SENSORS_ENVIRONMENTAL_INTERVAL, 0, INT_MAX) // Minutes, 0 follows measurement_interval
+SCHEMA_INT(SENSORS_PARTICULATE_INTERVAL, "particulate_interval", CONFIG_SENSORS_PARTICULATE_INTERVAL, 0, INT_MAX) // Minutes, 0 follows measurement_interval
+SCHEMA_INT(SYNC_INTERVAL, "sync_interval", CONFIG_SYNC_INTERVAL, 0, INT_MAX) // Minutes, 0 follows measurement_interval
+SCHEMA_INT(SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE, "environmental_bulk_size", CONFIG_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE, 1, INT_MAX)
+SCHEMA_INT(SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP, "environmental_bulk_sleep", CONFIG_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP, 1, INT_MAX)
+SCHEMA_INT(SENSORS_PARTICULATE_WARM_UP, "particulate_warm_up", CONFIG_SENSORS_PARTICULATE_WARM_UP, 0, INT_MAX)
+SCHEMA_INT(SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE, "particulate_bulk_size", CONFIG_SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE, 1, INT_MAX)
+SCHEMA_INT(SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP, "particulate_bulk_sleep", CONFIG_SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP, 1, INT_MAX)
+SCHEMA_INT(SENSORS_CONTINUOUS_MODE, "continuous_mode", CONFIG_SENSORS_CONTINUOUS_MODE, 0, 1) // Mains powered nodes - never sleeps
+SCHEMA_INT(SYNC_CONTINUOUS_PUBLISH_INTERVAL, "continuous_publish_interval", CONFIG_SYNC_CONTINUOUS_PUBLISH_INTERVAL, 1, INT_MAX)
+SCHEMA_INT(SYNC_LINK_ROLE, "link_role", CONFIG_SYNC_LINK_ROLE, SYNC_LINK_WIFI, SYNC_LINK_BEACON)
+SCHEMA_STRING(SYNC_LINK_GATEWAY, "link_gateway", 18, CONFIG_SYNC_LINK_GATEWAY) // MAC address of the gateway, AA:BB:CC:DD:EE:FF
+SCHEMA_INT(SYNC_LINK_CHANNEL, "link_channel", CONFIG_SYNC_LINK_CHANNEL, 1, 13) // Wi-Fi channel of the gateway's AP
+SCHEMA_NETWORK(ssid, "wifi_ssid")
+SCHEMA_NETWORK(username, "wifi_username")
+SCHEMA_NETWORK(password, "wifi_password")
+SCHEMA_PROTOCOL(protocol, "wifi_protocol", CONFIG_SYNC_WIFI_PROTOCOL)
+SCHEMA_NETWORKS("wifi_networks")
+SCHEMA_STRING(SYNC_MQTT_BROKER_URL, "mqtt_broker_url", 256, CONFIG_SYNC_MQTT_BROKER_URL)
+
+#undef SCHEMA_INT
+#undef SCHEMA_STRING
+#undef SCHEMA_NETWORK
+#undef SCHEMA_PROTOCOL
+#undef SCHEMA_NETWORKS
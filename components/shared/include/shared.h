@@ -1,10 +1,12 @@
 #pragma once
 
+#include <limits.h>
 #include <stdint.h>
 
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "sdkconfig.h"
 
 #include "wifi.h"
 
@@ -16,20 +18,22 @@
 
 #define NVS_KEY_CONFIG "config"
 
-#define CFG_KEY_SYNC_WIFI_SSID "wifi_ssid"
-#define CFG_KEY_SYNC_WIFI_USERNAME "wifi_username"
-#define CFG_KEY_SYNC_WIFI_PASSWORD "wifi_password"
-#define CFG_KEY_SYNC_WIFI_PROTOCOL "wifi_protocol"
-#define CFG_KEY_SYNC_MQTT_BROKER_URL "mqtt_broker_url"
-#define CFG_KEY_SENSORS_GENERAL_MEASUREMENT_INTERVAL "measurement_interval"
-#define CFG_KEY_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE "environmental_bulk_size"
-#define CFG_KEY_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP "environmental_bulk_sleep"
-#define CFG_KEY_SENSORS_PARTICULATE_WARM_UP "particulate_warm_up"
-#define CFG_KEY_SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE "particulate_bulk_size"
-#define CFG_KEY_SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP "particulate_bulk_sleep"
+#define SHARED_CONFIG_MAX_LEN 1024 // Longest configuration document, terminator included
+
+// SYNC_LINK_ROLE - how readings leave the node
+enum {
+	SYNC_LINK_WIFI,	   // Own Wi-Fi association and MQTT session
+	SYNC_LINK_LEAF,	   // ESP-NOW frames to a gateway node, no association
+	SYNC_LINK_GATEWAY, // Stays associated, forwards the readings of leaf nodes
+	SYNC_LINK_BEACON,  // Latest reading in BLE advertisements, nothing is acknowledged
+};
 
 // ===== ===== ===== =====
 
+// Marks a parameter whose sensor was not due (or failed) on that wake - NAN for temperature and humidity
+#define READING_PM_MISSING UINT16_MAX
+
+// One reading of every parameter - assembled from the sensor sample rings
 typedef struct {
 	float temperature;
 	float humidity;
@@ -38,26 +42,38 @@ typedef struct {
 } shared_data_t;
 
 typedef struct {
-	int SENSORS_GENERAL_MEASUREMENT_INTERVAL;
-
-	int SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE;
-	int SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP;
+	char ssid[32];
+	char username[64];
+	char password[64];
+	wifi_auth_mode_t protocol;
+} wifi_network_t;
 
-	int SENSORS_PARTICULATE_WARM_UP;
-	int SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE;
-	int SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP;
-
-	char SYNC_WIFI_SSID[32];
-	char SYNC_WIFI_USERNAME[64];
-	char SYNC_WIFI_PASSWORD[64];
-	wifi_auth_mode_t SYNC_WIFI_PROTOCOL;
+// Fields of the runtime configuration are declared in config_schema.h
+typedef struct {
+#define SCHEMA_INT(field, key, default_value, min, max) int field;
+#define SCHEMA_STRING(field, key, size, default_value) char field[size];
+#include "config_schema.h"
 
-	char SYNC_MQTT_BROKER_URL[256];
+	// Ordered by preference - the first entry comes from the wifi_ssid/... keys
+	wifi_network_t SYNC_WIFI_NETWORKS[CONFIG_SYNC_WIFI_MAX_NETWORKS];
+	int SYNC_WIFI_NETWORK_COUNT;
 } shared_config_t;
 
 extern SemaphoreHandle_t sync_mutex;
-extern shared_data_t shared_data;
+
+#if CONFIG_VOGON_BAKED_CONFIG
+extern const shared_config_t shared_config;
+#else
 extern shared_config_t shared_config;
+extern uint32_t shared_config_hash; // config_hash() of the configuration loaded from NVS
 
 esp_err_t load_shared_config();
+esp_err_t shared_config_parse(const char *json_string, shared_config_t *config);
+esp_err_t shared_config_store(const char *json_string);
+#endif
+
+esp_err_t shared_nvs_init();
+esp_err_t shared_nvs_init_default();
+uint32_t config_hash(const char *json_string);
+void shared_json_init();
 esp_err_t nvs_read_str(const char *key, char **value, size_t *len, const char *default_value);
@@ -1,70 +1,219 @@
+#include "stddef.h"
+
 #include "cJSON.h"
 #include "esp_log.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "sdkconfig.h"
 
 #include "helpers.h"
 #include "shared.h"
 
+#if !CONFIG_VOGON_BAKED_CONFIG
+#include "config_dispatch.h"
+#endif
+
 static const char *TAG = "MODULE[shared]";
 
 SemaphoreHandle_t sync_mutex;
-shared_data_t shared_data = {0};
+
+// FNV-1a - cheap change detection of configuration documents
+uint32_t config_hash(const char *json_string) {
+	uint32_t hash = 2166136261u;
+
+	for (const char *c = json_string; *c != '\0'; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+// Parsed documents are short-lived - allocations bump through a static arena that
+// rewinds once every cJSON item handed out is freed again. Baked builds parse only
+// OTA manifests and default to a smaller arena.
+static uint8_t json_arena[CONFIG_VOGON_JSON_ARENA_SIZE] __attribute__((aligned(8)));
+static size_t json_arena_used = 0;
+static size_t json_arena_live = 0;
+static portMUX_TYPE json_arena_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void *json_arena_malloc(size_t size) {
+	size = (size + 7) & ~(size_t)7;
+	void *ptr = NULL;
+
+	taskENTER_CRITICAL(&json_arena_lock);
+	if (size <= sizeof(json_arena) - json_arena_used) {
+		ptr = &json_arena[json_arena_used];
+		json_arena_used += size;
+		json_arena_live++;
+	}
+	taskEXIT_CRITICAL(&json_arena_lock);
+
+	if (ptr == NULL)
+		ESP_LOGE(TAG, "JSON arena exhausted (%d bytes)", (int)sizeof(json_arena));
+
+	return ptr;
+}
+
+static void json_arena_free(void *ptr) {
+	if (ptr == NULL)
+		return;
+
+	taskENTER_CRITICAL(&json_arena_lock);
+	if (--json_arena_live == 0)
+		json_arena_used = 0;
+	taskEXIT_CRITICAL(&json_arena_lock);
+}
+
+void shared_json_init() {
+	cJSON_Hooks hooks = {.malloc_fn = json_arena_malloc, .free_fn = json_arena_free};
+	cJSON_InitHooks(&hooks);
+}
+
+static esp_err_t nvs_init_partition(const char *partition, bool *initialized) {
+	if (*initialized)
+		return ESP_OK;
+
+	esp_err_t ret = nvs_flash_init_partition(partition);
+	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+		RETURN_ON_ERROR(nvs_flash_erase_partition(partition));
+		ret = nvs_flash_init_partition(partition);
+	}
+
+	*initialized = ret == ESP_OK;
+	return ret;
+}
+
+// NVS partitions are initialized on first use - wakes that never touch them skip the mount
+
+esp_err_t shared_nvs_init() {
+	static bool initialized = false;
+	return nvs_init_partition(NVS_PARTITION, &initialized);
+}
+
+// Default partition - Wi-Fi and BLE keep calibration and bonding data there
+esp_err_t shared_nvs_init_default() {
+	static bool initialized = false;
+	return nvs_init_partition(NVS_DEFAULT_PART_NAME, &initialized);
+}
+
+#if !CONFIG_VOGON_BAKED_CONFIG
 shared_config_t shared_config = {0};
+uint32_t shared_config_hash = 0;
 
 typedef enum {
-	TYPE_INT,
-	TYPE_STR
-} handle_type_t;
+	SCHEMA_KIND_INT,
+	SCHEMA_KIND_STRING,
+	SCHEMA_KIND_NETWORK,
+	SCHEMA_KIND_PROTOCOL,
+	SCHEMA_KIND_NETWORKS
+} schema_kind_t;
 
 typedef struct {
-	void *destination;
-	size_t destination_size;
-	char *json_key;
-	handle_type_t type;
+	const char *key;
+	schema_kind_t kind;
+	uint16_t offset; // Field offset within shared_config_t
+	uint16_t size;
+	int min;
+	int max;
+} schema_entry_t;
+
+#define FIELD_SIZE(field) sizeof(((shared_config_t *)0)->field)
+
+// One entry per line of config_schema.h, in the same order - indexed by the generated dispatch table
+static const schema_entry_t schema[] = {
+#define SCHEMA_INT(field, key, default_value, min, max) {key, SCHEMA_KIND_INT, offsetof(shared_config_t, field), FIELD_SIZE(field), min, max},
+#define SCHEMA_STRING(field, key, size, default_value) {key, SCHEMA_KIND_STRING, offsetof(shared_config_t, field), FIELD_SIZE(field)},
+#define SCHEMA_NETWORK(member, key) {key, SCHEMA_KIND_NETWORK, offsetof(shared_config_t, SYNC_WIFI_NETWORKS[0].member), FIELD_SIZE(SYNC_WIFI_NETWORKS[0].member)},
+#define SCHEMA_PROTOCOL(member, key, default_value) {key, SCHEMA_KIND_PROTOCOL, offsetof(shared_config_t, SYNC_WIFI_NETWORKS[0].member), FIELD_SIZE(SYNC_WIFI_NETWORKS[0].member)},
+#define SCHEMA_NETWORKS(key) {key, SCHEMA_KIND_NETWORKS},
+#include "config_schema.h"
+};
+
+static const int8_t dispatch[CONFIG_DISPATCH_SLOTS] = CONFIG_DISPATCH_TABLE;
+
+_Static_assert(sizeof(schema) / sizeof(schema[0]) == CONFIG_DISPATCH_KEYS, "config_dispatch.h is out of date with config_schema.h");
+
+// FNV-1a from the generated seed - must match gen_config_dispatch.py
+static uint32_t schema_key_hash(const char *key) {
+	uint32_t hash = CONFIG_DISPATCH_SEED;
+
+	for (const char *c = key; *c != '\0'; c++) {
+		hash ^= (uint8_t)*c;
+		hash *= 16777619u;
+	}
 
-	union {
-		int default_int;
-		const char *default_str;
-	};
-} config_mapping_t;
+	return hash;
+}
 
-config_mapping_t mappings[] = {
-	{&shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL, sizeof(int), CFG_KEY_SENSORS_GENERAL_MEASUREMENT_INTERVAL, TYPE_INT, .default_int = CONFIG_SENSORS_GENERAL_MEASUREMENT_INTERVAL},
+// One hash and one comparison - unknown keys land on an empty slot or on a different key
+static const schema_entry_t *schema_lookup(const char *key) {
+	if (key == NULL)
+		return NULL;
 
-	{&shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE, sizeof(int), CFG_KEY_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE, TYPE_INT, .default_int = CONFIG_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE},
-	{&shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP, sizeof(int), CFG_KEY_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP, TYPE_INT, .default_int = CONFIG_SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP},
+	int index = dispatch[schema_key_hash(key) & (CONFIG_DISPATCH_SLOTS - 1)];
+	if (index < 0 || strcmp(schema[index].key, key) != 0)
+		return NULL;
 
-	{&shared_config.SENSORS_PARTICULATE_WARM_UP, sizeof(int), CFG_KEY_SENSORS_PARTICULATE_WARM_UP, TYPE_INT, .default_int = CONFIG_SENSORS_PARTICULATE_WARM_UP},
-	{&shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE, sizeof(int), CFG_KEY_SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE, TYPE_INT, .default_int = CONFIG_SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE},
-	{&shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP, sizeof(int), CFG_KEY_SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP, TYPE_INT, .default_int = CONFIG_SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE},
+	return &schema[index];
+}
 
-	{shared_config.SYNC_WIFI_SSID, sizeof(char) * 32, CFG_KEY_SYNC_WIFI_SSID, TYPE_STR, .default_str = ""},
-	{shared_config.SYNC_WIFI_USERNAME, sizeof(char) * 64, CFG_KEY_SYNC_WIFI_USERNAME, TYPE_STR, .default_str = ""},
-	{shared_config.SYNC_WIFI_PASSWORD, sizeof(char) * 64, CFG_KEY_SYNC_WIFI_PASSWORD, TYPE_STR, .default_str = ""},
-	{&shared_config.SYNC_WIFI_PROTOCOL, sizeof(int), CFG_KEY_SYNC_WIFI_PROTOCOL, TYPE_INT, .default_int = CONFIG_SYNC_WIFI_PROTOCOL},
+static void copy_value(char *destination, size_t destination_size, const char *value) {
+	strncpy(destination, value, destination_size - 1);
+	destination[destination_size - 1] = '\0';
+}
 
-	{shared_config.SYNC_MQTT_BROKER_URL, sizeof(char) * 256, CFG_KEY_SYNC_MQTT_BROKER_URL, TYPE_STR, .default_str = CONFIG_SYNC_MQTT_BROKER_URL}};
+static void set_defaults(shared_config_t *config) {
+	memset(config, 0, sizeof(shared_config_t));
 
-static bool ensure_config() {
-	bool conditions[] = {
-		shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL > 0,
-		shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SIZE > 0,
-		shared_config.SENSORS_ENVIRONMENTAL_MEASUREMENT_BULK_SLEEP > 0,
-		shared_config.SENSORS_PARTICULATE_WARM_UP >= 0,
-		shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SIZE > 0,
-		shared_config.SENSORS_PARTICULATE_MEASUREMENT_BULK_SLEEP > 0,
+#define SCHEMA_INT(field, key, default_value, min, max) config->field = (default_value);
+#define SCHEMA_STRING(field, key, size, default_value) copy_value(config->field, sizeof(config->field), (default_value));
+#define SCHEMA_PROTOCOL(member, key, default_value) config->SYNC_WIFI_NETWORKS[0].member = (default_value);
+#include "config_schema.h"
+}
+
+static bool ensure_network(const wifi_network_t *network) {
+	switch (network->protocol) {
+		case WIFI_AUTH_OPEN:
+			return strlen(network->ssid) > 0;
+
+		case WIFI_AUTH_WPA2_PSK:
+			return strlen(network->ssid) > 0 && strlen(network->password) > 0;
+
+		case WIFI_AUTH_WPA2_ENTERPRISE:
+			return strlen(network->ssid) > 0 && strlen(network->username) > 0 && strlen(network->password) > 0;
+
+		default:
+			return false;
+	}
+}
+
+static bool ensure_config(const shared_config_t *config) {
+	for (int i = 0; i < config->SYNC_WIFI_NETWORK_COUNT; i++)
+		if (!ensure_network(&config->SYNC_WIFI_NETWORKS[i]))
+			return false;
+
+	for (size_t i = 0; i < sizeof(schema) / sizeof(schema[0]); i++) {
+		const schema_entry_t *entry = &schema[i];
+		if (entry->kind != SCHEMA_KIND_INT)
+			continue;
 
-		strlen(shared_config.SYNC_MQTT_BROKER_URL) > 0,
-		strlen(shared_config.SYNC_WIFI_SSID) > 0,
+		int value = *(const int *)((const uint8_t *)config + entry->offset);
+		if (value < entry->min || value > entry->max) {
+			ESP_LOGE(TAG, "Invalid %s: %d", entry->key, value);
+			return false;
+		}
+	}
 
-		(shared_config.SYNC_WIFI_PROTOCOL == WIFI_AUTH_WPA2_PSK
-			 ? strlen(shared_config.SYNC_WIFI_PASSWORD) > 0
-			 : true),
+	// Rules across keys - ranges of single keys come from config_schema.h
+	bool conditions[] = {
+		config->SYNC_LINK_ROLE != SYNC_LINK_LEAF || strlen(config->SYNC_LINK_GATEWAY) == 17,
+		config->SYNC_LINK_ROLE != SYNC_LINK_LEAF || !config->SENSORS_CONTINUOUS_MODE,
+		config->SYNC_LINK_ROLE != SYNC_LINK_BEACON || !config->SENSORS_CONTINUOUS_MODE,
 
-		(shared_config.SYNC_WIFI_PROTOCOL == WIFI_AUTH_WPA2_ENTERPRISE
-			 ? strlen(shared_config.SYNC_WIFI_USERNAME) > 0 && strlen(shared_config.SYNC_WIFI_PASSWORD) > 0
-			 : true)};
+		// Leaf and beacon nodes never associate or talk to the broker themselves
+		config->SYNC_LINK_ROLE == SYNC_LINK_LEAF || config->SYNC_LINK_ROLE == SYNC_LINK_BEACON || strlen(config->SYNC_MQTT_BROKER_URL) > 0,
+		config->SYNC_LINK_ROLE == SYNC_LINK_LEAF || config->SYNC_LINK_ROLE == SYNC_LINK_BEACON || config->SYNC_WIFI_NETWORK_COUNT > 0};
 
 	for (size_t i = 0; i < sizeof(conditions) / sizeof(bool); i++)
 		if (!conditions[i])
@@ -86,69 +235,137 @@ wifi_auth_mode_t wifi_auth_mode_from_string(const char *str) {
 	}
 }
 
-esp_err_t load_shared_config() {
-	char *json_string = NULL;
-	size_t json_len = 0;
-	esp_err_t ret = nvs_read_str(NVS_KEY_CONFIG, &json_string, &json_len, NULL);
+static void copy_string(char *destination, size_t destination_size, const cJSON *item) {
+	copy_value(destination, destination_size, cJSON_IsString(item) && item->valuestring != NULL ? item->valuestring : "");
+}
 
-	if (json_string == NULL)
-		return ESP_FAIL;
+// Fallback networks follow the primary one given by the flat wifi_* keys
+static void parse_networks(const cJSON *networks, shared_config_t *config) {
+	int count = strlen(config->SYNC_WIFI_NETWORKS[0].ssid) > 0 ? 1 : 0;
+
+	const cJSON *item = NULL;
+	cJSON_ArrayForEach(item, networks) {
+		if (count == CONFIG_SYNC_WIFI_MAX_NETWORKS) {
+			ESP_LOGW(TAG, "Only %d Wi-Fi networks supported, ignoring the rest", CONFIG_SYNC_WIFI_MAX_NETWORKS);
+			break;
+		}
+
+		wifi_network_t *network = &config->SYNC_WIFI_NETWORKS[count++];
+		copy_string(network->ssid, sizeof(network->ssid), cJSON_GetObjectItemCaseSensitive(item, "ssid"));
+		copy_string(network->username, sizeof(network->username), cJSON_GetObjectItemCaseSensitive(item, "username"));
+		copy_string(network->password, sizeof(network->password), cJSON_GetObjectItemCaseSensitive(item, "password"));
 
+		const cJSON *protocol = cJSON_GetObjectItemCaseSensitive(item, "protocol");
+		network->protocol = cJSON_IsString(protocol) && protocol->valuestring != NULL
+								? wifi_auth_mode_from_string(protocol->valuestring)
+								: WIFI_AUTH_OPEN;
+	}
+
+	config->SYNC_WIFI_NETWORK_COUNT = count;
+}
+
+esp_err_t shared_config_parse(const char *json_string, shared_config_t *config) {
 	cJSON *root = cJSON_Parse(json_string);
 	if (root == NULL) {
 		ESP_LOGE(TAG, "Error before: [%s]\n", cJSON_GetErrorPtr());
 		return ESP_FAIL;
 	}
 
-	for (size_t i = 0; i < sizeof(mappings) / sizeof(config_mapping_t); i++) {
-		config_mapping_t *mapping = &mappings[i];
-		cJSON *item = cJSON_GetObjectItemCaseSensitive(root, mapping->json_key);
+	set_defaults(config);
 
-		if (strcmp(mapping->json_key, CFG_KEY_SYNC_WIFI_PROTOCOL) == 0) {
-			if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-				wifi_auth_mode_t protocol = wifi_auth_mode_from_string(item->valuestring);
-				*((wifi_auth_mode_t *)mapping->destination) = protocol;
-			}
+	// Every key once, in document order - the fallback networks need the primary one first
+	const cJSON *networks = NULL;
+	const cJSON *item = NULL;
 
+	cJSON_ArrayForEach(item, root) {
+		const schema_entry_t *entry = schema_lookup(item->string);
+		if (entry == NULL) {
+			ESP_LOGW(TAG, "Unknown configuration key %s", item->string ? item->string : "");
 			continue;
 		}
 
-		switch (mapping->type) {
-			case TYPE_INT: {
-				if (cJSON_IsNumber(item)) {
-					*((int *)mapping->destination) = item->valueint;
-				} else {
-					*((int *)mapping->destination) = mapping->default_int;
-				}
+		void *destination = (uint8_t *)config + entry->offset;
 
+		switch (entry->kind) {
+			case SCHEMA_KIND_INT:
+				if (cJSON_IsNumber(item))
+					*((int *)destination) = item->valueint;
 				break;
-			}
-
-			case TYPE_STR: {
-				char *value = NULL;
-
-				if (cJSON_IsString(item) && (item->valuestring != NULL)) {
-					value = item->valuestring;
-				} else {
-					value = (char *)mapping->default_str;
-				}
 
-				strncpy((char *)mapping->destination, value, mapping->destination_size - 1);
-				((char *)mapping->destination)[strlen(value)] = '\0';
+			case SCHEMA_KIND_STRING:
+			case SCHEMA_KIND_NETWORK:
+				if (cJSON_IsString(item) && item->valuestring != NULL)
+					copy_value(destination, entry->size, item->valuestring);
+				break;
 
+			case SCHEMA_KIND_PROTOCOL:
+				if (cJSON_IsString(item) && item->valuestring != NULL)
+					*((wifi_auth_mode_t *)destination) = wifi_auth_mode_from_string(item->valuestring);
 				break;
-			}
 
-			default:
-				ESP_LOGW(TAG, "Unknown mapping type for key %s", mapping->json_key);
+			case SCHEMA_KIND_NETWORKS:
+				networks = item;
 				break;
 		}
 	}
 
-	return ensure_config() ? ESP_OK : ESP_FAIL;
+	parse_networks(networks, config);
+
+	cJSON_Delete(root);
+	return ensure_config(config) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t load_shared_config() {
+	// Same limit as a remote configuration - read into place instead of a heap copy
+	static char json_string[SHARED_CONFIG_MAX_LEN];
+	size_t json_len = sizeof(json_string);
+
+	RETURN_ON_ERROR(shared_nvs_init());
+
+	nvs_handle_t nvs_handle;
+	RETURN_ON_ERROR(nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle));
+
+	esp_err_t ret = nvs_get_str(nvs_handle, NVS_KEY_CONFIG, json_string, &json_len);
+	nvs_close(nvs_handle);
+
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to read configuration: %s", esp_err_to_name(ret));
+		return ESP_FAIL;
+	}
+
+	// Parsed aside - a reload after BLE provisioning happens while other tasks read shared_config
+	static shared_config_t config;
+	alloc_scope_begin();
+	ret = shared_config_parse(json_string, &config);
+	alloc_scope_end();
+
+	if (ret != ESP_OK)
+		return ret;
+
+	shared_config = config;
+	shared_config_hash = config_hash(json_string);
+	return ESP_OK;
 }
 
+esp_err_t shared_config_store(const char *json_string) {
+	RETURN_ON_ERROR(shared_nvs_init());
+
+	nvs_handle_t nvs_handle;
+	RETURN_ON_ERROR(nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle));
+
+	esp_err_t ret = nvs_set_str(nvs_handle, NVS_KEY_CONFIG, json_string);
+	if (ret == ESP_OK) ret = nvs_commit(nvs_handle);
+
+	nvs_close(nvs_handle);
+	return ret;
+}
+#endif
+
 esp_err_t nvs_read_str(const char *key, char **value, size_t *len, const char *default_value) {
+	*value = NULL;
+	*len = 0;
+	RETURN_ON_ERROR_RET(shared_nvs_init(), ESP_ERR_NVS_NOT_INITIALIZED);
+
 	nvs_handle_t nvs_handle;
 	esp_err_t ret = nvs_open_from_partition(NVS_PARTITION, NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
 	RETURN_ON_ERROR(ret);
@@ -1 +1,21 @@
-esp_err_t mqtt_sync();
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#include "backlog.h"
+#include "backoff.h"
+
+#define SYNC_READING_MAX_LEN 128 // One serialized reading, terminator included
+
+extern backoff_t mqtt_backoff;
+
+// ESP_OK once everything was acknowledged, ESP_FAIL when the broker couldn't be reached,
+// ESP_ERR_NOT_FINISHED when the broker answered but messages expired - the backlog is kept either way
+esp_err_t mqtt_sync(bool probe);
+
+// Called after every acknowledged publish of continuous mode
+typedef void (*sync_published_fn)();
+
+esp_err_t mqtt_stream(sync_published_fn published);
+// Writes one reading as JSON into buffer, returns its length or 0 if it didn't fit
+size_t sync_serialize_reading(char *buffer, size_t capacity, const char *address, const uint32_t timestamp, const backlog_column_t *column, const int32_t value);
@@ -1,6 +1,9 @@
+#include "math.h"
 #include "stdint.h"
+#include "string.h"
+#include "time.h"
 
-#include "cJSON.h"
+#include "esp_attr.h"
 #include "esp_bit_defs.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -10,8 +13,15 @@
 #include "mqtt_client.h"
 #include "sdkconfig.h"
 
+#include "backlog.h"
+#include "block.h"
+#include "diagnostics.h"
 #include "helpers.h"
+#include "link.h"
+#include "rollup.h"
+#include "sensors.h"
 #include "shared.h"
+#include "trace.h"
 
 #include "sync.h"
 
@@ -19,19 +29,57 @@
 #define TOPIC_LEN 100
 
 #define MQTT_CONNECTION_TIMEOUT 60 * 1000
+#define MQTT_PROBE_TIMEOUT CONFIG_SYNC_MQTT_PROBE_TIMEOUT_MS
 #define MQTT_CONCURRENT_MESSAGES 4
 #define MQTT_MESSAGE_TIMEOUT_MS 10 * 1000
 #define MQTT_MESSAGE_WAIT_TIME_MS 15 * 1000
+#define MQTT_BUFFER_SIZE 2048
+
+#define STREAM_DRAIN_INTERVAL_MS 1000 // Well within what the sensor rings buffer
+
+#define REMOTE_CONFIG_MAX_LEN SHARED_CONFIG_MAX_LEN
 
 static const char *TAG = "MODULE[sync]";
 
 static EventGroupHandle_t mqtt_connection_event_group;
 static SemaphoreHandle_t mqtt_publish_mutex;
+static StaticEventGroup_t mqtt_connection_event_group_buffer;
+static StaticSemaphore_t mqtt_publish_mutex_buffer;
 
 static const int MQTT_CONNECTED_BIT = BIT0;
 
+#if !CONFIG_VOGON_BAKED_CONFIG
+static const int MQTT_SUBSCRIBED_BIT = BIT1;
+static const int MQTT_CONFIG_RECEIVED_BIT = BIT2;
+static const int MQTT_TRACE_REQUESTED_BIT = BIT3;
+
+// Any retained message here asks for the trace ring - cleared once the dump is published
+#define TRACE_REQUEST_SUFFIX "/trace/get"
+
+// Retained configuration received on vogonair/:mac_address/config
+static char remote_config[REMOTE_CONFIG_MAX_LEN];
+
+// Hash of the last remote configuration that failed validation - not re-parsed every cycle
+RTC_DATA_ATTR static uint32_t rejected_config_hash = 0;
+#endif
+
+// Set when the broker didn't acknowledge a message - backlog is kept for the next sync
+static bool mqtt_delivery_failed;
+
+RTC_DATA_ATTR backoff_t mqtt_backoff = {0};
+
 #define LEN_AUTO 0
 
+_Static_assert(STREAM_PARAMETER_COUNT == BACKLOG_COLUMN_COUNT, "Stream parameters must match backlog columns");
+
+// Sized for a backlog chunk or a full continuous mode window, whichever is larger
+#define BLOCK_MAX_READINGS (CONFIG_SYNC_BLOCK_MAX_READINGS > CONFIG_STREAM_WINDOW_SAMPLES ? CONFIG_SYNC_BLOCK_MAX_READINGS : CONFIG_STREAM_WINDOW_SAMPLES)
+
+static uint8_t block_buffer[BLOCK_HEADER_MAX_LEN + BACKLOG_COLUMN_COUNT * BLOCK_COLUMN_MAX_LEN(BLOCK_MAX_READINGS)];
+
+// Rollup and telemetry JSON - esp-mqtt copies a QoS 1 message into its outbox before publish returns
+static char message_buffer[MQTT_BUFFER_SIZE];
+
 enum {
 	AT_MOST_ONCE,
 	AT_LEAST_ONCE,
@@ -53,21 +101,53 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
 			ESP_LOGD(TAG, "MQTT_EVENT_CONNECTED");
 			break;
 		case MQTT_EVENT_DISCONNECTED:
+#if CONFIG_VOGON_BAKED_CONFIG
 			xEventGroupClearBits(mqtt_connection_event_group, MQTT_CONNECTED_BIT);
+#else
+			// Clean session - the config subscription is gone as well
+			xEventGroupClearBits(mqtt_connection_event_group, MQTT_CONNECTED_BIT | MQTT_SUBSCRIBED_BIT);
+#endif
 			ESP_LOGW(TAG, "MQTT_EVENT_DISCONNECTED");
 			break;
-		case MQTT_EVENT_PUBLISHED:
+		case MQTT_EVENT_PUBLISHED: {
 			// Message acknowledged by broker
 			// Fired only for QoS>0
-			ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED");
+			esp_mqtt_event_handle_t event = event_data;
+			TRACE(TRACE_SYNC_ACKNOWLEDGED, event->msg_id);
 			xSemaphoreGive(mqtt_publish_mutex);
 			break;
+		}
 		case MQTT_EVENT_DELETED:
 			// Message deleted from outbox (not acknowledged by broker)
 			// Fired only if message couldn't have been sent or acknowledged before expiring
 			ESP_LOGI(TAG, "MQTT_EVENT_DELETED");
+			mqtt_delivery_failed = true;
 			xSemaphoreGive(mqtt_publish_mutex);
 			break;
+#if !CONFIG_VOGON_BAKED_CONFIG
+		case MQTT_EVENT_SUBSCRIBED:
+			ESP_LOGD(TAG, "MQTT_EVENT_SUBSCRIBED");
+			xEventGroupSetBits(mqtt_connection_event_group, MQTT_SUBSCRIBED_BIT);
+			break;
+		case MQTT_EVENT_DATA: {
+			// Config and trace request topics - an empty retained message means no request
+			ESP_LOGD(TAG, "MQTT_EVENT_DATA");
+			esp_mqtt_event_handle_t event = event_data;
+			const size_t suffix_len = strlen(TRACE_REQUEST_SUFFIX);
+
+			if (event->topic_len >= suffix_len &&
+				memcmp(event->topic + event->topic_len - suffix_len, TRACE_REQUEST_SUFFIX, suffix_len) == 0) {
+				if (event->data_len > 0)
+					xEventGroupSetBits(mqtt_connection_event_group, MQTT_TRACE_REQUESTED_BIT);
+			} else if (event->data_len > 0 && event->data_len == event->total_data_len && event->data_len < REMOTE_CONFIG_MAX_LEN) {
+				memcpy(remote_config, event->data, event->data_len);
+				remote_config[event->data_len] = '\0';
+				xEventGroupSetBits(mqtt_connection_event_group, MQTT_CONFIG_RECEIVED_BIT);
+			}
+
+			break;
+		}
+#endif
 		default:
 			break;
 	}
@@ -79,45 +159,332 @@ static void get_mac_address_string(char *mac_str) {
 	snprintf(mac_str, MAC_LEN, "%02X:%02X:%02X:%02X:%02X:%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
-static void publish(esp_mqtt_client_handle_t *client, const uint16_t sensor, const uint8_t type, const double value) {
+size_t sync_serialize_reading(char *buffer, size_t capacity, const char *address, const uint32_t timestamp, const backlog_column_t *column, const int32_t value) {
+	text_buffer_t text;
+	text_init(&text, buffer, capacity);
+	text_append(&text, "{\"address\":\"%s\",\"sensor\":%u,\"parameter\":%u,\"value\":", address, column->sensor, column->parameter);
+	text_append_fixed(&text, value, column->scale);
+	text_append(&text, ",\"timestamp\":%lu}", (unsigned long)timestamp);
+
+	return text_overflowed(&text) ? 0 : text.length;
+}
+
+static void publish(esp_mqtt_client_handle_t *client, const uint32_t timestamp, const backlog_column_t *column, const int32_t value) {
 	char mac_address[MAC_LEN];
 	char topic[TOPIC_LEN];
+	char message[SYNC_READING_MAX_LEN];
 	get_mac_address_string(mac_address);
 
-	cJSON *root = cJSON_CreateObject();
-	cJSON_AddStringToObject(root, "address", mac_address);
-	cJSON_AddNumberToObject(root, "sensor", sensor);
-	cJSON_AddNumberToObject(root, "parameter", type);
-	cJSON_AddNumberToObject(root, "value", value);
-
-	char *message = cJSON_Print(root);
+	alloc_scope_begin();
+	size_t length = sync_serialize_reading(message, sizeof(message), mac_address, timestamp, column, value);
+	alloc_scope_end();
 	snprintf(topic, sizeof(topic), "vogonair/%s/raw", mac_address);
 
-	if (message) {
+	if (length > 0) {
 		BaseType_t ret = xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS));
+		float real = value / powf(10, column->scale);
 
 		if (ret == pdFALSE) {
-			ESP_LOGE(TAG, "Failed to send MQTT message [sensor=%d, type=%d, value=%.2f] within timeout", sensor, type, value);
+			ESP_LOGE(TAG, "Failed to send MQTT message [sensor=%d, type=%d, value=%.2f] within timeout", column->sensor, column->parameter, real);
 
-			// cJSON_Delete(root);
-			// free(message);
 			// return;
 		}
 
-		ESP_LOGI(TAG, "Publishing to topic %s: %s", topic, message);
-		esp_mqtt_client_publish(*client, topic, message, LEN_AUTO, AT_LEAST_ONCE, NOT_RETAIN);
-		free(message);
+		TRACE(TRACE_SYNC_PUBLISHED, column->sensor, column->parameter, trace_float(real), timestamp);
+		esp_mqtt_client_publish(*client, topic, message, length, AT_LEAST_ONCE, NOT_RETAIN);
+	}
+}
+
+// Publishes the block encoded in block_buffer
+static void send_block(esp_mqtt_client_handle_t *client, const size_t length, const size_t count) {
+	char mac_address[MAC_LEN];
+	char topic[TOPIC_LEN];
+	get_mac_address_string(mac_address);
+	snprintf(topic, sizeof(topic), "vogonair/%s/block", mac_address);
+
+	if (length == 0) {
+		ESP_LOGE(TAG, "Failed to encode block of %d readings", (int)count);
+		mqtt_delivery_failed = true;
+		return;
+	}
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to send MQTT block [readings=%d] within timeout", (int)count);
+	}
+
+	ESP_LOGI(TAG, "Publishing %d readings to topic %s (%d bytes)", (int)count, topic, (int)length);
+	esp_mqtt_client_publish(*client, topic, (const char *)block_buffer, length, AT_LEAST_ONCE, NOT_RETAIN);
+}
+
+// Gateway - forwards a leaf's block under the leaf's address, taken from the block header
+static void publish_relay(esp_mqtt_client_handle_t *client, const link_relay_t *relay) {
+	const uint8_t *mac = &relay->data[3];
+	char topic[TOPIC_LEN];
+	snprintf(topic, sizeof(topic), "vogonair/%02X:%02X:%02X:%02X:%02X:%02X/block", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to send relayed MQTT block within timeout");
+	}
+
+	ESP_LOGI(TAG, "Relaying to topic %s (%d bytes)", topic, (int)relay->length);
+	esp_mqtt_client_publish(*client, topic, (const char *)relay->data, relay->length, AT_LEAST_ONCE, NOT_RETAIN);
+}
+
+// Publishes `count` backlog readings starting at `offset` as one columnar block
+static void publish_block(esp_mqtt_client_handle_t *client, const size_t offset, const size_t count) {
+	uint8_t mac[6];
+	ESP_ERROR_CHECK(esp_wifi_get_mac(ESP_IF_WIFI_STA, mac));
+
+	alloc_scope_begin();
+	size_t length = backlog_encode(mac, offset, count, block_buffer, sizeof(block_buffer));
+	alloc_scope_end();
+	send_block(client, length, count);
+}
+
+// Publishes every sample of a continuous mode window as one columnar block - columns may differ in length
+static void publish_window(esp_mqtt_client_handle_t *client, const stream_window_t *window) {
+	uint8_t mac[6];
+	ESP_ERROR_CHECK(esp_wifi_get_mac(ESP_IF_WIFI_STA, mac));
+
+	block_encoder_t encoder;
+	block_encoder_init(&encoder, block_buffer, sizeof(block_buffer), mac, BACKLOG_COLUMN_COUNT);
+
+	size_t total = 0;
+	for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++)
+		total += window->count[c];
+
+	if (total == 0)
+		return;
+
+	alloc_scope_begin();
+	for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++) {
+		const backlog_column_t *column = &backlog_columns[c];
+		float multiplier = powf(10, column->scale);
+		block_encoder_begin_column(&encoder, column->sensor, column->parameter, column->scale, window->count[c]);
+
+		for (size_t i = 0; i < window->count[c]; i++) {
+			const stream_sample_t *sample = &window->samples[c][i];
+			block_encoder_append(&encoder, sample->timestamp, lroundf(sample->value * multiplier));
+		}
+	}
+
+	size_t length = block_encoder_finish(&encoder);
+	alloc_scope_end();
+	send_block(client, length, total);
+}
+
+// Mean of a window as one reading - false if a sensor reported nothing in this window
+static bool window_mean(const stream_window_t *window, shared_data_t *data) {
+	float means[STREAM_PARAMETER_COUNT];
+
+	for (int p = 0; p < STREAM_PARAMETER_COUNT; p++) {
+		if (window->count[p] == 0)
+			return false;
+
+		float sum = 0;
+		for (size_t i = 0; i < window->count[p]; i++)
+			sum += window->samples[p][i].value;
+
+		means[p] = sum / window->count[p];
+	}
+
+	data->temperature = means[STREAM_TEMPERATURE];
+	data->humidity = means[STREAM_HUMIDITY];
+	data->pm25 = lroundf(means[STREAM_PM25]);
+	data->pm10 = lroundf(means[STREAM_PM10]);
+	return true;
+}
+
+// Publishes the pending buckets of one rollup period as one message, returns the number of buckets sent
+// Buckets that don't fit into the message buffer are left for the next message
+static size_t publish_rollup(esp_mqtt_client_handle_t *client, const rollup_period_t period) {
+	size_t pending = rollup_pending(period);
+	if (pending == 0)
+		return 0;
+
+	char mac_address[MAC_LEN];
+	char topic[TOPIC_LEN];
+	get_mac_address_string(mac_address);
+	snprintf(topic, sizeof(topic), "vogonair/%s/rollup", mac_address);
+
+	alloc_scope_begin();
+	text_buffer_t text;
+	text_init(&text, message_buffer, sizeof(message_buffer));
+	text_append(&text, "{\"address\":\"%s\",\"period\":%lu,\"buckets\":[", mac_address, (unsigned long)rollup_period_seconds(period));
+
+	size_t count = 0;
+	for (; count < pending; count++) {
+		const rollup_bucket_t *bucket = rollup_peek_pending(period, count);
+		size_t bucket_start = text.length;
+		const char *separator = "";
+
+		text_append(&text, "%s{\"start\":%lu,\"values\":[", count > 0 ? "," : "", (unsigned long)bucket->start);
+
+		for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++) {
+			const backlog_column_t *column = &backlog_columns[c];
+			const rollup_stats_t *stats = &bucket->stats[c];
+			if (stats->count == 0)
+				continue;
+
+			// One more digit for the mean, rounded half away from zero
+			int64_t tenfold = (int64_t)stats->sum * 10;
+			int32_t mean = (tenfold + (tenfold < 0 ? -stats->count : stats->count) / 2) / stats->count;
+
+			text_append(&text, "%s{\"sensor\":%u,\"parameter\":%u,\"count\":%u,\"min\":",
+						separator, column->sensor, column->parameter, stats->count);
+			text_append_fixed(&text, stats->min, column->scale);
+			text_append(&text, ",\"max\":");
+			text_append_fixed(&text, stats->max, column->scale);
+			text_append(&text, ",\"mean\":");
+			text_append_fixed(&text, mean, column->scale + 1);
+			text_append(&text, "}");
+			separator = ",";
+		}
+
+		text_append(&text, "]}");
+
+		// Room for the closing brackets is kept with every bucket
+		if (text.length + 2 >= text.capacity) {
+			text_truncate(&text, bucket_start);
+			break;
+		}
+	}
+
+	text_append(&text, "]}");
+	alloc_scope_end();
+
+	if (count == 0 || text_overflowed(&text)) {
+		ESP_LOGE(TAG, "Failed to encode rollup (%lus)", (unsigned long)rollup_period_seconds(period));
+		mqtt_delivery_failed = true;
+		return 0;
+	}
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to send MQTT rollup within timeout");
+	}
+
+	ESP_LOGI(TAG, "Publishing %d of %d rollups (%lus) to topic %s", (int)count, (int)pending, (unsigned long)rollup_period_seconds(period), topic);
+	esp_mqtt_client_publish(*client, topic, message_buffer, text.length, AT_LEAST_ONCE, NOT_RETAIN);
+	return count;
+}
+
+static void wait_for_acknowledgements() {
+	while (uxSemaphoreGetCount(mqtt_publish_mutex) != MQTT_CONCURRENT_MESSAGES) {
+		vTaskDelay(pdMS_TO_TICKS(50));
+	}
+}
+
+static void publish_telemetry(esp_mqtt_client_handle_t *client) {
+	char mac_address[MAC_LEN];
+	char topic[TOPIC_LEN];
+	get_mac_address_string(mac_address);
+	snprintf(topic, sizeof(topic), "vogonair/%s/telemetry", mac_address);
+
+	alloc_scope_begin();
+	size_t length = diag_serialize(mac_address, message_buffer, sizeof(message_buffer));
+	alloc_scope_end();
+
+	if (length == 0) {
+		ESP_LOGE(TAG, "Failed to encode telemetry");
+		mqtt_delivery_failed = true;
+		return;
+	}
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to send MQTT telemetry within timeout");
 	}
 
-	cJSON_Delete(root);
+	TRACE(TRACE_SYNC_TELEMETRY, length);
+	esp_mqtt_client_publish(*client, topic, message_buffer, length, AT_LEAST_ONCE, NOT_RETAIN);
 }
 
-esp_err_t mqtt_sync() {
-	mqtt_connection_event_group = xEventGroupCreate();
-	mqtt_publish_mutex = xSemaphoreCreateCounting(MQTT_CONCURRENT_MESSAGES, MQTT_CONCURRENT_MESSAGES);
+#if !CONFIG_VOGON_BAKED_CONFIG
+// Remote configuration and trace requests - one SUBSCRIBE, acknowledged by one SUBACK
+static void subscribe_remote_topics(esp_mqtt_client_handle_t client) {
+	char mac_address[MAC_LEN];
+	char config_topic[TOPIC_LEN];
+	char trace_topic[TOPIC_LEN];
+	get_mac_address_string(mac_address);
+	snprintf(config_topic, sizeof(config_topic), "vogonair/%s/config", mac_address);
+	snprintf(trace_topic, sizeof(trace_topic), "vogonair/%s" TRACE_REQUEST_SUFFIX, mac_address);
+
+	const esp_mqtt_topic_t topics[] = {
+		{.filter = config_topic, .qos = AT_LEAST_ONCE},
+		{.filter = trace_topic, .qos = AT_LEAST_ONCE}};
+
+	esp_mqtt_client_subscribe_multiple(client, topics, sizeof(topics) / sizeof(topics[0]));
+}
+
+// Publishes the trace ring to vogonair/:mac_address/trace and clears the retained request
+static void publish_trace(esp_mqtt_client_handle_t *client) {
+	static uint8_t dump[TRACE_DUMP_MAX_LEN];
+	size_t length = trace_dump(dump, sizeof(dump));
+
+	char mac_address[MAC_LEN];
+	char topic[TOPIC_LEN];
+	get_mac_address_string(mac_address);
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to send MQTT trace within timeout");
+	}
+
+	snprintf(topic, sizeof(topic), "vogonair/%s/trace", mac_address);
+	ESP_LOGI(TAG, "Publishing trace to topic %s (%d bytes)", topic, (int)length);
+	esp_mqtt_client_publish(*client, topic, (const char *)dump, length, AT_LEAST_ONCE, NOT_RETAIN);
+
+	if (xSemaphoreTake(mqtt_publish_mutex, pdMS_TO_TICKS(MQTT_MESSAGE_WAIT_TIME_MS)) == pdFALSE) {
+		ESP_LOGE(TAG, "Failed to clear MQTT trace request within timeout");
+	}
+
+	snprintf(topic, sizeof(topic), "vogonair/%s" TRACE_REQUEST_SUFFIX, mac_address);
+	esp_mqtt_client_publish(*client, topic, "", LEN_AUTO, AT_LEAST_ONCE, RETAIN);
+}
+
+// Validates and stores a changed remote configuration, used from this cycle on
+static void apply_remote_config() {
+	uint32_t hash = config_hash(remote_config);
+	if (hash == shared_config_hash || hash == rejected_config_hash)
+		return;
+
+	static shared_config_t config;
+	alloc_scope_begin();
+	esp_err_t ret = shared_config_parse(remote_config, &config);
+	alloc_scope_end();
+
+	if (ret != ESP_OK) {
+		ESP_LOGE(TAG, "Remote configuration rejected: validation failed");
+		rejected_config_hash = hash;
+		return;
+	}
+
+	if (shared_config_store(remote_config) != ESP_OK) {
+		ESP_LOGE(TAG, "Failed to store remote configuration");
+		return;
+	}
+
+	shared_config = config;
+	shared_config_hash = hash;
+	ESP_LOGI(TAG, "Remote configuration applied");
+}
+#endif
+
+// Created once - a gateway syncs over and over without restarting
+static void init_sync_objects() {
+	if (mqtt_connection_event_group == NULL) {
+		mqtt_connection_event_group = xEventGroupCreateStatic(&mqtt_connection_event_group_buffer);
+		mqtt_publish_mutex = xSemaphoreCreateCountingStatic(MQTT_CONCURRENT_MESSAGES, MQTT_CONCURRENT_MESSAGES, &mqtt_publish_mutex_buffer);
+	}
+
+	xEventGroupClearBits(mqtt_connection_event_group, 0xFF);
+}
+
+esp_err_t mqtt_sync(bool probe) {
+	mqtt_delivery_failed = false;
+	init_sync_objects();
 
 	esp_mqtt_client_config_t mqtt_cfg = {
 		.broker.address.uri = shared_config.SYNC_MQTT_BROKER_URL,
+		.buffer.size = MQTT_BUFFER_SIZE,
 		.network.timeout_ms = MQTT_MESSAGE_TIMEOUT_MS};
 
 	esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
@@ -128,29 +495,234 @@ esp_err_t mqtt_sync() {
 		mqtt_connection_event_group,
 		MQTT_CONNECTED_BIT,
 		pdFALSE, pdTRUE,
-		pdMS_TO_TICKS(MQTT_CONNECTION_TIMEOUT));
+		pdMS_TO_TICKS(probe ? MQTT_PROBE_TIMEOUT : MQTT_CONNECTION_TIMEOUT));
 
 	if (bits & MQTT_CONNECTED_BIT) {
 		ESP_LOGI(TAG, "Connected to MQTT broker: %s", shared_config.SYNC_MQTT_BROKER_URL);
 	} else {
 		ESP_LOGE(TAG, "Failed to connect to MQTT broker: %s", shared_config.SYNC_MQTT_BROKER_URL);
+		esp_mqtt_client_destroy(client);
 		return ESP_FAIL;
 	}
 
-	ESP_LOGI(TAG, "Syncing data...");
-	publish(&client, 0x01, 0x01, shared_data.temperature);
-	publish(&client, 0x01, 0x02, shared_data.humidity);
-	publish(&client, 0x02, 0x01, shared_data.pm25);
-	publish(&client, 0x02, 0x02, shared_data.pm10);
+#if !CONFIG_VOGON_BAKED_CONFIG
+	// Subscribe before publishing - the retained config arrives while readings are acknowledged
+	subscribe_remote_topics(client);
+
+#endif
+	// Aggregates first - after a long outage dashboards recover before the raw backlog drains
+	size_t rollups[ROLLUP_PERIOD_COUNT];
+	bool rollups_sent = false;
+
+	for (int p = 0; p < ROLLUP_PERIOD_COUNT; p++) {
+		rollups[p] = publish_rollup(&client, p);
+		rollups_sent |= rollups[p] > 0;
+	}
+
+	if (rollups_sent) {
+		wait_for_acknowledgements();
+
+		if (!mqtt_delivery_failed)
+			for (int p = 0; p < ROLLUP_PERIOD_COUNT; p++)
+				rollup_mark_uploaded(p, rollups[p]);
+	}
+
+	size_t count = backlog_count();
+	ESP_LOGI(TAG, "Syncing data (%d readings)...", (int)count);
+
+	if (count == 1) {
+		// Live reading only - keep the readable per-value messages
+		const backlog_entry_t *entry = backlog_peek(0);
+
+		for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++) {
+			int32_t value = backlog_columns[c].value(&entry->data);
+			if (value != BACKLOG_MISSING)
+				publish(&client, entry->timestamp, &backlog_columns[c], value);
+		}
+	} else {
+		// Backlog upload - columnar delta encoded blocks
+		for (size_t offset = 0; offset < count; offset += CONFIG_SYNC_BLOCK_MAX_READINGS) {
+			size_t chunk = count - offset;
+			if (chunk > CONFIG_SYNC_BLOCK_MAX_READINGS)
+				chunk = CONFIG_SYNC_BLOCK_MAX_READINGS;
+
+			publish_block(&client, offset, chunk);
+		}
+	}
+
+	size_t relayed = link_relay_count();
+	for (size_t i = 0; i < relayed; i++)
+		publish_relay(&client, link_relay_peek(i));
+
+	bool telemetry_sent = diag_upload_due();
+	if (telemetry_sent)
+		publish_telemetry(&client);
 
 	// Wait for all messages to be published
-	while (uxSemaphoreGetCount(mqtt_publish_mutex) != MQTT_CONCURRENT_MESSAGES) {
-		vTaskDelay(pdMS_TO_TICKS(50));
+	wait_for_acknowledgements();
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+	// The broker answers the SUBSCRIBE, retained messages included, before the PUBLISHes sent after it -
+	// once they are acknowledged there is nothing left to wait for. A missed message is retained for the next sync
+	bits = xEventGroupGetBits(mqtt_connection_event_group);
+	if (!(bits & MQTT_SUBSCRIBED_BIT) && !mqtt_delivery_failed) {
+		// Nothing was published - the SUBACK is the only sign the broker has handled the subscription
+		bits = xEventGroupWaitBits(
+			mqtt_connection_event_group,
+			MQTT_SUBSCRIBED_BIT,
+			pdFALSE, pdTRUE,
+			pdMS_TO_TICKS(MQTT_MESSAGE_TIMEOUT_MS));
 	}
 
-	ESP_LOGI(TAG, "Data synced successfully!");
+	if (xEventGroupGetBits(mqtt_connection_event_group) & MQTT_TRACE_REQUESTED_BIT) {
+		publish_trace(&client);
+		wait_for_acknowledgements();
+	}
+#endif
 
 	esp_mqtt_client_stop(client);
 	esp_mqtt_client_destroy(client);
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+	if (bits & MQTT_CONFIG_RECEIVED_BIT)
+		apply_remote_config();
+#endif
+
+	// Not a clean cycle - the caller must not restart into an update or judge a new image on it
+	if (mqtt_delivery_failed) {
+		ESP_LOGW(TAG, "Some messages were not acknowledged, keeping backlog");
+		return ESP_ERR_NOT_FINISHED;
+	}
+
+	backlog_drop(count);
+	link_relay_drop(relayed);
+	if (telemetry_sent)
+		diag_reset();
+
+	ESP_LOGI(TAG, "Data synced successfully!");
 	return ESP_OK;
 }
+
+// Continuous mode - publishes the samples of every interval over one persistent connection
+// Returns on setup failure or when a remote configuration turns continuous mode off
+esp_err_t mqtt_stream(sync_published_fn published) {
+	init_sync_objects();
+
+	// esp-mqtt reconnects on its own, messages queued while offline expire from the outbox
+	esp_mqtt_client_config_t mqtt_cfg = {
+		.broker.address.uri = shared_config.SYNC_MQTT_BROKER_URL,
+		.buffer.size = MQTT_BUFFER_SIZE,
+		.network.timeout_ms = MQTT_MESSAGE_TIMEOUT_MS};
+
+	esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
+	RETURN_ON_ERROR(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, client));
+	RETURN_ON_ERROR(esp_mqtt_client_start(client));
+
+	ESP_LOGI(TAG, "Streaming to MQTT broker %s every %ds", shared_config.SYNC_MQTT_BROKER_URL, shared_config.SYNC_CONTINUOUS_PUBLISH_INTERVAL);
+
+	TickType_t last_drain = xTaskGetTickCount();
+	TickType_t next_publish = last_drain;
+
+	for (;;) {
+		// The rings are drained often, the window is published once per interval
+		vTaskDelayUntil(&last_drain, pdMS_TO_TICKS(STREAM_DRAIN_INTERVAL_MS));
+		stream_drain();
+
+		if ((int32_t)(xTaskGetTickCount() - next_publish) < pdMS_TO_TICKS(shared_config.SYNC_CONTINUOUS_PUBLISH_INTERVAL * 1000))
+			continue;
+
+		next_publish = xTaskGetTickCount();
+		diag_begin_cycle();
+
+		const stream_window_t *window = stream_window();
+		if (window->dropped > 0)
+			ESP_LOGW(TAG, "%lu samples dropped since the last publish", (unsigned long)window->dropped);
+
+		shared_data_t mean;
+		bool has_mean = window_mean(window, &mean);
+
+		if (!(xEventGroupGetBits(mqtt_connection_event_group) & MQTT_CONNECTED_BIT)) {
+			// Offline - keep the window mean for upload after reconnecting
+			if (has_mean)
+				backlog_push(&mean);
+
+			stream_reset();
+			ESP_LOGW(TAG, "Broker unreachable, %d readings stored locally", (int)backlog_count());
+			diag_capture_phase(DIAG_PHASE_SYNC);
+			continue;
+		}
+
+		mqtt_delivery_failed = false;
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+		EventBits_t bits = xEventGroupGetBits(mqtt_connection_event_group);
+
+		if (!(bits & MQTT_SUBSCRIBED_BIT))
+			subscribe_remote_topics(client);
+
+		if (bits & MQTT_TRACE_REQUESTED_BIT) {
+			xEventGroupClearBits(mqtt_connection_event_group, MQTT_TRACE_REQUESTED_BIT);
+			publish_trace(&client);
+		}
+
+		if (bits & MQTT_CONFIG_RECEIVED_BIT) {
+			xEventGroupClearBits(mqtt_connection_event_group, MQTT_CONFIG_RECEIVED_BIT);
+			apply_remote_config();
+
+			if (!shared_config.SENSORS_CONTINUOUS_MODE) {
+				ESP_LOGI(TAG, "Continuous mode turned off remotely");
+				esp_mqtt_client_stop(client);
+				esp_mqtt_client_destroy(client);
+				return ESP_OK;
+			}
+		}
+#endif
+
+		uint32_t timestamp = (uint32_t)time(NULL);
+		if (has_mean)
+			rollup_add(timestamp, &mean);
+
+		size_t rollups[ROLLUP_PERIOD_COUNT];
+		for (int p = 0; p < ROLLUP_PERIOD_COUNT; p++)
+			rollups[p] = publish_rollup(&client, p);
+
+		publish_window(&client, window);
+		stream_reset();
+
+		size_t count = backlog_count();
+		for (size_t offset = 0; offset < count; offset += CONFIG_SYNC_BLOCK_MAX_READINGS) {
+			size_t chunk = count - offset;
+			if (chunk > CONFIG_SYNC_BLOCK_MAX_READINGS)
+				chunk = CONFIG_SYNC_BLOCK_MAX_READINGS;
+
+			publish_block(&client, offset, chunk);
+		}
+
+		bool telemetry_sent = diag_upload_due();
+		if (telemetry_sent)
+			publish_telemetry(&client);
+
+		wait_for_acknowledgements();
+
+		// Reset before the capture so this publish is reported with the next telemetry
+		if (telemetry_sent && !mqtt_delivery_failed)
+			diag_reset();
+
+		diag_capture_phase(DIAG_PHASE_SYNC);
+
+		if (mqtt_delivery_failed) {
+			// The window may be lost - keep its mean like an offline interval, it is in the rollups already
+			if (has_mean)
+				backlog_store(timestamp, &mean);
+
+			ESP_LOGW(TAG, "Some messages were not acknowledged, keeping backlog");
+			continue;
+		}
+
+		for (int p = 0; p < ROLLUP_PERIOD_COUNT; p++)
+			rollup_mark_uploaded(p, rollups[p]);
+
+		backlog_drop(count);
+		published();
+	}
+}
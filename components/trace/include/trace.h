@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "sdkconfig.h"
+
+// Deferred binary logging - records are written to a ring in RTC memory and formatted on the host
+//
+// Dump layout (little endian):
+//   magic "VT", version (1), reserved (0), records overwritten since boot of the ring (u32), records length (u16)
+//   records, oldest first: event (u8), argument count (u8), wake counter (u16), ms since boot (u32), arguments (u32 each)
+
+#define TRACE_MAGIC_0 'V'
+#define TRACE_MAGIC_1 'T'
+#define TRACE_VERSION 1
+
+#define TRACE_DUMP_HEADER_LEN 10
+#define TRACE_RECORD_HEADER_LEN 8
+#define TRACE_MAX_ARGS 8
+#define TRACE_DUMP_MAX_LEN (TRACE_DUMP_HEADER_LEN + CONFIG_TRACE_RING_SIZE)
+
+typedef enum {
+#define TRACE_EVENT(name, tag, format) name,
+#include "trace_events.h"
+#undef TRACE_EVENT
+
+	TRACE_EVENT_COUNT
+} trace_event_t;
+
+// TRACE(event, args...) - integers convert implicitly, floats go through trace_float()
+#define TRACE(event, ...) \
+	trace_write((event), (const uint32_t[]){__VA_ARGS__}, sizeof((const uint32_t[]){__VA_ARGS__}) / sizeof(uint32_t))
+
+static inline uint32_t trace_float(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+void trace_begin_cycle();
+void trace_write(trace_event_t event, const uint32_t *args, size_t count);
+size_t trace_dump(uint8_t *buffer, size_t capacity);
@@ -0,0 +1,16 @@
+// TRACE_EVENT(name, tag, format) - the record stores the position in this list, append only
+// Arguments are 32-bit: %d/%u/%x for integers, %f (with precision) for floats passed through trace_float()
+// Parsed by tools/decode_trace.py - keep one event per line
+
+TRACE_EVENT(TRACE_DHT22_MEASURING, "dht22", "Measuring [%d/%d]")
+TRACE_EVENT(TRACE_DHT22_MEASURED, "dht22", "Measured [%d/%d]: temperature=%.2fC, humidity=%.2f%%")
+TRACE_EVENT(TRACE_SDS011_MEASURING, "sds011", "Measuring [%d/%d]")
+TRACE_EVENT(TRACE_SDS011_MEASURED, "sds011", "Measured [%d/%d]: PM2.5=%.1f, PM10=%.1f")
+TRACE_EVENT(TRACE_SYNC_PUBLISHED, "sync", "Published sensor=%d parameter=%d value=%.2f timestamp=%u")
+TRACE_EVENT(TRACE_SYNC_ACKNOWLEDGED, "sync", "Message %d acknowledged")
+TRACE_EVENT(TRACE_SYNC_TELEMETRY, "sync", "Published telemetry (%d bytes)")
+TRACE_EVENT(TRACE_BLE_CONFIG_READ, "bluetooth", "Config read at offset %d (%d bytes)")
+TRACE_EVENT(TRACE_BLE_CONFIG_WRITTEN, "bluetooth", "Config written (%d bytes)")
+TRACE_EVENT(TRACE_SDS011_WARMED_UP, "sds011", "Warmed up in %u ms (limit %u ms)")
+TRACE_EVENT(TRACE_DHT22_CONVERGED, "dht22", "Converged after %d of %d samples")
+TRACE_EVENT(TRACE_SDS011_CONVERGED, "sds011", "Converged after %d of %d samples")
@@ -0,0 +1,179 @@
+#include "stdio.h"
+#include "string.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+
+#include "trace.h"
+
+#define TRACE_RING_MAGIC (0x56540000 | CONFIG_TRACE_RING_SIZE) // Ring layout of this image
+#define TRACE_LINE_LEN 128
+
+#if CONFIG_TRACE_CONSOLE
+static const char *TAG = "MODULE[trace]";
+
+static const struct {
+	const char *tag;
+	const char *format;
+} events[TRACE_EVENT_COUNT] = {
+#define TRACE_EVENT(name, event_tag, event_format) [name] = {event_tag, event_format},
+#include "trace_events.h"
+#undef TRACE_EVENT
+};
+#endif
+
+// Survives deep sleep - written by the sensor tasks and the main task
+RTC_DATA_ATTR static uint32_t ring_magic;
+RTC_DATA_ATTR static uint8_t ring[CONFIG_TRACE_RING_SIZE];
+RTC_DATA_ATTR static uint16_t ring_head; // Oldest record
+RTC_DATA_ATTR static uint16_t ring_used;
+RTC_DATA_ATTR static uint32_t ring_overwritten;
+RTC_DATA_ATTR static uint16_t wake_counter;
+
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static void ring_copy_out(size_t offset, void *data, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		((uint8_t *)data)[i] = ring[(offset + i) % CONFIG_TRACE_RING_SIZE];
+}
+
+static void ring_copy_in(size_t offset, const void *data, size_t len) {
+	for (size_t i = 0; i < len; i++)
+		ring[(offset + i) % CONFIG_TRACE_RING_SIZE] = ((const uint8_t *)data)[i];
+}
+
+static void put_u16(uint8_t *buffer, uint16_t value) {
+	buffer[0] = value;
+	buffer[1] = value >> 8;
+}
+
+static void put_u32(uint8_t *buffer, uint32_t value) {
+	put_u16(buffer, value);
+	put_u16(buffer + 2, value >> 16);
+}
+
+void trace_begin_cycle() {
+	// Cold boot, or an image with a different ring - start over
+	if (ring_magic != TRACE_RING_MAGIC) {
+		ring_magic = TRACE_RING_MAGIC;
+		ring_head = 0;
+		ring_used = 0;
+		ring_overwritten = 0;
+		wake_counter = 0;
+	}
+
+	wake_counter++;
+}
+
+#if CONFIG_TRACE_CONSOLE
+// Same formatting as tools/decode_trace.py - one conversion at a time from the raw arguments
+static void trace_print(trace_event_t event, const uint32_t *args, size_t count) {
+	char line[TRACE_LINE_LEN];
+	size_t len = 0;
+	size_t arg = 0;
+
+	for (const char *c = events[event].format; *c && len < sizeof(line) - 1; c++) {
+		if (*c != '%') {
+			line[len++] = *c;
+			continue;
+		}
+
+		char spec[8] = {'%'};
+		size_t spec_len = 1;
+		while (c[1] && strchr("0123456789.-", c[1]) && spec_len < sizeof(spec) - 2)
+			spec[spec_len++] = *++c;
+
+		char conversion = *++c;
+		spec[spec_len++] = conversion;
+
+		if (conversion == '\0')
+			break;
+
+		int written;
+		if (conversion == '%') {
+			written = snprintf(line + len, sizeof(line) - len, "%%");
+		} else if (arg >= count) {
+			written = snprintf(line + len, sizeof(line) - len, "?");
+		} else if (conversion == 'f') {
+			float value;
+			memcpy(&value, &args[arg++], sizeof(value));
+			written = snprintf(line + len, sizeof(line) - len, spec, (double)value);
+		} else if (conversion == 'd') {
+			written = snprintf(line + len, sizeof(line) - len, spec, (int)(int32_t)args[arg++]);
+		} else {
+			written = snprintf(line + len, sizeof(line) - len, spec, (unsigned int)args[arg++]);
+		}
+
+		if (written > 0)
+			len += written;
+	}
+
+	if (len > sizeof(line) - 1)
+		len = sizeof(line) - 1;
+	line[len] = '\0';
+
+	ESP_LOGI(TAG, "[%s] %s", events[event].tag, line);
+}
+#endif
+
+void trace_write(trace_event_t event, const uint32_t *args, size_t count) {
+	if (count > TRACE_MAX_ARGS)
+		count = TRACE_MAX_ARGS;
+
+	uint8_t record[TRACE_RECORD_HEADER_LEN + TRACE_MAX_ARGS * sizeof(uint32_t)];
+	size_t len = TRACE_RECORD_HEADER_LEN + count * sizeof(uint32_t);
+
+	record[0] = event;
+	record[1] = count;
+	put_u16(record + 2, wake_counter);
+	put_u32(record + 4, esp_log_timestamp());
+	for (size_t i = 0; i < count; i++)
+		put_u32(record + TRACE_RECORD_HEADER_LEN + i * sizeof(uint32_t), args[i]);
+
+	taskENTER_CRITICAL(&ring_lock);
+
+	// Overwrite whole records, oldest first
+	while ((size_t)(CONFIG_TRACE_RING_SIZE - ring_used) < len) {
+		uint8_t header[2];
+		ring_copy_out(ring_head, header, sizeof(header));
+
+		size_t oldest = TRACE_RECORD_HEADER_LEN + header[1] * sizeof(uint32_t);
+		ring_head = (ring_head + oldest) % CONFIG_TRACE_RING_SIZE;
+		ring_used -= oldest;
+		ring_overwritten++;
+	}
+
+	ring_copy_in(ring_head + ring_used, record, len);
+	ring_used += len;
+
+	taskEXIT_CRITICAL(&ring_lock);
+
+#if CONFIG_TRACE_CONSOLE
+	trace_print(event, args, count);
+#endif
+}
+
+// Copies the ring out oldest first, returns the dump length or 0 if it didn't fit
+size_t trace_dump(uint8_t *buffer, size_t capacity) {
+	taskENTER_CRITICAL(&ring_lock);
+
+	size_t used = ring_used;
+	if (capacity < TRACE_DUMP_HEADER_LEN + used) {
+		taskEXIT_CRITICAL(&ring_lock);
+		return 0;
+	}
+
+	buffer[0] = TRACE_MAGIC_0;
+	buffer[1] = TRACE_MAGIC_1;
+	buffer[2] = TRACE_VERSION;
+	buffer[3] = 0;
+	put_u32(buffer + 4, ring_overwritten);
+	put_u16(buffer + 8, used);
+	ring_copy_out(ring_head, buffer + TRACE_DUMP_HEADER_LEN, used);
+
+	taskEXIT_CRITICAL(&ring_lock);
+
+	return TRACE_DUMP_HEADER_LEN + used;
+}
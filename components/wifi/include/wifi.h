@@ -1,6 +1,14 @@
+#include "stdbool.h"
+#include "stdint.h"
+
+#include "backoff.h"
+
 extern EventGroupHandle_t wifi_connection_event_group;
 extern const int WIFI_CONNECTED_BIT;
+extern backoff_t wifi_backoff;
 
 esp_err_t init_tcp_ip();
-esp_err_t wifi_connect();
+esp_err_t wifi_connect(bool probe);
 esp_err_t wifi_disconnect();
+esp_err_t wifi_start_radio(uint8_t channel);
+void wifi_set_auto_reconnect(bool enabled);
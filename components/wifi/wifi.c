@@ -1,8 +1,14 @@
+#include "string.h"
+#include "time.h"
+
+#include "esp_attr.h"
 #include "esp_bit_defs.h"
 #include "esp_eap_client.h"
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_netif_sntp.h"
+#include "esp_timer.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
@@ -13,23 +19,106 @@
 #include "wifi.h"
 
 #define WIFI_CONNECTION_TIMEOUT 10 * 1000
+#define WIFI_PROBE_TIMEOUT CONFIG_SYNC_WIFI_PROBE_TIMEOUT_MS
+#define WIFI_DISCONNECT_TIMEOUT 200
+
+#define WIFI_SCAN_MAX_RECORDS 16
+
+#define CLOCK_RESYNC_S (CONFIG_SYNC_SNTP_RESYNC_HOURS * 3600)
+
+// Ranking weights - roughly "dB worth" of one past success / failure / 250 ms of association
+#define SCORE_SUCCESS_BONUS 3
+#define SCORE_FAILURE_PENALTY 10
+#define SCORE_MAX_HISTORY 4
+#define SCORE_LATENCY_STEP_MS 250
 
 static const char *TAG = "MODULE[wifi]";
 
 EventGroupHandle_t wifi_connection_event_group;
+static StaticEventGroup_t wifi_connection_event_group_buffer;
 const int WIFI_CONNECTED_BIT = BIT0;
+static const int WIFI_STARTED_BIT = BIT1;
+static const int WIFI_DISCONNECTED_BIT = BIT2;
+
+RTC_DATA_ATTR backoff_t wifi_backoff = {0};
+
+// Connection history per configured network - survives deep sleep, reset when the SSID changes
+typedef struct {
+	uint32_t ssid_hash;
+	uint8_t bssid[6];
+	uint8_t channel;
+	int8_t rssi;
+	uint8_t successes;
+	uint8_t failures;
+	uint16_t connect_ms;
+} wifi_network_stats_t;
+
+typedef struct {
+	int network;
+	uint8_t bssid[6];
+	uint8_t channel;
+	int8_t rssi;
+	int score;
+} wifi_candidate_t;
+
+RTC_DATA_ATTR static wifi_network_stats_t network_stats[CONFIG_SYNC_WIFI_MAX_NETWORKS] = {0};
+RTC_DATA_ATTR static int8_t last_network = -1; // Network of the last successful connection
+
+static wifi_ap_record_t scan_records[WIFI_SCAN_MAX_RECORDS];
+
+static bool auto_reconnect = false;
+
+// Wall-clock time of the last SNTP update - the RTC keeps the clock across deep sleep in between
+RTC_DATA_ATTR static int64_t last_clock_sync = 0;
+static bool sntp_running = false;
+
+static void clock_synced(struct timeval *tv) {
+	last_clock_sync = tv->tv_sec;
+	ESP_LOGI(TAG, "Clock set by SNTP");
+}
+
+// Runs alongside the MQTT session - wifi_disconnect() waits for the rest
+static void start_clock_sync() {
+	if (sntp_running || strlen(CONFIG_SYNC_SNTP_SERVER) == 0)
+		return;
+
+	int64_t now = time(NULL);
+	if (last_clock_sync != 0 && now >= last_clock_sync && now - last_clock_sync < CLOCK_RESYNC_S)
+		return;
+
+	esp_sntp_config_t config = ESP_NETIF_SNTP_DEFAULT_CONFIG(CONFIG_SYNC_SNTP_SERVER);
+	config.sync_cb = clock_synced;
+
+	if (esp_netif_sntp_init(&config) == ESP_OK)
+		sntp_running = true;
+}
+
+static void stop_clock_sync() {
+	if (!sntp_running)
+		return;
+
+	if (esp_netif_sntp_sync_wait(pdMS_TO_TICKS(CONFIG_SYNC_SNTP_TIMEOUT_MS)) != ESP_OK)
+		ESP_LOGW(TAG, "No SNTP response, keeping the RTC time");
+
+	esp_netif_sntp_deinit();
+	sntp_running = false;
+}
 
 static void wifi_event_handler(void *arg, esp_event_base_t event_base, int32_t event_id, void *event_data) {
 	if (event_base == WIFI_EVENT) {
 		switch (event_id) {
 			case WIFI_EVENT_STA_START:
 				ESP_LOGI(TAG, "WIFI_EVENT_STA_START");
-				esp_wifi_connect();
+				xEventGroupSetBits(wifi_connection_event_group, WIFI_STARTED_BIT);
 				break;
 
 			case WIFI_EVENT_STA_DISCONNECTED:
 				ESP_LOGI(TAG, "WIFI_EVENT_STA_DISCONNECTED");
 				xEventGroupClearBits(wifi_connection_event_group, WIFI_CONNECTED_BIT);
+				xEventGroupSetBits(wifi_connection_event_group, WIFI_DISCONNECTED_BIT);
+
+				if (auto_reconnect)
+					esp_wifi_connect();
 				break;
 
 			default:
@@ -44,6 +133,7 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
 			case IP_EVENT_STA_GOT_IP:
 				ESP_LOGI(TAG, "IP_EVENT_STA_GOT_IP");
 				xEventGroupSetBits(wifi_connection_event_group, WIFI_CONNECTED_BIT);
+				start_clock_sync();
 				break;
 
 			default:
@@ -52,6 +142,203 @@ static void ip_event_handler(void *arg, esp_event_base_t event_base, int32_t eve
 	}
 }
 
+static wifi_network_stats_t *get_stats(int network) {
+	wifi_network_stats_t *stats = &network_stats[network];
+	uint32_t hash = config_hash(shared_config.SYNC_WIFI_NETWORKS[network].ssid);
+
+	if (stats->ssid_hash != hash) {
+		memset(stats, 0, sizeof(wifi_network_stats_t));
+		stats->ssid_hash = hash;
+	}
+
+	return stats;
+}
+
+static void record_attempt(const wifi_candidate_t *candidate, bool success, uint32_t elapsed_ms) {
+	wifi_network_stats_t *stats = get_stats(candidate->network);
+
+	if (success) {
+		if (stats->successes < UINT8_MAX) stats->successes++;
+		stats->failures = 0;
+		stats->connect_ms = elapsed_ms > UINT16_MAX ? UINT16_MAX : elapsed_ms;
+		memcpy(stats->bssid, candidate->bssid, sizeof(stats->bssid));
+		stats->channel = candidate->channel;
+		stats->rssi = candidate->rssi;
+		last_network = candidate->network;
+	} else {
+		if (stats->failures < UINT8_MAX) stats->failures++;
+		if (last_network == candidate->network) last_network = -1;
+	}
+}
+
+static int score_candidate(const wifi_candidate_t *candidate) {
+	const wifi_network_stats_t *stats = get_stats(candidate->network);
+
+	int successes = stats->successes < SCORE_MAX_HISTORY ? stats->successes : SCORE_MAX_HISTORY;
+	int failures = stats->failures < SCORE_MAX_HISTORY ? stats->failures : SCORE_MAX_HISTORY;
+
+	return candidate->rssi +
+		   successes * SCORE_SUCCESS_BONUS -
+		   failures * SCORE_FAILURE_PENALTY -
+		   stats->connect_ms / SCORE_LATENCY_STEP_MS;
+}
+
+static int find_network(const uint8_t *ssid) {
+	for (int i = 0; i < shared_config.SYNC_WIFI_NETWORK_COUNT; i++)
+		if (strncmp((const char *)ssid, shared_config.SYNC_WIFI_NETWORKS[i].ssid, sizeof(shared_config.SYNC_WIFI_NETWORKS[i].ssid)) == 0)
+			return i;
+
+	return -1;
+}
+
+// One scan per wake - keeps the strongest AP of every configured network, ranked best first
+static int scan_candidates(wifi_candidate_t *candidates) {
+	wifi_scan_config_t scan_config = {
+		.scan_type = WIFI_SCAN_TYPE_ACTIVE,
+		.scan_time.active.min = 0,
+		.scan_time.active.max = CONFIG_SYNC_WIFI_SCAN_DWELL_MS};
+
+	if (esp_wifi_scan_start(&scan_config, true) != ESP_OK) {
+		ESP_LOGE(TAG, "Wi-Fi scan failed");
+		return 0;
+	}
+
+	uint16_t record_count = WIFI_SCAN_MAX_RECORDS;
+	if (esp_wifi_scan_get_ap_records(&record_count, scan_records) != ESP_OK)
+		return 0;
+
+	int count = 0;
+	for (int i = 0; i < record_count; i++) {
+		int network = find_network(scan_records[i].ssid);
+		if (network < 0)
+			continue;
+
+		int slot = 0;
+		while (slot < count && candidates[slot].network != network)
+			slot++;
+
+		if (slot < count && candidates[slot].rssi >= scan_records[i].rssi)
+			continue;
+
+		wifi_candidate_t *candidate = &candidates[slot];
+		candidate->network = network;
+		memcpy(candidate->bssid, scan_records[i].bssid, sizeof(candidate->bssid));
+		candidate->channel = scan_records[i].primary;
+		candidate->rssi = scan_records[i].rssi;
+		candidate->score = score_candidate(candidate);
+
+		if (slot == count)
+			count++;
+	}
+
+	// Insertion sort - a handful of candidates at most
+	for (int i = 1; i < count; i++) {
+		wifi_candidate_t candidate = candidates[i];
+		int j = i - 1;
+
+		while (j >= 0 && candidates[j].score < candidate.score) {
+			candidates[j + 1] = candidates[j];
+			j--;
+		}
+
+		candidates[j + 1] = candidate;
+	}
+
+	ESP_LOGI(TAG, "Scan found %d of %d configured networks", count, shared_config.SYNC_WIFI_NETWORK_COUNT);
+	return count;
+}
+
+static esp_err_t configure_network(const wifi_candidate_t *candidate) {
+	const wifi_network_t *network = &shared_config.SYNC_WIFI_NETWORKS[candidate->network];
+	wifi_config_t wifi_config = {};
+
+	strncpy((char *)wifi_config.sta.ssid,
+			network->ssid,
+			sizeof(wifi_config.sta.ssid));
+
+	// Known AP - associate directly instead of scanning all channels again
+	wifi_config.sta.bssid_set = true;
+	memcpy(wifi_config.sta.bssid, candidate->bssid, sizeof(wifi_config.sta.bssid));
+	wifi_config.sta.channel = candidate->channel;
+
+	switch (network->protocol) {
+		case WIFI_AUTH_OPEN:
+			RETURN_ON_ERROR(esp_wifi_sta_enterprise_disable());
+			break;
+
+		case WIFI_AUTH_WPA2_PSK:
+			strncpy((char *)wifi_config.sta.password,
+					network->password,
+					sizeof(wifi_config.sta.password));
+
+			RETURN_ON_ERROR(esp_wifi_sta_enterprise_disable());
+			break;
+
+		case WIFI_AUTH_WPA2_ENTERPRISE:
+			RETURN_ON_ERROR(esp_eap_client_set_username(
+				(uint8_t *)network->username,
+				strlen(network->username)));
+
+			RETURN_ON_ERROR(esp_eap_client_set_password(
+				(uint8_t *)network->password,
+				strlen(network->password)));
+
+			RETURN_ON_ERROR(esp_eap_client_set_eap_methods(ESP_EAP_TYPE_PEAP | ESP_EAP_TYPE_TTLS));
+			RETURN_ON_ERROR(esp_wifi_sta_enterprise_enable());
+
+			break;
+
+		default:
+			ESP_LOGE(TAG, "Unsupported Wi-Fi protocol: %d", network->protocol);
+			return ESP_FAIL;
+	}
+
+	return esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config);
+}
+
+static esp_err_t connect_candidate(const wifi_candidate_t *candidate, int timeout_ms) {
+	const char *ssid = shared_config.SYNC_WIFI_NETWORKS[candidate->network].ssid;
+	ESP_LOGI(TAG, "Connecting to Wi-Fi: %s (channel %d, RSSI %d)", ssid, candidate->channel, candidate->rssi);
+
+	int64_t start = esp_timer_get_time();
+	xEventGroupClearBits(wifi_connection_event_group, WIFI_CONNECTED_BIT | WIFI_DISCONNECTED_BIT);
+
+	esp_err_t ret = configure_network(candidate);
+	if (ret == ESP_OK) ret = esp_wifi_connect();
+
+	EventBits_t bits = 0;
+	if (ret == ESP_OK) {
+		// A rejected association ends the attempt right away instead of running out the timeout
+		bits = xEventGroupWaitBits(
+			wifi_connection_event_group,
+			WIFI_CONNECTED_BIT | WIFI_DISCONNECTED_BIT,
+			pdFALSE, pdFALSE,
+			pdMS_TO_TICKS(timeout_ms));
+	}
+
+	uint32_t elapsed_ms = (esp_timer_get_time() - start) / 1000;
+	bool connected = bits & WIFI_CONNECTED_BIT;
+	record_attempt(candidate, connected, elapsed_ms);
+
+	if (connected) {
+		ESP_LOGI(TAG, "Connected to Wi-Fi: %s in %d ms", ssid, (int)elapsed_ms);
+		return ESP_OK;
+	}
+
+	ESP_LOGE(TAG, "Failed to connect to Wi-Fi: %s", ssid);
+
+	if (!(bits & WIFI_DISCONNECTED_BIT)) {
+		esp_wifi_disconnect();
+		xEventGroupWaitBits(
+			wifi_connection_event_group,
+			WIFI_DISCONNECTED_BIT,
+			pdFALSE, pdTRUE,
+			pdMS_TO_TICKS(WIFI_DISCONNECT_TIMEOUT));
+	}
+
+	return ESP_FAIL;
+}
+
 esp_err_t init_tcp_ip() {
 	ESP_LOGI(TAG, "Init TCP/IP");
 	RETURN_ON_ERROR(esp_netif_init());
@@ -59,8 +346,9 @@ esp_err_t init_tcp_ip() {
 	return ESP_OK;
 }
 
-esp_err_t wifi_connect() {
-	wifi_connection_event_group = xEventGroupCreate();
+esp_err_t wifi_connect(bool probe) {
+	RETURN_ON_ERROR(shared_nvs_init_default());
+	wifi_connection_event_group = xEventGroupCreateStatic(&wifi_connection_event_group_buffer);
 
 	esp_netif_t *netif = esp_netif_create_default_wifi_sta();
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
@@ -81,61 +369,72 @@ esp_err_t wifi_connect() {
 														NULL,
 														&got_ip_event_instance));
 
-	wifi_config_t wifi_config = {};
+	RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA));
+	RETURN_ON_ERROR(esp_wifi_start());
 
-	strncpy((char *)wifi_config.sta.ssid,
-			shared_config.SYNC_WIFI_SSID,
-			sizeof(wifi_config.sta.ssid));
+	xEventGroupWaitBits(
+		wifi_connection_event_group,
+		WIFI_STARTED_BIT,
+		pdFALSE, pdTRUE,
+		portMAX_DELAY);
 
-	switch (shared_config.SYNC_WIFI_PROTOCOL) {
-		case WIFI_AUTH_OPEN:
-			break;
+	// Whole budget of this wake - shared by all attempts
+	int64_t deadline = esp_timer_get_time() + (int64_t)(probe ? WIFI_PROBE_TIMEOUT : WIFI_CONNECTION_TIMEOUT) * 1000;
 
-		case WIFI_AUTH_WPA2_PSK:
-			strncpy((char *)wifi_config.sta.password,
-					shared_config.SYNC_WIFI_PASSWORD,
-					sizeof(wifi_config.sta.password));
+	// Fast path - the AP that worked last time, no scan
+	if (last_network >= 0 && last_network < shared_config.SYNC_WIFI_NETWORK_COUNT) {
+		const wifi_network_stats_t *stats = get_stats(last_network);
 
-			break;
+		if (stats->successes > 0 && stats->channel != 0) {
+			wifi_candidate_t cached = {.network = last_network, .channel = stats->channel, .rssi = stats->rssi};
+			memcpy(cached.bssid, stats->bssid, sizeof(cached.bssid));
 
-		case WIFI_AUTH_WPA2_ENTERPRISE:
-			RETURN_ON_ERROR(esp_eap_client_set_username(
-				(uint8_t *)shared_config.SYNC_WIFI_USERNAME,
-				strlen(shared_config.SYNC_WIFI_USERNAME)));
+			int timeout_ms = (deadline - esp_timer_get_time()) / 1000;
+			if (connect_candidate(&cached, timeout_ms) == ESP_OK)
+				return ESP_OK;
+		}
+	}
 
-			RETURN_ON_ERROR(esp_eap_client_set_password(
-				(uint8_t *)shared_config.SYNC_WIFI_PASSWORD,
-				strlen(shared_config.SYNC_WIFI_PASSWORD)));
+	wifi_candidate_t candidates[CONFIG_SYNC_WIFI_MAX_NETWORKS];
+	int count = scan_candidates(candidates);
 
-			RETURN_ON_ERROR(esp_eap_client_set_eap_methods(ESP_EAP_TYPE_PEAP | ESP_EAP_TYPE_TTLS));
-			RETURN_ON_ERROR(esp_wifi_sta_enterprise_enable());
+	// Probing only tries the best candidate
+	if (probe && count > 1)
+		count = 1;
 
+	for (int i = 0; i < count; i++) {
+		int timeout_ms = (deadline - esp_timer_get_time()) / 1000;
+		if (timeout_ms <= 0)
 			break;
 
-		default:
-			ESP_LOGE(TAG, "Unsupported Wi-Fi protocol: %d", shared_config.SYNC_WIFI_PROTOCOL);
-			return ESP_FAIL;
+		if (connect_candidate(&candidates[i], timeout_ms) == ESP_OK)
+			return ESP_OK;
 	}
 
+	ESP_LOGE(TAG, "No configured Wi-Fi network reachable");
+	return ESP_FAIL;
+}
+
+// Radio only, no association - ESP-NOW on a fixed channel
+esp_err_t wifi_start_radio(uint8_t channel) {
+	RETURN_ON_ERROR(shared_nvs_init_default());
+
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	RETURN_ON_ERROR(esp_wifi_init(&cfg));
+	RETURN_ON_ERROR(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 	RETURN_ON_ERROR(esp_wifi_set_mode(WIFI_MODE_STA));
-	RETURN_ON_ERROR(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
 	RETURN_ON_ERROR(esp_wifi_start());
 
-	EventBits_t bits = xEventGroupWaitBits(
-		wifi_connection_event_group,
-		WIFI_CONNECTED_BIT,
-		pdFALSE, pdTRUE,
-		pdMS_TO_TICKS(WIFI_CONNECTION_TIMEOUT));
+	return esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+}
 
-	if (bits & WIFI_CONNECTED_BIT) {
-		ESP_LOGI(TAG, "Connected to Wi-Fi: %s", shared_config.SYNC_WIFI_SSID);
-		return ESP_OK;
-	} else {
-		ESP_LOGE(TAG, "Failed to connect to Wi-Fi: %s", shared_config.SYNC_WIFI_SSID);
-		return ESP_FAIL;
-	}
+// Keeps the association alive for nodes that never sleep - reconnects to the same network on every drop
+void wifi_set_auto_reconnect(bool enabled) {
+	auto_reconnect = enabled;
 }
 
 esp_err_t wifi_disconnect() {
+	auto_reconnect = false;
+	stop_clock_sync();
 	return esp_wifi_stop();
 }
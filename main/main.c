@@ -1,3 +1,4 @@
+#include "math.h"
 #include "stdio.h"
 
 #include "driver/gpio.h"
@@ -5,78 +6,105 @@
 #include "esp_log.h"
 #include "esp_netif.h"
 #include "esp_sleep.h"
+#include "esp_system.h"
 #include "freertos/FreeRTOS.h"
 #include "nvs_flash.h"
 
+#include "backlog.h"
+#include "backoff.h"
+#include "battery.h"
+#include "beacon.h"
+#include "bench.h"
 #include "bluetooth.h"
+#include "diagnostics.h"
 #include "helpers.h"
+#include "link.h"
+#include "ota.h"
+#include "schedule.h"
 #include "sensors.h"
 #include "shared.h"
 #include "sync.h"
+#include "trace.h"
 #include "wifi.h"
 
 static const char *TAG = "MODULE[main]";
 
-// Number of concurrent tasks running measurements to wait for before MQTT sync
-#define TASK_COUNT 2
+// How often the sensor rings are drained while the measurement tasks run
+#define SAMPLE_DRAIN_INTERVAL_MS 1000
 
 #define BLUETOOTH_TRIGGER_GPIO GPIO_NUM_0
+#define GPIO_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 8)
+#define PROVISIONING_POLL_MS 100
 
-void app_main(void) {
-	ESP_LOGI(TAG, "Booting Vogon...");
-	esp_err_t ret;
+// Always-on modes - pause before restarting when the network is unusable at boot
+#define NETWORK_RETRY_DELAY_MS 30 * 1000
 
-	// NVS flash required by WiFi, MQTT and BLE
-	ret = nvs_flash_init();
-	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-		ESP_ERROR_CHECK(nvs_flash_erase());
-		ESP_ERROR_CHECK(nvs_flash_init());
-	}
+// Sensor tasks end before deep sleep - continuous mode reuses the same stacks for its stream tasks
+#define SENSOR_TASK_STACK_SIZE (configMINIMAL_STACK_SIZE * 8)
 
-	// Also flash app-specific NVS partition
-	ret = nvs_flash_init_partition(NVS_PARTITION);
-	if (ret == ESP_ERR_NVS_NO_FREE_PAGES || ret == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-		ESP_ERROR_CHECK(nvs_flash_erase_partition(NVS_PARTITION));
-		ESP_ERROR_CHECK(nvs_flash_init_partition(NVS_PARTITION));
-	}
+static StaticTask_t dht22_task_buffer;
+static StaticTask_t sds011_task_buffer;
+static StackType_t dht22_task_stack[SENSOR_TASK_STACK_SIZE];
+static StackType_t sds011_task_stack[SENSOR_TASK_STACK_SIZE];
 
-	// Detect wakeup cause and choose device mode
-	// - boot button press - bluetooth configuration mode
-	// - otherwise normal operation
-	esp_reset_reason_t reset_reason = esp_reset_reason();
-	esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
+static StaticSemaphore_t sync_mutex_buffer;
 
-	rtc_gpio_hold_dis(BLUETOOTH_TRIGGER_GPIO);	   // Allow GPIO pin reconfiguration
-	rtc_gpio_pullup_dis(BLUETOOTH_TRIGGER_GPIO);   // Clear any previous pull-ups
-	rtc_gpio_pulldown_dis(BLUETOOTH_TRIGGER_GPIO); // Clear any previous pull-downs
+#if !CONFIG_VOGON_BAKED_CONFIG
+static TaskHandle_t gpio_task_handle = NULL;
+static StaticTask_t gpio_task_buffer;
+static StackType_t gpio_task_stack[GPIO_TASK_STACK_SIZE];
+static StaticQueue_t gpio_evt_queue_buffer;
+static uint8_t gpio_evt_queue_storage[sizeof(int)];
+static volatile bool provisioning = false; // Button-started provisioning holds off deep sleep
 
-	ESP_LOGI(TAG, "Reset reason: %d", reset_reason);
-	ESP_LOGI(TAG, "Wakeup cause: %d", wakeup_cause);
+// BLE mode until a valid configuration is written, then straight on to a full cycle with it
+static void run_provisioning() {
+	bluetooth_gatt_server_start();
+	bluetooth_wait_for_config();
+	bluetooth_gatt_server_stop();
 
-	if (wakeup_cause == ESP_SLEEP_WAKEUP_EXT0) {
-		ESP_LOGI(TAG, "Woke up from BOOT button press - starting Bluetooth configuration mode");
-		bluetooth_gatt_server_start();
-		return;
-	}
+	// Old credentials and intervals must not hold back the first cycle
+	schedule_reset();
+	backoff_success(&wifi_backoff);
+	backoff_success(&mqtt_backoff);
+}
 
-	// Load configuration from NVS
-	ret = load_shared_config();
-	if (ret != ESP_OK) {
-		ESP_LOGW(TAG, "Vogon not yet configured. Entering Bluetooth configuration mode.");
-		bluetooth_gatt_server_start();
-		return;
+// Button press during a cycle - the same provisioning as at boot, then the written configuration replaces the running one
+static void bluetooth_trigger_task(void *arg) {
+	int pin;
+
+	for (;;) {
+		if (xQueueReceive(gpio_evt_queue, &pin, portMAX_DELAY) != pdTRUE)
+			continue;
+
+		provisioning = true;
+		run_provisioning();
+
+		if (load_shared_config() != ESP_OK)
+			ESP_LOGE(TAG, "Provisioned configuration could not be loaded");
+
+		// Presses during provisioning don't start it again
+		xQueueReset(gpio_evt_queue);
+		provisioning = false;
 	}
+}
+
+// Start BLE configuration server on EN button press (START_BLUETOOTH_GPIO)
+static void start_bluetooth_trigger() {
+	rtc_gpio_hold_dis(BLUETOOTH_TRIGGER_GPIO);	   // Allow GPIO pin reconfiguration
+	rtc_gpio_pullup_dis(BLUETOOTH_TRIGGER_GPIO);   // Clear any previous pull-ups
+	rtc_gpio_pulldown_dis(BLUETOOTH_TRIGGER_GPIO); // Clear any previous pull-downs
 
-	// Start BLE configuration server on EN button press (START_BLUETOOTH_GPIO)
-	gpio_evt_queue = xQueueCreate(1, sizeof(int));
+	gpio_evt_queue = xQueueCreateStatic(1, sizeof(int), gpio_evt_queue_storage, &gpio_evt_queue_buffer);
 
-	xTaskCreatePinnedToCore(
-		bluetooth_gat_server_trigger_task,
+	gpio_task_handle = xTaskCreateStaticPinnedToCore(
+		bluetooth_trigger_task,
 		"gpio_task",
-		configMINIMAL_STACK_SIZE * 8,
+		GPIO_TASK_STACK_SIZE,
 		NULL,
 		10,
-		NULL,
+		gpio_task_stack,
+		&gpio_task_buffer,
 		APP_CPU_NUM);
 
 	gpio_config_t io_conf = {
@@ -91,62 +119,328 @@ void app_main(void) {
 		BLUETOOTH_TRIGGER_GPIO,
 		gpio_isr_handler,
 		(void *)BLUETOOTH_TRIGGER_GPIO));
+}
+#endif
 
-	// Initialize sync semaphore to number of concurrent tasks
-	// sync_mutex = xSemaphoreCreateCounting(TASK_COUNT, 0);
-
-	// Initialize shared data
-	shared_data.temperature = 0;
-	shared_data.humidity = 0,
-	shared_data.pm25 = 0;
-	shared_data.pm10 = 0;
-
-	// ESP_LOGI(TAG, "Warming up...");
-	// vTaskDelay(pdMS_TO_TICKS(5 * 1000));
-
-	// ESP_LOGI(TAG, "Starting DHT22 task!");
-	// xTaskCreatePinnedToCore(
-	// 	dht22_task,
-	// 	"dht22",
-	// 	configMINIMAL_STACK_SIZE * 8,
-	// 	NULL,
-	// 	10,
-	// 	NULL,
-	// 	APP_CPU_NUM);
-
-	// ESP_LOGI(TAG, "Starting SDS011 task!");
-	// xTaskCreatePinnedToCore(
-	// 	sds011_task,
-	// 	"sds011",
-	// 	configMINIMAL_STACK_SIZE * 8,
-	// 	NULL,
-	// 	10,
-	// 	NULL,
-	// 	APP_CPU_NUM);
-
-	// ESP_LOGI(TAG, "All tasks are pinned!");
-
-	// // Wait for concurrent tasks to finish
-	// for (int i = 0; i < TASK_COUNT; i++) {
-	// 	if (xSemaphoreTake(sync_mutex, portMAX_DELAY) != pdTRUE) {
-	// 		ESP_LOGE(TAG, "Failed to take semaphore!");
-	// 	}
-	// }
+static void drain_samples(sample_ring_t *ring, sample_stats_t *first, sample_stats_t *second) {
+	sensor_sample_t sample;
+
+	while (sample_ring_pop(ring, &sample)) {
+		sample_stats_add(first, sample.values[0]);
+		sample_stats_add(second, sample.values[1]);
+	}
+}
+
+// Consumer of the sensor rings - averages the samples while `task_count` sensor tasks are still measuring
+// Returns false when no sensor delivered anything
+static bool collect_reading(shared_data_t *reading, int task_count) {
+	alloc_scope_begin();
+	sample_stats_t stats[STREAM_PARAMETER_COUNT];
+	for (int p = 0; p < STREAM_PARAMETER_COUNT; p++)
+		sample_stats_reset(&stats[p]);
+
+	int finished = 0;
+	while (finished < task_count) {
+		if (xSemaphoreTake(sync_mutex, pdMS_TO_TICKS(SAMPLE_DRAIN_INTERVAL_MS)) == pdTRUE)
+			finished++;
+
+		drain_samples(&dht22_ring, &stats[STREAM_TEMPERATURE], &stats[STREAM_HUMIDITY]);
+		drain_samples(&sds011_ring, &stats[STREAM_PM25], &stats[STREAM_PM10]);
+	}
+
+	// Sensors that were not due or delivered nothing are left out of the reading
+	bool environmental = stats[STREAM_TEMPERATURE].count > 0;
+	bool particulate = stats[STREAM_PM25].count > 0;
+
+	reading->temperature = environmental ? sample_stats_mean(&stats[STREAM_TEMPERATURE]) : NAN;
+	reading->humidity = environmental ? sample_stats_mean(&stats[STREAM_HUMIDITY]) : NAN;
+	reading->pm25 = particulate ? lroundf(sample_stats_mean(&stats[STREAM_PM25])) : READING_PM_MISSING;
+	reading->pm10 = particulate ? lroundf(sample_stats_mean(&stats[STREAM_PM10])) : READING_PM_MISSING;
+	alloc_scope_end();
+
+	ESP_LOGI(TAG, "Final measurements: temperature=%.2fC, humidity=%.2f%%, PM2.5=%d, PM10=%d",
+			 reading->temperature, reading->humidity, reading->pm25, reading->pm10);
+
+	return environmental || particulate;
+}
+
+// Continuous mode - the stream's acknowledged publishes stand in for the syncs of a sleeping node
+static void stream_published() {
+	// Only firmware that reached the broker is kept after an update
+	ota_confirm(true);
+
+	// Reuse the connection to fetch firmware updates
+	ota_run();
+}
+
+// Mains powered nodes - sensors stream at their maximum rate, the node never sleeps
+static void run_continuous() {
+	ESP_LOGI(TAG, "Starting continuous mode");
+
+	xTaskCreateStaticPinnedToCore(dht22_stream_task, "dht22", SENSOR_TASK_STACK_SIZE, NULL, 10, dht22_task_stack, &dht22_task_buffer, APP_CPU_NUM);
+	xTaskCreateStaticPinnedToCore(sds011_stream_task, "sds011", SENSOR_TASK_STACK_SIZE, NULL, 10, sds011_task_stack, &sds011_task_buffer, APP_CPU_NUM);
+
+#if !CONFIG_VOGON_BAKED_CONFIG && CONFIG_VOGON_FAST_BOOT
+	start_bluetooth_trigger();
+#endif
+
+	init_tcp_ip();
+
+	if (wifi_connect(false) != ESP_OK) {
+		ESP_LOGE(TAG, "No Wi-Fi network reachable, restarting...");
+		vTaskDelay(pdMS_TO_TICKS(NETWORK_RETRY_DELAY_MS));
+		esp_restart();
+	}
+
+	wifi_set_auto_reconnect(true);
+
+	mqtt_stream(stream_published);
+
+	// Setup failed or continuous mode was turned off - start over
+	esp_restart();
+}
+
+// ESP-NOW gateway - stays associated and forwards what leaf nodes send, measures nothing itself
+static void run_gateway() {
+	ESP_LOGI(TAG, "Starting ESP-NOW gateway");
+
+#if !CONFIG_VOGON_BAKED_CONFIG && CONFIG_VOGON_FAST_BOOT
+	start_bluetooth_trigger();
+#endif
 
 	init_tcp_ip();
-	ret = wifi_connect();
 
-	if (ret == ESP_OK) {
-		mqtt_sync();
-		wifi_disconnect();
+	if (wifi_connect(false) != ESP_OK) {
+		ESP_LOGE(TAG, "No Wi-Fi network reachable, restarting...");
+		vTaskDelay(pdMS_TO_TICKS(NETWORK_RETRY_DELAY_MS));
+		esp_restart();
 	}
 
-	uint64_t sleep_time = shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL * 60 * 1000000;
+	wifi_set_auto_reconnect(true);
+	ESP_ERROR_CHECK(link_gateway_start());
+
+	for (;;) {
+		vTaskDelay(pdMS_TO_TICKS(CONFIG_LINK_GATEWAY_FORWARD_MS));
+
+		if (link_relay_count() > 0 && mqtt_sync(false) == ESP_OK)
+			ota_confirm(true);
+	}
+}
 
-	ESP_LOGI(TAG, "Going to sleep for %d minutes...", shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL);
+void app_main(void) {
+	ESP_LOGI(TAG, "Booting Vogon...");
+	esp_err_t ret;
+
+	// Before anything parses JSON - documents are parsed in a static arena
+	shared_json_init();
+
+	// NVS partitions are initialized lazily on first read (shared_nvs_init*)
+
+#if CONFIG_VOGON_BENCHMARK
+	bench_run();
+	return;
+#endif
+
+	trace_begin_cycle();
+
+	// Detect wakeup cause and choose device mode
+	// - boot button press - bluetooth configuration mode
+	// - otherwise normal operation
+	esp_reset_reason_t reset_reason = esp_reset_reason();
+	esp_sleep_wakeup_cause_t wakeup_cause = esp_sleep_get_wakeup_cause();
+
+	ESP_LOGI(TAG, "Reset reason: %d", reset_reason);
+	ESP_LOGI(TAG, "Wakeup cause: %d", wakeup_cause);
+
+#if CONFIG_VOGON_BAKED_CONFIG
+	// Configuration is part of the image - no NVS, JSON or BLE provisioning
+	ESP_LOGI(TAG, "Using baked configuration");
+#else
+	if (wakeup_cause == ESP_SLEEP_WAKEUP_EXT0) {
+		ESP_LOGI(TAG, "Woke up from BOOT button press - starting Bluetooth configuration mode");
+		run_provisioning();
+	}
+
+	// Load configuration from NVS
+	while (load_shared_config() != ESP_OK) {
+		ESP_LOGW(TAG, "Vogon not yet configured. Entering Bluetooth configuration mode.");
+		run_provisioning();
+	}
+#endif
+
+	diag_begin_cycle();
+
+#if !CONFIG_VOGON_BAKED_CONFIG && !CONFIG_VOGON_FAST_BOOT
+	start_bluetooth_trigger();
+#endif
+
+	diag_capture_phase(DIAG_PHASE_BOOT);
+
+	if (shared_config.SYNC_LINK_ROLE == SYNC_LINK_GATEWAY) {
+		run_gateway();
+		return;
+	}
+
+	if (shared_config.SENSORS_CONTINUOUS_MODE) {
+		run_continuous();
+		return;
+	}
+
+	diag_capture_first_sample(); // Measurement starts here
+
+	// Unloaded voltage - decides the band of this wake's schedule and bulk sizes
+	if (battery_measure() == ESP_OK && battery_millivolts() > 0)
+		diag_capture_battery(battery_millivolts(), battery_band());
+
+	// Only the drivers that are due run on this wake
+	schedule_begin();
+	int task_count = 0;
+
+	// Initialize sync semaphore to number of concurrent tasks
+	sync_mutex = xSemaphoreCreateCountingStatic(SCHEDULE_SENSOR_JOB_COUNT, 0, &sync_mutex_buffer);
+
+	if (schedule_due(SCHEDULE_ENVIRONMENTAL)) {
+		ESP_LOGI(TAG, "Starting DHT22 task!");
+		xTaskCreateStaticPinnedToCore(
+			dht22_task,
+			"dht22",
+			SENSOR_TASK_STACK_SIZE,
+			NULL,
+			10,
+			dht22_task_stack,
+			&dht22_task_buffer,
+			APP_CPU_NUM);
+
+		schedule_done(SCHEDULE_ENVIRONMENTAL);
+		task_count++;
+	}
+
+	if (schedule_due(SCHEDULE_PARTICULATE)) {
+		ESP_LOGI(TAG, "Starting SDS011 task!");
+		xTaskCreateStaticPinnedToCore(
+			sds011_task,
+			"sds011",
+			SENSOR_TASK_STACK_SIZE,
+			NULL,
+			10,
+			sds011_task_stack,
+			&sds011_task_buffer,
+			APP_CPU_NUM);
+
+		schedule_done(SCHEDULE_PARTICULATE);
+		task_count++;
+	}
+
+	// Samples are drained from the rings until the started tasks finished
+	shared_data_t reading;
+	bool measured = task_count > 0 && collect_reading(&reading, task_count);
+
+	diag_capture_phase(DIAG_PHASE_MEASURE);
+
+#if !CONFIG_VOGON_BAKED_CONFIG && CONFIG_VOGON_FAST_BOOT
+	// Out of the measurement path - the button still works during sync
+	start_bluetooth_trigger();
+#endif
+
+	// Sensors that failed on every attempt leave no reading - a row of missing values only costs backlog space
+	if (measured) {
+		alloc_scope_begin();
+		backlog_push(&reading);
+		alloc_scope_end();
+	}
+
+	// A new image proves itself by syncing on its first cycle with a reachable network, whatever the upload schedule
+	bool sync_due = schedule_due(SCHEDULE_SYNC) || ota_pending_verify();
+	if (schedule_due(SCHEDULE_SYNC))
+		schedule_done(SCHEDULE_SYNC);
+
+	// Back off from an unreachable AP or broker - measure and store locally until the next probe
+	backoff_action_t wifi_action = sync_due ? backoff_next(&wifi_backoff) : BACKOFF_SKIP;
+	backoff_action_t mqtt_action = sync_due ? backoff_next(&mqtt_backoff) : BACKOFF_SKIP;
+
+	bool synced = false;
+	bool conclusive = false; // A failed sync only counts against a new image when no network or broker is to blame
+
+	if (!sync_due) {
+		ESP_LOGI(TAG, "Upload not due, %d readings stored locally", (int)backlog_count());
+	} else if (shared_config.SYNC_LINK_ROLE == SYNC_LINK_LEAF) {
+		// No association, DHCP or MQTT - one acknowledged frame per block to the gateway
+		init_tcp_ip();
+		synced = link_leaf_sync() == ESP_OK;
+	} else if (shared_config.SYNC_LINK_ROLE == SYNC_LINK_BEACON) {
+		// Nobody acknowledges a broadcast - only the latest reading is kept on air
+		size_t stored = backlog_count();
+		if (stored > 0) {
+			synced = beacon_broadcast(&backlog_peek(stored - 1)->data) == ESP_OK;
+			conclusive = true; // Nothing to reach - a failed broadcast is the image's fault
+
+			// A failed broadcast keeps the latest reading for the next wake
+			backlog_drop(synced ? stored : stored - 1);
+		}
+	} else if (wifi_action == BACKOFF_SKIP || mqtt_action == BACKOFF_SKIP) {
+		ESP_LOGW(TAG, "Connection backoff active (Wi-Fi failures: %d, MQTT failures: %d), %d readings stored locally",
+				 wifi_backoff.failures, mqtt_backoff.failures, (int)backlog_count());
+	} else {
+		init_tcp_ip();
+		ret = wifi_connect(wifi_action == BACKOFF_PROBE);
+
+		if (ret == ESP_OK) {
+			backoff_success(&wifi_backoff);
+
+			ret = mqtt_sync(mqtt_action == BACKOFF_PROBE);
+			if (ret == ESP_OK) {
+				backoff_success(&mqtt_backoff);
+				synced = true;
+
+				// Reuse the connection to fetch firmware updates
+				ota_run();
+			} else if (ret == ESP_ERR_NOT_FINISHED) {
+				// The broker answered - expired messages are retried on the next sync, not backed off
+				backoff_success(&mqtt_backoff);
+			} else {
+				backoff_failure(&mqtt_backoff);
+			}
+
+			wifi_disconnect();
+		} else {
+			backoff_failure(&wifi_backoff);
+		}
+	}
+
+	// An AP or broker outage, expired messages, a silent gateway or an active backoff defer the verdict to a later cycle
+	if (sync_due && (synced || conclusive))
+		ota_confirm(synced);
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+	diag_capture_task(DIAG_TASK_GPIO, gpio_task_handle);
+#endif
+	diag_capture_phase(DIAG_PHASE_SYNC);
+
+#if CONFIG_VOGON_ALLOC_CHECK
+	uint32_t allocs = alloc_scope_take();
+	if (allocs > 0)
+		ESP_LOGE(TAG, "Wake cycle made %lu heap allocations", (unsigned long)allocs);
+	else
+		ESP_LOGI(TAG, "Wake cycle made no heap allocations");
+#endif
+
+#if !CONFIG_VOGON_BAKED_CONFIG
+	// A configuration written now resets the schedule - the node wakes straight into a cycle with it
+	while (provisioning)
+		vTaskDelay(pdMS_TO_TICKS(PROVISIONING_POLL_MS));
+#endif
+
+	// Until the earliest of the sensor and upload jobs is due
+	uint64_t sleep_time = schedule_sleep_us();
+
+	ESP_LOGI(TAG, "Going to sleep for %d seconds...", (int)(sleep_time / 1000000));
+#if !CONFIG_VOGON_BAKED_CONFIG
 	rtc_gpio_pullup_dis(BLUETOOTH_TRIGGER_GPIO);  // Make sure pull-up is off
 	rtc_gpio_pulldown_en(BLUETOOTH_TRIGGER_GPIO); // Have GPIO pin default to LOW
 	esp_sleep_enable_ext0_wakeup(BLUETOOTH_TRIGGER_GPIO, 0);
 	rtc_gpio_hold_en(BLUETOOTH_TRIGGER_GPIO); // Freeze GPIO configuration
+#endif
+
+	diag_prepare_sleep(sleep_time);
 	esp_deep_sleep(sleep_time);
 }
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+"""Host-side decoder for the Vogon BLE beacon.
+
+The advertisement format is documented in
+components/beacon/include/beacon_protocol.h. Decodes advertising data given
+as hex and prints it shaped like a raw MQTT message:
+
+	tools/decode_beacon.py 0201040fffffff5601070...
+
+or listens for beacons with bleak (pip install bleak) and prints one line
+per wake, dropping the repeated copies of a burst:
+
+	tools/decode_beacon.py --scan
+"""
+
+import argparse
+import asyncio
+import json
+import struct
+import sys
+
+COMPANY_ID = 0xFFFF
+MAGIC = ord("V")
+VERSION = 1
+
+AD_TYPE_MANUFACTURER = 0xFF
+PAYLOAD = struct.Struct("<BBHhHHH")  # After the company ID
+
+TEMPERATURE_MISSING = -0x8000
+VALUE_MISSING = 0xFFFF
+
+
+def decode_manufacturer(data):
+	"""Decodes the manufacturer specific data following the company ID."""
+	if len(data) < PAYLOAD.size:
+		return None
+
+	magic, version, sequence, temperature, humidity, pm25, pm10 = PAYLOAD.unpack_from(data)
+	if magic != MAGIC or version != VERSION:
+		return None
+
+	values = {}
+	if temperature != TEMPERATURE_MISSING:
+		values["temperature"] = temperature / 100
+	if humidity != VALUE_MISSING:
+		values["humidity"] = humidity / 100
+	if pm25 != VALUE_MISSING:
+		values["pm25"] = pm25
+	if pm10 != VALUE_MISSING:
+		values["pm10"] = pm10
+
+	return sequence, values
+
+
+def decode(adv, company_id=COMPANY_ID):
+	"""Walks the AD structures of an advertisement, returns (sequence, values) or None."""
+	pos = 0
+	while pos < len(adv):
+		length = adv[pos]
+		if length == 0 or pos + 1 + length > len(adv):
+			return None
+
+		field = adv[pos + 1 : pos + 1 + length]
+		pos += 1 + length
+
+		if field[0] == AD_TYPE_MANUFACTURER and len(field) >= 3 and int.from_bytes(field[1:3], "little") == company_id:
+			return decode_manufacturer(field[3:])
+
+	return None
+
+
+def message(address, sequence, values):
+	return json.dumps({"mac_address": address, "sequence": sequence, **values})
+
+
+async def scan(company_id):
+	from bleak import BleakScanner
+
+	last = {}
+
+	def detected(device, advertisement):
+		data = advertisement.manufacturer_data.get(company_id)
+		decoded = data and decode_manufacturer(data)
+		if not decoded:
+			return
+
+		sequence, values = decoded
+		if last.get(device.address) == sequence:
+			return
+
+		last[device.address] = sequence
+		print(message(device.address, sequence, values), flush=True)
+
+	async with BleakScanner(detected):
+		await asyncio.Event().wait()
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+	parser.add_argument("adv", nargs="?", help="advertising data as hex")
+	parser.add_argument("--scan", action="store_true", help="listen for beacons")
+	parser.add_argument("--company-id", type=lambda value: int(value, 0), default=COMPANY_ID)
+	args = parser.parse_args()
+
+	if args.scan:
+		asyncio.run(scan(args.company_id))
+		return
+
+	if not args.adv:
+		parser.error("advertising data or --scan required")
+
+	decoded = decode(bytes.fromhex(args.adv), args.company_id)
+	if not decoded:
+		sys.exit("not a Vogon beacon")
+
+	print(message(None, *decoded))
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Reference decoder for the Vogon columnar backlog block format.
+
+The format is documented in components/encoding/include/block.h. Reads one
+block from a file (or stdin) and prints one JSON object per value, in the
+same shape as the messages published to vogonair/:mac_address/raw.
+
+	mosquitto_sub -t 'vogonair/+/block' -C 1 > block.bin
+	tools/decode_block.py block.bin
+"""
+
+import json
+import sys
+
+MAGIC = b"VB"
+VERSION = 1
+DEVICE_ID_LEN = 6
+
+
+class Reader:
+	def __init__(self, data):
+		self.data = data
+		self.pos = 0
+
+	def byte(self):
+		if self.pos >= len(self.data):
+			raise ValueError("unexpected end of block")
+
+		value = self.data[self.pos]
+		self.pos += 1
+		return value
+
+	def varint(self):
+		result = 0
+		shift = 0
+
+		while True:
+			byte = self.byte()
+			result |= (byte & 0x7F) << shift
+			shift += 7
+
+			if not byte & 0x80:
+				return result & 0xFFFFFFFF
+
+	def zigzag(self):
+		value = self.varint()
+		return (value >> 1) ^ -(value & 1)
+
+
+def decode(data):
+	reader = Reader(data)
+
+	if bytes([reader.byte(), reader.byte()]) != MAGIC:
+		raise ValueError("not a Vogon block")
+
+	version = reader.byte()
+	if version != VERSION:
+		raise ValueError(f"unsupported block version {version}")
+
+	device_id = bytes(reader.byte() for _ in range(DEVICE_ID_LEN))
+	address = ":".join(f"{b:02X}" for b in device_id)
+
+	readings = []
+	for _ in range(reader.varint()):
+		sensor = reader.varint()
+		parameter = reader.varint()
+		scale = reader.byte()
+		count = reader.varint()
+
+		timestamp = 0
+		value = 0
+
+		for _ in range(count):
+			timestamp = (timestamp + reader.zigzag()) & 0xFFFFFFFF
+			value += reader.zigzag()
+
+			readings.append({
+				"address": address,
+				"sensor": sensor,
+				"parameter": parameter,
+				"value": value / 10**scale,
+				"timestamp": timestamp,
+			})
+
+	if reader.pos != len(data):
+		raise ValueError("trailing bytes after last column")
+
+	return readings
+
+
+def main():
+	if len(sys.argv) > 1:
+		with open(sys.argv[1], "rb") as f:
+			data = f.read()
+	else:
+		data = sys.stdin.buffer.read()
+
+	for reading in decode(data):
+		print(json.dumps(reading))
+
+
+if __name__ == "__main__":
+	main()
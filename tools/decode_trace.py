@@ -0,0 +1,102 @@
+#!/usr/bin/env python3
+"""Host-side decoder for the Vogon deferred trace ring.
+
+The dump format is documented in components/trace/include/trace.h and the
+event formats are read from components/trace/include/trace_events.h of the
+same firmware version. Reads one dump from a file (or stdin) and prints one
+line per record:
+
+	mosquitto_sub -t 'vogonair/+/trace' -C 1 > trace.bin
+	tools/decode_trace.py trace.bin
+"""
+
+import os
+import re
+import struct
+import sys
+
+MAGIC = b"VT"
+VERSION = 1
+DUMP_HEADER = struct.Struct("<2sBBIH")
+RECORD_HEADER = struct.Struct("<BBHI")
+
+EVENTS_PATH = os.path.join(os.path.dirname(__file__), "..", "components", "trace", "include", "trace_events.h")
+EVENT_RE = re.compile(r'^TRACE_EVENT\((\w+),\s*"([^"]*)",\s*"((?:[^"\\]|\\.)*)"\)', re.MULTILINE)
+SPEC_RE = re.compile(r"%([0-9.\-]*)([diuxXf%])")
+
+
+def load_events(path):
+	with open(path) as f:
+		return [(tag, fmt.encode().decode("unicode_escape")) for _, tag, fmt in EVENT_RE.findall(f.read())]
+
+
+def format_record(fmt, args):
+	args = list(args)
+
+	def convert(match):
+		flags, conversion = match.groups()
+		if conversion == "%":
+			return "%"
+		if not args:
+			return "?"
+
+		raw = args.pop(0)
+		if conversion == "f":
+			return f"%{flags}f" % struct.unpack("<f", struct.pack("<I", raw))[0]
+		if conversion in "di":
+			return f"%{flags}d" % struct.unpack("<i", struct.pack("<I", raw))[0]
+		if conversion == "u":
+			return f"%{flags}d" % raw
+		return f"%{flags}{conversion}" % raw
+
+	return SPEC_RE.sub(convert, fmt)
+
+
+def decode(data, events):
+	if len(data) < DUMP_HEADER.size:
+		raise ValueError("truncated trace dump")
+
+	magic, version, _, overwritten, length = DUMP_HEADER.unpack_from(data)
+	if magic != MAGIC:
+		raise ValueError("not a Vogon trace dump")
+	if version != VERSION:
+		raise ValueError(f"unsupported trace version {version}")
+	if DUMP_HEADER.size + length != len(data):
+		raise ValueError("trace dump length mismatch")
+
+	records = []
+	pos = DUMP_HEADER.size
+	while pos < len(data):
+		event, count, wake, ms = RECORD_HEADER.unpack_from(data, pos)
+		pos += RECORD_HEADER.size
+
+		args = struct.unpack_from(f"<{count}I", data, pos)
+		pos += 4 * count
+
+		if event < len(events):
+			tag, fmt = events[event]
+			records.append((wake, ms, tag, format_record(fmt, args)))
+		else:
+			records.append((wake, ms, "?", f"unknown event {event} {list(args)}"))
+
+	return overwritten, records
+
+
+def main():
+	if len(sys.argv) > 1:
+		with open(sys.argv[1], "rb") as f:
+			data = f.read()
+	else:
+		data = sys.stdin.buffer.read()
+
+	overwritten, records = decode(data, load_events(EVENTS_PATH))
+
+	if overwritten:
+		print(f"# {overwritten} older records overwritten")
+
+	for wake, ms, tag, message in records:
+		print(f"wake {wake:5d} {ms:8d} ms [{tag}] {message}")
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,422 @@
+// Fleet load generator - runs the firmware's sync.c for N virtual nodes against a real broker
+//
+// Every virtual node is a process of its own: sync.c, the backlog and the backoff keep their state in
+// file-scope variables, just like in RTC memory on the device. A node wakes every interval (with random
+// phase and jitter), stores one reading and calls mqtt_sync() - connect, subscribe, publish QoS1,
+// wait for the PUBACKs and disconnect - exactly as the firmware does after a deep sleep wake.
+//
+//	cmake -S tools/loadgen -B build/loadgen && cmake --build build/loadgen
+//	mosquitto -p 1883 &
+//	build/loadgen/loadgen -n 500 -i 60 -j 5 -d 600
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <mosquitto.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backlog.h"
+#include "backoff.h"
+#include "esp_log.h"
+#include "shared.h"
+#include "shim.h"
+#include "sync.h"
+
+#define PROGRESS_INTERVAL_S 10
+#define DRAIN_S 2 // Late deliveries to the subscriber after the last node finished
+
+typedef struct {
+	const char *host;
+	int port;
+	int nodes;
+	int interval_s;
+	int jitter_s;
+	int duration_s;
+	int backlog;
+	unsigned int seed;
+} options_t;
+
+// Shared by the parent and all virtual nodes
+typedef struct {
+	shim_stats_t mqtt;
+	atomic_uint_fast64_t syncs;
+	atomic_uint_fast64_t sync_failures; // mqtt_sync() could not connect
+	atomic_uint_fast64_t undelivered;	// Connected, but not every message was acknowledged
+	atomic_uint_fast64_t skipped;		// Backoff skipped the upload
+	atomic_uint_fast64_t readings;
+} loadgen_stats_t;
+
+static loadgen_stats_t *stats;
+static atomic_uint_fast64_t received;	  // Seen by the subscriber of the parent, duplicates included
+static atomic_uint_fast64_t duplicates; // QoS1 redeliveries of a message already received
+
+static double now_s(void) {
+	return shim_now_us() / 1e6;
+}
+
+static void sleep_until(double deadline_s) {
+	double remaining = deadline_s - now_s();
+	if (remaining > 0)
+		usleep((useconds_t)(remaining * 1e6));
+}
+
+static double uniform(double low, double high) {
+	return low + (high - low) * (rand() / (double)RAND_MAX);
+}
+
+// ===== ===== ===== =====
+// Virtual node
+
+static void push_reading(void) {
+	const shared_data_t reading = {
+		.temperature = uniform(-10, 35),
+		.humidity = uniform(20, 95),
+		.pm25 = uniform(0, 80),
+		.pm10 = uniform(0, 120)};
+
+	backlog_push(&reading);
+	atomic_fetch_add(&stats->readings, 1);
+}
+
+static void run_node(int index, const options_t *options, int start_fd) {
+	mosquitto_lib_init();
+	srand(options->seed ^ (index * 2654435761u));
+
+	// Locally administered MAC - one topic tree per node
+	const uint8_t mac[6] = {0x02, 0x56, 0x47, index >> 16, index >> 8, index};
+	shim_set_mac(mac);
+
+	snprintf(shared_config.SYNC_MQTT_BROKER_URL, sizeof(shared_config.SYNC_MQTT_BROKER_URL),
+			 "mqtt://%s:%d", options->host, options->port);
+	shared_config.SENSORS_GENERAL_MEASUREMENT_INTERVAL = (options->interval_s + 59) / 60;
+
+	// Readings kept while offline - uploaded as blocks on the first sync
+	for (int i = 0; i < options->backlog; i++)
+		push_reading();
+
+	// Released by the parent once its subscriber is ready
+	char byte;
+	while (read(start_fd, &byte, 1) < 0 && errno == EINTR) {
+	}
+	close(start_fd);
+
+	double start = now_s();
+	double end = start + options->duration_s;
+	double wake = start + uniform(0, options->interval_s);
+
+	while (wake < end) {
+		sleep_until(wake + uniform(-options->jitter_s, options->jitter_s));
+		push_reading();
+
+		backoff_action_t action = backoff_next(&mqtt_backoff);
+		if (action == BACKOFF_SKIP) {
+			atomic_fetch_add(&stats->skipped, 1);
+			wake += options->interval_s;
+			continue;
+		}
+
+		// Same backoff as the firmware - expired messages don't count against a broker that answered
+		esp_err_t ret = mqtt_sync(action == BACKOFF_PROBE);
+		if (ret == ESP_OK) {
+			backoff_success(&mqtt_backoff);
+			atomic_fetch_add(&stats->syncs, 1);
+		} else if (ret == ESP_ERR_NOT_FINISHED) {
+			backoff_success(&mqtt_backoff);
+			atomic_fetch_add(&stats->undelivered, 1);
+		} else {
+			backoff_failure(&mqtt_backoff);
+			atomic_fetch_add(&stats->sync_failures, 1);
+		}
+
+		wake += options->interval_s;
+	}
+
+	mosquitto_lib_cleanup();
+	_exit(0);
+}
+
+// ===== ===== ===== =====
+// Subscriber - counts what actually reached the broker's subscribers
+
+static void on_subscriber_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message) {
+	(void)mosq;
+	(void)obj;
+	atomic_fetch_add(&received, 1);
+
+	uint64_t id = shim_message_id(message->topic, message->payload, message->payloadlen);
+	int previous = shim_message_mark(id, SHIM_MESSAGE_RECEIVED);
+	if (previous >= 0 && (previous & SHIM_MESSAGE_RECEIVED))
+		atomic_fetch_add(&duplicates, 1);
+}
+
+static void on_subscriber_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos) {
+	(void)mosq;
+	(void)mid;
+	(void)qos_count;
+	(void)granted_qos;
+	atomic_store((atomic_bool *)obj, true);
+}
+
+static struct mosquitto *start_subscriber(const options_t *options) {
+	static atomic_bool subscribed;
+
+	struct mosquitto *mosq = mosquitto_new(NULL, true, &subscribed);
+	if (mosq == NULL)
+		return NULL;
+
+	mosquitto_message_callback_set(mosq, on_subscriber_message);
+	mosquitto_subscribe_callback_set(mosq, on_subscriber_subscribe);
+
+	if (mosquitto_connect(mosq, options->host, options->port, 60) != MOSQ_ERR_SUCCESS ||
+		mosquitto_loop_start(mosq) != MOSQ_ERR_SUCCESS) {
+		mosquitto_destroy(mosq);
+		return NULL;
+	}
+
+	char *filters[] = SHIM_TRACKED_TOPICS;
+	mosquitto_subscribe_multiple(mosq, NULL, SHIM_TRACKED_TOPIC_COUNT, filters, 1, 0, NULL);
+
+	for (int i = 0; i < 100 && !atomic_load(&subscribed); i++)
+		usleep(50 * 1000);
+
+	return mosq;
+}
+
+// ===== ===== ===== =====
+// Report
+
+static uint64_t load(atomic_uint_fast64_t *counter) {
+	return atomic_load(counter);
+}
+
+static double percentile_ms(const uint64_t *histogram, uint64_t total, double percentile) {
+	uint64_t rank = (uint64_t)ceil(total * percentile / 100.0);
+	uint64_t seen = 0;
+
+	for (int bucket = 0; bucket < SHIM_LATENCY_BUCKETS; bucket++) {
+		seen += histogram[bucket];
+		if (seen >= rank && histogram[bucket] > 0)
+			return shim_latency_bucket_us(bucket + 1) / 1000.0; // Upper bound of the bucket
+	}
+
+	return NAN;
+}
+
+static void print_progress(double elapsed) {
+	printf("[%6.0fs] published=%llu acknowledged=%llu expired=%llu received=%llu syncs=%llu unconnected=%llu undelivered=%llu\n",
+		   elapsed,
+		   (unsigned long long)load(&stats->mqtt.published),
+		   (unsigned long long)load(&stats->mqtt.acknowledged),
+		   (unsigned long long)load(&stats->mqtt.expired),
+		   (unsigned long long)load(&received),
+		   (unsigned long long)load(&stats->syncs),
+		   (unsigned long long)load(&stats->sync_failures),
+		   (unsigned long long)load(&stats->undelivered));
+	fflush(stdout);
+}
+
+// Acknowledged message IDs the subscriber never saw
+static uint64_t count_lost(uint64_t *acknowledged) {
+	uint64_t lost = 0;
+	*acknowledged = 0;
+
+	for (size_t i = 0; i < shim_messages->capacity; i++) {
+		unsigned int state = atomic_load(&shim_messages->slots[i].state);
+		if (!(state & SHIM_MESSAGE_ACKNOWLEDGED))
+			continue;
+
+		(*acknowledged)++;
+		if (!(state & SHIM_MESSAGE_RECEIVED))
+			lost++;
+	}
+
+	return lost;
+}
+
+static void print_report(const options_t *options, double elapsed) {
+	uint64_t histogram[SHIM_LATENCY_BUCKETS];
+	uint64_t samples = 0;
+	for (int bucket = 0; bucket < SHIM_LATENCY_BUCKETS; bucket++) {
+		histogram[bucket] = load(&stats->mqtt.latency[bucket]);
+		samples += histogram[bucket];
+	}
+
+	uint64_t published = load(&stats->mqtt.published);
+	uint64_t acknowledged = load(&stats->mqtt.acknowledged);
+	uint64_t expired = load(&stats->mqtt.expired);
+	uint64_t delivered = load(&received);
+	uint64_t tracked;
+	uint64_t lost = count_lost(&tracked);
+
+	printf("\n");
+	printf("Nodes:          %d (interval %ds, jitter +-%ds, backlog %d)\n", options->nodes, options->interval_s, options->jitter_s, options->backlog);
+	printf("Duration:       %.1fs\n", elapsed);
+	printf("Syncs:          %llu ok, %llu failed to connect, %llu not fully acknowledged, %llu skipped by backoff\n",
+		   (unsigned long long)load(&stats->syncs), (unsigned long long)load(&stats->sync_failures),
+		   (unsigned long long)load(&stats->undelivered), (unsigned long long)load(&stats->skipped));
+	printf("Connections:    %llu, %llu dropped\n", (unsigned long long)load(&stats->mqtt.connects), (unsigned long long)load(&stats->mqtt.disconnects));
+	printf("Throughput:     %.1f msg/s published, %.1f msg/s acknowledged\n", published / elapsed, acknowledged / elapsed);
+	printf("PUBACK latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, p99.9 %.2f ms, max %.2f ms\n",
+		   percentile_ms(histogram, samples, 50), percentile_ms(histogram, samples, 90),
+		   percentile_ms(histogram, samples, 99), percentile_ms(histogram, samples, 99.9),
+		   percentile_ms(histogram, samples, 100));
+	printf("Messages:       %llu published, %llu acknowledged, %llu expired unacknowledged\n",
+		   (unsigned long long)published, (unsigned long long)acknowledged, (unsigned long long)expired);
+	printf("Loss:           %llu of %llu acknowledged messages not delivered to the subscriber (%.3f %%)\n",
+		   (unsigned long long)lost, (unsigned long long)tracked, tracked ? 100.0 * lost / tracked : 0.0);
+	printf("Subscriber:     %llu received, %llu of them duplicates\n", (unsigned long long)delivered, (unsigned long long)load(&duplicates));
+
+	uint64_t overflow = load(&shim_messages->overflow);
+	if (overflow > 0)
+		printf("                %llu messages not tracked - the message ID table was full\n", (unsigned long long)overflow);
+}
+
+// ===== ===== ===== =====
+
+static void usage(const char *name) {
+	fprintf(stderr,
+			"Usage: %s [-H host] [-p port] [-n nodes] [-i interval_s] [-j jitter_s] [-d duration_s] [-b backlog] [-s seed] [-v]\n",
+			name);
+	exit(2);
+}
+
+int main(int argc, char **argv) {
+	options_t options = {
+		.host = "localhost",
+		.port = 1883,
+		.nodes = 100,
+		.interval_s = 60,
+		.jitter_s = 5,
+		.duration_s = 300,
+		.backlog = 0,
+		.seed = (unsigned int)time(NULL)};
+
+	int opt;
+	while ((opt = getopt(argc, argv, "H:p:n:i:j:d:b:s:v")) != -1) {
+		switch (opt) {
+			case 'H':
+				options.host = optarg;
+				break;
+			case 'p':
+				options.port = atoi(optarg);
+				break;
+			case 'n':
+				options.nodes = atoi(optarg);
+				break;
+			case 'i':
+				options.interval_s = atoi(optarg);
+				break;
+			case 'j':
+				options.jitter_s = atoi(optarg);
+				break;
+			case 'd':
+				options.duration_s = atoi(optarg);
+				break;
+			case 'b':
+				options.backlog = atoi(optarg);
+				break;
+			case 's':
+				options.seed = strtoul(optarg, NULL, 0);
+				break;
+			case 'v':
+				shim_log_level++;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+
+	if (options.nodes <= 0 || options.nodes > 0xFFFFFF || options.interval_s <= 0 || options.jitter_s < 0 ||
+		options.duration_s <= 0 || options.backlog < 0 || options.backlog > CONFIG_BACKLOG_CAPACITY)
+		usage(argv[0]);
+
+	stats = mmap(NULL, sizeof(*stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stats == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	shim_stats = &stats->mqtt;
+
+	// Every message a node can publish in the run, at most half full
+	size_t messages = (size_t)options.nodes * (options.backlog + options.duration_s / options.interval_s + 2) * BACKLOG_COLUMN_COUNT;
+	size_t capacity = 1024;
+	while (capacity < 2 * messages)
+		capacity *= 2;
+
+	shim_messages = mmap(NULL, sizeof(*shim_messages) + capacity * sizeof(shim_message_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (shim_messages == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	shim_messages->capacity = capacity;
+
+	int start_pipe[2];
+	if (pipe(start_pipe) != 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	// Fork before any thread exists - the subscriber's network thread is started afterwards
+	for (int i = 0; i < options.nodes; i++) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			kill(0, SIGTERM);
+			return 1;
+		}
+
+		if (pid == 0) {
+			close(start_pipe[1]);
+			run_node(i, &options, start_pipe[0]);
+		}
+	}
+	close(start_pipe[0]);
+
+	mosquitto_lib_init();
+	struct mosquitto *subscriber = start_subscriber(&options);
+	if (subscriber == NULL) {
+		fprintf(stderr, "Cannot subscribe at %s:%d\n", options.host, options.port);
+		kill(0, SIGTERM);
+		return 1;
+	}
+
+	printf("Starting %d virtual nodes against %s:%d\n", options.nodes, options.host, options.port);
+
+	double start = now_s();
+	close(start_pipe[1]); // EOF releases every node at once
+
+	int running = options.nodes;
+	double next_progress = start + PROGRESS_INTERVAL_S;
+
+	while (running > 0) {
+		while (running > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+			running--;
+
+		if (now_s() >= next_progress) {
+			print_progress(now_s() - start);
+			next_progress += PROGRESS_INTERVAL_S;
+		}
+
+		usleep(100 * 1000);
+	}
+
+	double elapsed = now_s() - start;
+	sleep(DRAIN_S);
+
+	mosquitto_disconnect(subscriber);
+	mosquitto_loop_stop(subscriber, false);
+	mosquitto_destroy(subscriber);
+	mosquitto_lib_cleanup();
+
+	print_report(&options, elapsed);
+	return 0;
+}
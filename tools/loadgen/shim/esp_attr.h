@@ -0,0 +1,5 @@
+#pragma once
+
+// One process per virtual node - "RTC memory" is plain process memory
+#define RTC_DATA_ATTR
+#define IRAM_ATTR
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+
+// 0 = silent, 1 = errors, 2 = warnings, 3 = info - set with loadgen -v
+extern int shim_log_level;
+
+uint32_t esp_log_timestamp(void);
+
+#define SHIM_LOG(level, letter, tag, format, ...)                                                      \
+	do {                                                                                               \
+		if (shim_log_level >= (level))                                                                 \
+			fprintf(stderr, letter " (%u) %s: " format "\n", esp_log_timestamp(), tag, ##__VA_ARGS__); \
+	} while (0)
+
+#define ESP_LOGE(tag, format, ...) SHIM_LOG(1, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) SHIM_LOG(2, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) SHIM_LOG(3, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) SHIM_LOG(4, "D", tag, format, ##__VA_ARGS__)
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+
+typedef enum {
+	WIFI_AUTH_OPEN = 0,
+	WIFI_AUTH_WPA2_PSK = 3,
+	WIFI_AUTH_WPA2_ENTERPRISE = 5,
+} wifi_auth_mode_t;
+
+typedef enum {
+	WIFI_IF_STA,
+	WIFI_IF_AP,
+} wifi_interface_t;
+
+#define ESP_IF_WIFI_STA WIFI_IF_STA
+
+// The MAC of the virtual node running in this process
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]);
@@ -0,0 +1,61 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "diagnostics.h"
+#include "link.h"
+#include "shared.h"
+
+// Firmware components sync.c links against but the load generator does not exercise
+
+// Filled in per virtual node by loadgen.c
+shared_config_t shared_config;
+uint32_t shared_config_hash;
+SemaphoreHandle_t sync_mutex;
+
+// Remote configuration is received but never applied - the virtual nodes keep their configuration
+uint32_t config_hash(const char *json_string) {
+	(void)json_string;
+	return 0;
+}
+
+esp_err_t shared_config_parse(const char *json_string, shared_config_t *config) {
+	(void)json_string;
+	(void)config;
+	return ESP_FAIL;
+}
+
+esp_err_t shared_config_store(const char *json_string) {
+	(void)json_string;
+	return ESP_FAIL;
+}
+
+// No telemetry - heap and stack figures of the host mean nothing
+void diag_begin_cycle() {}
+void diag_capture_phase(diag_phase_t phase) { (void)phase; }
+
+bool diag_upload_due() {
+	return false;
+}
+
+size_t diag_serialize(const char *address, char *buffer, size_t capacity) {
+	(void)address;
+	(void)buffer;
+	(void)capacity;
+	return 0;
+}
+
+void diag_reset() {}
+
+// Virtual nodes are Wi-Fi nodes - no ESP-NOW leaves to relay
+size_t link_relay_count() {
+	return 0;
+}
+
+const link_relay_t *link_relay_peek(size_t index) {
+	(void)index;
+	return NULL;
+}
+
+void link_relay_drop(size_t count) {
+	(void)count;
+}
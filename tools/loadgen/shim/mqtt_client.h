@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+// The subset of the esp-mqtt client API used by sync.c, implemented on libmosquitto in shim.c
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef enum {
+	MQTT_EVENT_ANY = -1,
+	MQTT_EVENT_ERROR = 0,
+	MQTT_EVENT_CONNECTED,
+	MQTT_EVENT_DISCONNECTED,
+	MQTT_EVENT_SUBSCRIBED,
+	MQTT_EVENT_UNSUBSCRIBED,
+	MQTT_EVENT_PUBLISHED,
+	MQTT_EVENT_DATA,
+	MQTT_EVENT_BEFORE_CONNECT,
+	MQTT_EVENT_DELETED,
+} esp_mqtt_event_id_t;
+
+typedef struct {
+	esp_mqtt_event_id_t event_id;
+	esp_mqtt_client_handle_t client;
+	char *data;
+	int data_len;
+	int total_data_len;
+	int current_data_offset;
+	char *topic;
+	int topic_len;
+	int msg_id;
+	int qos;
+	bool retain;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+typedef struct {
+	const char *filter;
+	int qos;
+} esp_mqtt_topic_t;
+
+typedef struct {
+	struct {
+		struct {
+			const char *uri;
+		} address;
+	} broker;
+	struct {
+		int size;
+	} buffer;
+	struct {
+		int timeout_ms;
+	} network;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t *topic_list, int size);
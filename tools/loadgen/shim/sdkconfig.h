@@ -0,0 +1,16 @@
+#pragma once
+
+// Kconfig defaults of the components compiled into the load generator
+
+#define CONFIG_VOGON_BAKED_CONFIG 0
+#define CONFIG_BACKLOG_CAPACITY 144
+#define CONFIG_BACKOFF_MAX_SKIPPED_CYCLES 16
+#define CONFIG_ROLLUP_HOURS 24
+#define CONFIG_ROLLUP_DAYS 7
+#define CONFIG_SENSORS_RING_SLOTS 64
+#define CONFIG_STREAM_WINDOW_SAMPLES 64
+#define CONFIG_SYNC_BLOCK_MAX_READINGS 48
+#define CONFIG_SYNC_MQTT_PROBE_TIMEOUT_MS 5000
+#define CONFIG_SYNC_WIFI_MAX_NETWORKS 4
+#define CONFIG_TRACE_RING_SIZE 1024
+#define CONFIG_TRACE_CONSOLE 0
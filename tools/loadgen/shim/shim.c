@@ -0,0 +1,601 @@
+#include <errno.h>
+#include <mosquitto.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mqtt_client.h"
+
+#include "shim.h"
+
+// Host implementations of the ESP-IDF, FreeRTOS and esp-mqtt calls made by the firmware components
+
+static const char *TAG = "MODULE[shim]";
+
+#define SHIM_MAX_INFLIGHT 64
+#define SHIM_REAPER_INTERVAL_MS 100
+#define SHIM_KEEPALIVE_S 120
+
+int shim_log_level = 0;
+shim_stats_t *shim_stats;
+shim_messages_t *shim_messages;
+
+static uint8_t node_mac[6];
+
+// ===== ===== ===== =====
+// Time
+
+static uint64_t monotonic_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+static uint64_t boot_us;
+
+uint64_t shim_now_us(void) {
+	if (boot_us == 0)
+		boot_us = monotonic_us();
+
+	return monotonic_us() - boot_us;
+}
+
+uint32_t esp_log_timestamp(void) {
+	return shim_now_us() / 1000;
+}
+
+static void deadline_after(struct timespec *deadline, TickType_t ticks) {
+	clock_gettime(CLOCK_REALTIME, deadline);
+	deadline->tv_sec += ticks / 1000;
+	deadline->tv_nsec += (long)(ticks % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+TickType_t xTaskGetTickCount(void) {
+	return shim_now_us() / 1000;
+}
+
+void vTaskDelay(TickType_t ticks) {
+	usleep((useconds_t)ticks * 1000);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period) {
+	*previous_wake += period;
+
+	int32_t remaining = (int32_t)(*previous_wake - xTaskGetTickCount());
+	if (remaining > 0)
+		vTaskDelay(remaining);
+}
+
+// ===== ===== ===== =====
+// Event groups and counting semaphores
+
+struct shim_event_group {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+	EventGroupHandle_t group = calloc(1, sizeof(*group));
+	pthread_mutex_init(&group->lock, NULL);
+	pthread_cond_init(&group->changed, NULL);
+	return group;
+}
+
+// The pthread objects don't fit the FreeRTOS buffers - the host doesn't care where they live
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t *buffer) {
+	(void)buffer;
+	return xEventGroupCreate();
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+	pthread_mutex_lock(&group->lock);
+	group->bits |= bits;
+	EventBits_t result = group->bits;
+	pthread_cond_broadcast(&group->changed);
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+	pthread_mutex_lock(&group->lock);
+	EventBits_t result = group->bits;
+	group->bits &= ~bits;
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+	pthread_mutex_lock(&group->lock);
+	EventBits_t result = group->bits;
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+static bool bits_satisfied(EventBits_t current, EventBits_t bits, BaseType_t wait_for_all) {
+	return wait_for_all ? (current & bits) == bits : (current & bits) != 0;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks) {
+	struct timespec deadline;
+	deadline_after(&deadline, ticks);
+
+	pthread_mutex_lock(&group->lock);
+
+	int ret = 0;
+	while (!bits_satisfied(group->bits, bits, wait_for_all) && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&group->changed, &group->lock, &deadline);
+
+	EventBits_t result = group->bits;
+	if (clear_on_exit && bits_satisfied(result, bits, wait_for_all))
+		group->bits &= ~bits;
+
+	pthread_mutex_unlock(&group->lock);
+	return result;
+}
+
+struct shim_semaphore {
+	pthread_mutex_t lock;
+	pthread_cond_t given;
+	UBaseType_t count;
+	UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+	SemaphoreHandle_t semaphore = calloc(1, sizeof(*semaphore));
+	pthread_mutex_init(&semaphore->lock, NULL);
+	pthread_cond_init(&semaphore->given, NULL);
+	semaphore->count = initial;
+	semaphore->max = max;
+	return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCountingStatic(UBaseType_t max, UBaseType_t initial, StaticSemaphore_t *buffer) {
+	(void)buffer;
+	return xSemaphoreCreateCounting(max, initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks) {
+	struct timespec deadline;
+	deadline_after(&deadline, ticks);
+
+	pthread_mutex_lock(&semaphore->lock);
+
+	int ret = 0;
+	while (semaphore->count == 0 && ret != ETIMEDOUT)
+		ret = pthread_cond_timedwait(&semaphore->given, &semaphore->lock, &deadline);
+
+	BaseType_t taken = semaphore->count > 0;
+	if (taken)
+		semaphore->count--;
+
+	pthread_mutex_unlock(&semaphore->lock);
+	return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore) {
+	pthread_mutex_lock(&semaphore->lock);
+
+	BaseType_t given = semaphore->count < semaphore->max;
+	if (given) {
+		semaphore->count++;
+		pthread_cond_signal(&semaphore->given);
+	}
+
+	pthread_mutex_unlock(&semaphore->lock);
+	return given ? pdTRUE : pdFALSE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t semaphore) {
+	pthread_mutex_lock(&semaphore->lock);
+	UBaseType_t count = semaphore->count;
+	pthread_mutex_unlock(&semaphore->lock);
+	return count;
+}
+
+// ===== ===== ===== =====
+// ESP-IDF
+
+const char *esp_err_to_name(esp_err_t code) {
+	switch (code) {
+		case ESP_OK:
+			return "ESP_OK";
+		case ESP_FAIL:
+			return "ESP_FAIL";
+		case ESP_ERR_NO_MEM:
+			return "ESP_ERR_NO_MEM";
+		case ESP_ERR_INVALID_ARG:
+			return "ESP_ERR_INVALID_ARG";
+		case ESP_ERR_TIMEOUT:
+			return "ESP_ERR_TIMEOUT";
+		case ESP_ERR_NOT_FINISHED:
+			return "ESP_ERR_NOT_FINISHED";
+		default:
+			return "ESP_ERR";
+	}
+}
+
+void shim_set_mac(const uint8_t mac[6]) {
+	memcpy(node_mac, mac, sizeof(node_mac));
+}
+
+esp_err_t esp_wifi_get_mac(wifi_interface_t ifx, uint8_t mac[6]) {
+	(void)ifx;
+	memcpy(mac, node_mac, sizeof(node_mac));
+	return ESP_OK;
+}
+
+// ===== ===== ===== =====
+// PUBACK latency histogram
+
+int shim_latency_bucket(uint64_t us) {
+	if (us < SHIM_LATENCY_SUB_BUCKETS)
+		return us;
+
+	int exponent = 63 - __builtin_clzll(us);
+	int mantissa = (us >> (exponent - 4)) & (SHIM_LATENCY_SUB_BUCKETS - 1);
+	int bucket = SHIM_LATENCY_SUB_BUCKETS * (exponent - 3) + mantissa;
+
+	return bucket < SHIM_LATENCY_BUCKETS ? bucket : SHIM_LATENCY_BUCKETS - 1;
+}
+
+// Lower bound of the bucket
+uint64_t shim_latency_bucket_us(int bucket) {
+	if (bucket < SHIM_LATENCY_SUB_BUCKETS)
+		return bucket;
+
+	int exponent = bucket / SHIM_LATENCY_SUB_BUCKETS + 3;
+	int mantissa = bucket % SHIM_LATENCY_SUB_BUCKETS;
+
+	return (uint64_t)(SHIM_LATENCY_SUB_BUCKETS + mantissa) << (exponent - 4);
+}
+
+// ===== ===== ===== =====
+// Message IDs
+
+// FNV-1a over the topic, a separator and the payload
+uint64_t shim_message_id(const char *topic, const void *payload, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (const char *c = topic; *c; c++)
+		hash = (hash ^ (uint8_t)*c) * 0x100000001b3ull;
+
+	hash = (hash ^ 0xFF) * 0x100000001b3ull;
+	for (size_t i = 0; i < len; i++)
+		hash = (hash ^ ((const uint8_t *)payload)[i]) * 0x100000001b3ull;
+
+	return hash ? hash : 1;
+}
+
+int shim_message_mark(uint64_t id, unsigned int flag) {
+	size_t mask = shim_messages->capacity - 1;
+
+	for (size_t probe = 0; probe < shim_messages->capacity; probe++) {
+		shim_message_t *slot = &shim_messages->slots[(id + probe) & mask];
+
+		uint_fast64_t current = atomic_load(&slot->id);
+		if (current == 0 && atomic_compare_exchange_strong(&slot->id, &current, id))
+			current = id;
+
+		if (current == id)
+			return atomic_fetch_or(&slot->state, flag);
+	}
+
+	atomic_fetch_add(&shim_messages->overflow, 1);
+	return -1;
+}
+
+// ===== ===== ===== =====
+// esp-mqtt on libmosquitto - events are dispatched from the mosquitto network thread like from the esp-mqtt task
+
+typedef struct {
+	int msg_id;
+	uint64_t sent_us;
+	uint64_t id; // shim_message_id(), 0 if the subscriber doesn't listen to the topic
+} inflight_t;
+
+struct esp_mqtt_client {
+	struct mosquitto *mosq;
+	char host[128];
+	int port;
+
+	esp_event_handler_t handler;
+	void *handler_arg;
+
+	// Outbox - QoS1 messages waiting for their PUBACK
+	pthread_mutex_t lock;
+	inflight_t inflight[SHIM_MAX_INFLIGHT];
+	int inflight_count;
+
+	pthread_t reaper;
+	volatile bool running;
+};
+
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t *event) {
+	event->client = client;
+	if (client->handler)
+		client->handler(client->handler_arg, "MQTT_EVENTS", event->event_id, event);
+}
+
+static void dispatch_simple(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id) {
+	esp_mqtt_event_t event = {.event_id = id, .msg_id = msg_id};
+	dispatch(client, &event);
+}
+
+// Removes msg_id from the outbox, false if it was not waiting
+static bool inflight_take(esp_mqtt_client_handle_t client, int msg_id, inflight_t *taken) {
+	bool found = false;
+
+	pthread_mutex_lock(&client->lock);
+	for (int i = 0; i < client->inflight_count; i++) {
+		if (client->inflight[i].msg_id == msg_id) {
+			*taken = client->inflight[i];
+			client->inflight[i] = client->inflight[--client->inflight_count];
+			found = true;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&client->lock);
+
+	return found;
+}
+
+static void on_connect(struct mosquitto *mosq, void *obj, int rc) {
+	(void)mosq;
+	esp_mqtt_client_handle_t client = obj;
+
+	if (rc != 0) {
+		ESP_LOGW(TAG, "Connection refused: %s", mosquitto_connack_string(rc));
+		dispatch_simple(client, MQTT_EVENT_ERROR, 0);
+		return;
+	}
+
+	atomic_fetch_add(&shim_stats->connects, 1);
+	dispatch_simple(client, MQTT_EVENT_CONNECTED, 0);
+}
+
+static void on_disconnect(struct mosquitto *mosq, void *obj, int rc) {
+	(void)mosq;
+	esp_mqtt_client_handle_t client = obj;
+
+	// rc is 0 only for the disconnect requested by esp_mqtt_client_stop()
+	if (rc != 0)
+		atomic_fetch_add(&shim_stats->disconnects, 1);
+	dispatch_simple(client, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void on_publish(struct mosquitto *mosq, void *obj, int mid) {
+	(void)mosq;
+	esp_mqtt_client_handle_t client = obj;
+
+	// A PUBACK arriving after the message expired from the outbox is ignored, like in esp-mqtt
+	inflight_t message;
+	if (!inflight_take(client, mid, &message))
+		return;
+
+	if (message.id != 0)
+		shim_message_mark(message.id, SHIM_MESSAGE_ACKNOWLEDGED);
+
+	atomic_fetch_add(&shim_stats->acknowledged, 1);
+	atomic_fetch_add(&shim_stats->latency[shim_latency_bucket(shim_now_us() - message.sent_us)], 1);
+	dispatch_simple(client, MQTT_EVENT_PUBLISHED, mid);
+}
+
+static void on_subscribe(struct mosquitto *mosq, void *obj, int mid, int qos_count, const int *granted_qos) {
+	(void)mosq;
+	(void)qos_count;
+	(void)granted_qos;
+	dispatch_simple(obj, MQTT_EVENT_SUBSCRIBED, mid);
+}
+
+static void on_message(struct mosquitto *mosq, void *obj, const struct mosquitto_message *message) {
+	(void)mosq;
+
+	esp_mqtt_event_t event = {
+		.event_id = MQTT_EVENT_DATA,
+		.msg_id = message->mid,
+		.topic = message->topic,
+		.topic_len = strlen(message->topic),
+		.data = message->payload,
+		.data_len = message->payloadlen,
+		.total_data_len = message->payloadlen,
+		.qos = message->qos,
+		.retain = message->retain};
+
+	dispatch(obj, &event);
+}
+
+// Expires outbox messages the broker never acknowledged, reported as MQTT_EVENT_DELETED
+static void *reaper_task(void *arg) {
+	esp_mqtt_client_handle_t client = arg;
+
+	while (client->running) {
+		vTaskDelay(pdMS_TO_TICKS(SHIM_REAPER_INTERVAL_MS));
+
+		int expired[SHIM_MAX_INFLIGHT];
+		int expired_count = 0;
+		uint64_t now = shim_now_us();
+
+		pthread_mutex_lock(&client->lock);
+		for (int i = 0; i < client->inflight_count;) {
+			if (now - client->inflight[i].sent_us >= (uint64_t)SHIM_OUTBOX_EXPIRED_MS * 1000) {
+				expired[expired_count++] = client->inflight[i].msg_id;
+				client->inflight[i] = client->inflight[--client->inflight_count];
+			} else {
+				i++;
+			}
+		}
+		pthread_mutex_unlock(&client->lock);
+
+		for (int i = 0; i < expired_count; i++) {
+			atomic_fetch_add(&shim_stats->expired, 1);
+			dispatch_simple(client, MQTT_EVENT_DELETED, expired[i]);
+		}
+	}
+
+	return NULL;
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config) {
+	esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+	if (client == NULL)
+		return NULL;
+
+	// mqtt://host[:port]
+	const char *uri = config->broker.address.uri;
+	const char *host = strstr(uri, "://") ? strstr(uri, "://") + 3 : uri;
+	const char *colon = strchr(host, ':');
+	size_t host_len = colon ? (size_t)(colon - host) : strlen(host);
+	if (host_len >= sizeof(client->host))
+		host_len = sizeof(client->host) - 1;
+
+	memcpy(client->host, host, host_len);
+	client->port = colon ? atoi(colon + 1) : 1883;
+
+	pthread_mutex_init(&client->lock, NULL);
+
+	// Clean session with a random client ID, like esp-mqtt defaults
+	client->mosq = mosquitto_new(NULL, true, client);
+	if (client->mosq == NULL) {
+		free(client);
+		return NULL;
+	}
+
+	mosquitto_connect_callback_set(client->mosq, on_connect);
+	mosquitto_disconnect_callback_set(client->mosq, on_disconnect);
+	mosquitto_publish_callback_set(client->mosq, on_publish);
+	mosquitto_subscribe_callback_set(client->mosq, on_subscribe);
+	mosquitto_message_callback_set(client->mosq, on_message);
+	mosquitto_int_option(client->mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+	mosquitto_reconnect_delay_set(client->mosq, 1, 10, false);
+
+	return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg) {
+	(void)event;
+	client->handler = event_handler;
+	client->handler_arg = event_handler_arg;
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client) {
+	int rc = mosquitto_connect_async(client->mosq, client->host, client->port, SHIM_KEEPALIVE_S);
+	if (rc != MOSQ_ERR_SUCCESS && rc != MOSQ_ERR_ERRNO) {
+		ESP_LOGE(TAG, "Connect to %s:%d failed: %s", client->host, client->port, mosquitto_strerror(rc));
+		return ESP_FAIL;
+	}
+
+	// The network thread retries a failed connection, like the esp-mqtt task
+	if (mosquitto_loop_start(client->mosq) != MOSQ_ERR_SUCCESS)
+		return ESP_FAIL;
+
+	client->running = true;
+	if (pthread_create(&client->reaper, NULL, reaper_task, client) != 0) {
+		client->running = false;
+		return ESP_FAIL;
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client) {
+	if (!client->running)
+		return ESP_FAIL;
+
+	client->running = false;
+	pthread_join(client->reaper, NULL);
+
+	mosquitto_disconnect(client->mosq);
+	mosquitto_loop_stop(client->mosq, false);
+	return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client) {
+	if (client->running)
+		esp_mqtt_client_stop(client);
+
+	mosquitto_destroy(client->mosq);
+	pthread_mutex_destroy(&client->lock);
+	free(client);
+	return ESP_OK;
+}
+
+static bool tracked_topic(const char *topic) {
+	static const char *filters[] = SHIM_TRACKED_TOPICS;
+
+	for (int i = 0; i < SHIM_TRACKED_TOPIC_COUNT; i++) {
+		bool matches = false;
+		if (mosquitto_topic_matches_sub(filters[i], topic, &matches) == MOSQ_ERR_SUCCESS && matches)
+			return true;
+	}
+
+	return false;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain) {
+	if (len == 0 && data != NULL)
+		len = strlen(data);
+
+	int msg_id = 0;
+	uint64_t id = shim_messages && tracked_topic(topic) ? shim_message_id(topic, data, len) : 0;
+
+	// Held across the send - the PUBACK callback must find the message in the outbox
+	pthread_mutex_lock(&client->lock);
+
+	if (qos > 0 && client->inflight_count == SHIM_MAX_INFLIGHT) {
+		pthread_mutex_unlock(&client->lock);
+		ESP_LOGE(TAG, "Outbox full");
+		atomic_fetch_add(&shim_stats->expired, 1);
+		dispatch_simple(client, MQTT_EVENT_DELETED, 0);
+		return -1;
+	}
+
+	int rc = mosquitto_publish(client->mosq, &msg_id, topic, len, data, qos, retain);
+
+	// Not connected - libmosquitto keeps QoS>0 messages queued like the esp-mqtt outbox
+	bool queued = rc == MOSQ_ERR_SUCCESS || (rc == MOSQ_ERR_NO_CONN && qos > 0);
+	if (queued && qos > 0)
+		client->inflight[client->inflight_count++] = (inflight_t){.msg_id = msg_id, .sent_us = shim_now_us(), .id = id};
+
+	pthread_mutex_unlock(&client->lock);
+
+	// Reported as dropped from the outbox - sync.c waits for an event for every QoS1 message
+	if (!queued) {
+		ESP_LOGE(TAG, "Publish to %s failed: %s", topic, mosquitto_strerror(rc));
+		atomic_fetch_add(&shim_stats->expired, 1);
+		if (qos > 0)
+			dispatch_simple(client, MQTT_EVENT_DELETED, 0);
+		return -1;
+	}
+
+	atomic_fetch_add(&shim_stats->published, 1);
+	return msg_id;
+}
+
+int esp_mqtt_client_subscribe_multiple(esp_mqtt_client_handle_t client, const esp_mqtt_topic_t *topic_list, int size) {
+	if (size <= 0 || size > 8)
+		return -1;
+
+	// One SUBSCRIBE for all filters - libmosquitto takes a single QoS for the whole list
+	char *filters[8];
+	for (int i = 0; i < size; i++)
+		filters[i] = (char *)topic_list[i].filter;
+
+	int msg_id = 0;
+	int rc = mosquitto_subscribe_multiple(client->mosq, &msg_id, size, filters, topic_list[0].qos, 0, NULL);
+
+	return rc == MOSQ_ERR_SUCCESS ? msg_id : -1;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// PUBACK latency histogram - 16 linear sub-buckets per power of two microseconds (~6 % resolution)
+#define SHIM_LATENCY_SUB_BUCKETS 16
+#define SHIM_LATENCY_BUCKETS (SHIM_LATENCY_SUB_BUCKETS * 28)
+
+// Fleet-wide counters - lives in memory shared by all virtual node processes
+typedef struct {
+	atomic_uint_fast64_t published;	   // Handed to the client
+	atomic_uint_fast64_t acknowledged; // PUBACK received
+	atomic_uint_fast64_t expired;	   // Dropped from the outbox without a PUBACK
+	atomic_uint_fast64_t connects;
+	atomic_uint_fast64_t disconnects;  // Dropped by the broker or the network
+	atomic_uint_fast64_t latency[SHIM_LATENCY_BUCKETS];
+} shim_stats_t;
+
+extern shim_stats_t *shim_stats;
+
+// Topics the subscriber of the load generator listens to - only these are matched by message ID
+#define SHIM_TRACKED_TOPICS {"vogonair/+/raw", "vogonair/+/block", "vogonair/+/rollup"}
+#define SHIM_TRACKED_TOPIC_COUNT 3
+
+#define SHIM_MESSAGE_ACKNOWLEDGED 1
+#define SHIM_MESSAGE_RECEIVED 2
+
+// Message IDs seen fleet-wide - open addressing over a hash of topic and payload, so the MAC, the
+// timestamp and the parameter identify a message, and a QoS1 redelivery lands on the same slot
+typedef struct {
+	atomic_uint_fast64_t id; // 0: free
+	atomic_uint state;		 // SHIM_MESSAGE_ flags
+} shim_message_t;
+
+typedef struct {
+	size_t capacity;			   // Power of two
+	atomic_uint_fast64_t overflow; // IDs not recorded - the table was full
+	shim_message_t slots[];
+} shim_messages_t;
+
+extern shim_messages_t *shim_messages;
+
+// Outbox expiry of esp-mqtt (OUTBOX_EXPIRED_TIMEOUT_MS)
+#define SHIM_OUTBOX_EXPIRED_MS 30000
+
+void shim_set_mac(const uint8_t mac[6]);
+uint64_t shim_now_us(void);
+int shim_latency_bucket(uint64_t us);
+uint64_t shim_latency_bucket_us(int bucket);
+uint64_t shim_message_id(const char *topic, const void *payload, size_t len);
+// Flags the message, returns its flags from before or -1 if the table is full
+int shim_message_mark(uint64_t id, unsigned int flag);
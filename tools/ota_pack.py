@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Builds OTA update artifacts and the manifest consumed by components/ota.
+
+Produces a zlib compressed image and, when a base image is given and detools
+is installed (pip install detools), a heatshrink compressed delta against the
+base. The smallest artifact is written to the manifest. Sizes of all variants
+are printed to compare download bytes against the plain full image.
+
+	tools/ota_pack.py build/vogon-sensor.bin --base old/vogon-sensor.bin \\
+		--url http://192.168.1.10:8000/ --out ota/
+	python3 -m http.server -d ota/ 8000
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import zlib
+
+# esp_app_desc_t follows the image header (24 bytes) and first segment header (8 bytes)
+APP_DESC_OFFSET = 32
+APP_DESC_MAGIC = 0xABCD5432
+
+
+def app_version(image):
+	desc = image[APP_DESC_OFFSET:APP_DESC_OFFSET + 48]
+	if int.from_bytes(desc[0:4], "little") != APP_DESC_MAGIC:
+		raise ValueError("not an ESP-IDF application image")
+
+	return desc[16:48].split(b"\0", 1)[0].decode()
+
+
+def main():
+	parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+	parser.add_argument("image", help="new application image")
+	parser.add_argument("--base", help="image currently running on the fleet, enables delta updates")
+	parser.add_argument("--url", required=True, help="base URL the artifacts are served from")
+	parser.add_argument("--out", default=".", help="output directory")
+	args = parser.parse_args()
+
+	with open(args.image, "rb") as f:
+		image = f.read()
+
+	name = os.path.basename(args.image)
+	artifacts = {"raw": (name, image)}
+	artifacts["zlib"] = (name + ".zlib", zlib.compress(image, 9))
+
+	base_sha256 = None
+	if args.base:
+		import detools
+		import io
+
+		with open(args.base, "rb") as f:
+			base = f.read()
+
+		patch = io.BytesIO()
+		detools.create_patch(io.BytesIO(base), io.BytesIO(image), patch, compression="heatshrink")
+		artifacts["delta"] = (name + ".delta", patch.getvalue())
+
+		# esp_partition_get_sha256() returns the SHA-256 appended to app images (hash_appended flag)
+		base_sha256 = base[-32:].hex() if base[23] == 1 else hashlib.sha256(base).hexdigest()
+
+	os.makedirs(args.out, exist_ok=True)
+	for fmt, (filename, data) in artifacts.items():
+		with open(os.path.join(args.out, filename), "wb") as f:
+			f.write(data)
+
+		print(f"{fmt:>5}: {len(data):>8} bytes ({100 * len(data) / len(image):5.1f}% of full image)")
+
+	fmt, (filename, data) = min(artifacts.items(), key=lambda item: len(item[1][1]))
+	manifest = {
+		"version": app_version(image),
+		"url": args.url.rstrip("/") + "/" + filename,
+		"format": fmt,
+		"size": len(data),
+		"sha256": hashlib.sha256(data).hexdigest(),
+	}
+
+	if fmt == "delta":
+		manifest["base_sha256"] = base_sha256
+
+	with open(os.path.join(args.out, "manifest.json"), "w") as f:
+		json.dump(manifest, f, indent=4)
+
+	print(f"manifest.json: {fmt} update to {manifest['version']}")
+
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stdio.h>
+
+// Minimal assertions for the host tests - every failure is printed, the exit status tells CTest
+static int check_failures = 0;
+
+#define CHECK(condition)                                                                   \
+	do {                                                                                   \
+		if (!(condition)) {                                                                \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+			check_failures++;                                                              \
+		}                                                                                  \
+	} while (0)
+
+#define CHECK_RESULT() (check_failures == 0 ? 0 : 1)
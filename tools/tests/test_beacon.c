@@ -0,0 +1,157 @@
+// Beacon advertisement checks through beacon_decode - with --vectors, prints them for test_decode_beacon.py instead
+//
+// One vector per line: {"name": ..., "adv": hex, "company_id": n, "expected": null or [sequence, temperature, humidity, pm25, pm10]}
+// with temperature and humidity in hundredths and null for a missing parameter
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "beacon_protocol.h"
+#include "check.h"
+
+#define COMPANY_ID 0xFFFF
+#define OTHER_COMPANY_ID 0x02E5
+
+static bool print_vectors = false;
+
+static void emit_value(long value, bool missing) {
+	if (missing)
+		printf(", null");
+	else
+		printf(", %ld", value);
+}
+
+static void emit(const char *name, const uint8_t *adv, size_t len, uint16_t company_id, const beacon_reading_t *expected) {
+	if (!print_vectors)
+		return;
+
+	printf("{\"name\": \"%s\", \"adv\": \"", name);
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", adv[i]);
+
+	printf("\", \"company_id\": %u, \"expected\": ", company_id);
+	if (expected == NULL) {
+		printf("null}\n");
+		return;
+	}
+
+	printf("[%u", expected->sequence);
+	emit_value(lroundf(expected->temperature * 100), isnan(expected->temperature));
+	emit_value(lroundf(expected->humidity * 100), isnan(expected->humidity));
+	emit_value(expected->pm25, expected->pm25 == BEACON_VALUE_MISSING);
+	emit_value(expected->pm10, expected->pm10 == BEACON_VALUE_MISSING);
+	printf("]}\n");
+}
+
+static bool same_value(float decoded, float expected) {
+	return isnan(expected) ? isnan(decoded) : fabsf(decoded - expected) < 0.005f;
+}
+
+static void round_trip(const char *name, const beacon_reading_t *reading, const beacon_reading_t *expected) {
+	uint8_t adv[BEACON_ADV_MAX_LEN];
+	size_t len = beacon_encode(reading, COMPANY_ID, adv, sizeof(adv));
+	CHECK(len == BEACON_ADV_LEN);
+
+	beacon_reading_t decoded;
+	CHECK(beacon_decode(adv, len, COMPANY_ID, &decoded));
+	CHECK(decoded.sequence == expected->sequence);
+	CHECK(same_value(decoded.temperature, expected->temperature));
+	CHECK(same_value(decoded.humidity, expected->humidity));
+	CHECK(decoded.pm25 == expected->pm25);
+	CHECK(decoded.pm10 == expected->pm10);
+
+	emit(name, adv, len, COMPANY_ID, expected);
+}
+
+static void readings() {
+	beacon_reading_t reading = {.sequence = 513, .temperature = 21.37f, .humidity = 48.5f, .pm25 = 12, .pm10 = 20};
+	round_trip("reading", &reading, &reading);
+
+	beacon_reading_t negative = {.sequence = 65535, .temperature = -12.05f, .humidity = 0, .pm25 = 0, .pm10 = 0};
+	round_trip("negative_temperature", &negative, &negative);
+
+	beacon_reading_t missing = {.sequence = 7, .temperature = NAN, .humidity = NAN, .pm25 = 31, .pm10 = BEACON_VALUE_MISSING};
+	round_trip("missing_parameters", &missing, &missing);
+
+	// Out of range values are saturated, not wrapped
+	beacon_reading_t out_of_range = {.sequence = 1, .temperature = 400, .humidity = 101, .pm25 = 1, .pm10 = 2};
+	beacon_reading_t saturated = {.sequence = 1, .temperature = 327.67f, .humidity = 100, .pm25 = 1, .pm10 = 2};
+	round_trip("saturated", &out_of_range, &saturated);
+}
+
+// A collector sees the beacon among the advertisements of other devices - and of other companies
+static void other_advertisers() {
+	beacon_reading_t reading = {.sequence = 42, .temperature = 19.5f, .humidity = 60, .pm25 = 5, .pm10 = 9};
+
+	uint8_t adv[BEACON_ADV_MAX_LEN];
+	size_t len = beacon_encode(&reading, OTHER_COMPANY_ID, adv, sizeof(adv));
+	CHECK(len == BEACON_ADV_LEN);
+
+	beacon_reading_t decoded;
+	CHECK(!beacon_decode(adv, len, COMPANY_ID, &decoded));
+	emit("wrong_company_id", adv, len, COMPANY_ID, NULL);
+
+	// Complete local name ahead of the beacon's own structures
+	uint8_t named[BEACON_ADV_MAX_LEN];
+	static const uint8_t name[] = {5, 0x09, 'V', 'o', 'g', 'n'};
+	memcpy(named, name, sizeof(name));
+	len = beacon_encode(&reading, COMPANY_ID, named + sizeof(name), sizeof(named) - sizeof(name));
+	CHECK(len == BEACON_ADV_LEN);
+
+	CHECK(beacon_decode(named, sizeof(name) + len, COMPANY_ID, &decoded));
+	CHECK(decoded.sequence == 42 && decoded.pm10 == 9);
+	emit("after_local_name", named, sizeof(name) + len, COMPANY_ID, &reading);
+
+	// Wrong magic - same company, another product
+	beacon_encode(&reading, COMPANY_ID, adv, sizeof(adv));
+	adv[7] = 'X';
+	CHECK(!beacon_decode(adv, BEACON_ADV_LEN, COMPANY_ID, &decoded));
+	emit("wrong_magic", adv, BEACON_ADV_LEN, COMPANY_ID, NULL);
+}
+
+static void truncated() {
+	beacon_reading_t reading = {.sequence = 3, .temperature = 20, .humidity = 50, .pm25 = 4, .pm10 = 6};
+
+	uint8_t adv[BEACON_ADV_MAX_LEN];
+	size_t len = beacon_encode(&reading, COMPANY_ID, adv, sizeof(adv));
+	CHECK(beacon_encode(&reading, COMPANY_ID, adv, BEACON_ADV_LEN - 1) == 0);
+
+	// Cut short in the air - the length of the manufacturer structure overruns the packet
+	beacon_reading_t decoded;
+	char name[32];
+	for (size_t cut = 0; cut < len; cut++) {
+		CHECK(!beacon_decode(adv, cut, COMPANY_ID, &decoded));
+
+		snprintf(name, sizeof(name), "cut_%zu", cut);
+		emit(name, adv, cut, COMPANY_ID, NULL);
+	}
+
+	// Well formed, but the manufacturer data is shorter than the payload
+	for (size_t missing = 1; missing <= BEACON_MANUFACTURER_LEN - 2; missing++) {
+		uint8_t short_adv[BEACON_ADV_MAX_LEN];
+		memcpy(short_adv, adv, len - missing);
+		short_adv[3] -= missing;
+
+		CHECK(!beacon_decode(short_adv, len - missing, COMPANY_ID, &decoded));
+
+		snprintf(name, sizeof(name), "short_payload_%zu", missing);
+		emit(name, short_adv, len - missing, COMPANY_ID, NULL);
+	}
+
+	// A zero length structure ends the walk
+	uint8_t zero[] = {0, 0xFF};
+	CHECK(!beacon_decode(zero, sizeof(zero), COMPANY_ID, &decoded));
+	emit("zero_length", zero, sizeof(zero), COMPANY_ID, NULL);
+}
+
+int main(int argc, char **argv) {
+	print_vectors = argc > 1 && strcmp(argv[1], "--vectors") == 0;
+
+	readings();
+	other_advertisers();
+	truncated();
+
+	return CHECK_RESULT();
+}
@@ -0,0 +1,273 @@
+// Block encoder checks - with --vectors, prints the test blocks for test_decode_block.py instead
+//
+// One vector per line: {"name": ..., "block": hex, "readings": [[sensor, parameter, scale, timestamp, raw], ...]}
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "backlog.h"
+#include "block.h"
+#include "check.h"
+
+#define MAX_EXPECTED 512
+#define WORST_CASE_SAMPLES 48
+
+static const uint8_t device_id[BLOCK_DEVICE_ID_LEN] = {0x24, 0x6F, 0x28, 0xAB, 0xCD, 0xEF};
+
+typedef struct {
+	uint16_t sensor;
+	uint8_t parameter;
+	uint8_t scale;
+	uint32_t timestamp;
+	int32_t raw;
+} expected_t;
+
+typedef struct {
+	const char *name;
+	uint8_t buffer[BLOCK_HEADER_MAX_LEN + BACKLOG_COLUMN_COUNT * BLOCK_COLUMN_MAX_LEN(CONFIG_SYNC_BLOCK_MAX_READINGS)];
+	size_t length;
+	expected_t expected[MAX_EXPECTED];
+	size_t count;
+} vector_t;
+
+static bool print_vectors = false;
+
+static void expect(vector_t *vector, uint16_t sensor, uint8_t parameter, uint8_t scale, uint32_t timestamp, int32_t raw) {
+	vector->expected[vector->count++] = (expected_t){sensor, parameter, scale, timestamp, raw};
+}
+
+static void emit(const vector_t *vector) {
+	if (!print_vectors)
+		return;
+
+	printf("{\"name\": \"%s\", \"block\": \"", vector->name);
+	for (size_t i = 0; i < vector->length; i++)
+		printf("%02x", vector->buffer[i]);
+
+	printf("\", \"readings\": [");
+	for (size_t i = 0; i < vector->count; i++) {
+		const expected_t *e = &vector->expected[i];
+		printf("%s[%u, %u, %u, %lu, %ld]", i > 0 ? ", " : "", e->sensor, e->parameter, e->scale, (unsigned long)e->timestamp, (long)e->raw);
+	}
+
+	printf("]}\n");
+}
+
+// Temperatures falling below zero and a clock stepped back - every delta of this block is negative at some point
+static void negative_deltas() {
+	static vector_t vector = {.name = "negative_deltas"};
+	static const uint32_t timestamps[] = {1000, 1600, 1300, 1900, 100};
+	static const int32_t temperatures[] = {53, 12, -7, -120, -3276};
+
+	block_encoder_t encoder;
+	block_encoder_init(&encoder, vector.buffer, sizeof(vector.buffer), device_id, 1);
+	block_encoder_begin_column(&encoder, 0x01, 0x01, 1, 5);
+
+	for (int i = 0; i < 5; i++) {
+		block_encoder_append(&encoder, timestamps[i], temperatures[i]);
+		expect(&vector, 0x01, 0x01, 1, timestamps[i], temperatures[i]);
+	}
+
+	vector.length = block_encoder_finish(&encoder);
+	CHECK(vector.length > 0);
+	emit(&vector);
+}
+
+// Readings from the backlog where sensors were not due - missing parameters shorten their column, one column stays empty
+static void missing_values() {
+	static vector_t vector = {.name = "missing_values"};
+
+	backlog_drop(backlog_count());
+	for (int i = 0; i < 6; i++) {
+		shared_data_t data = {
+			.temperature = i % 2 == 0 ? 20.0f - i * 1.5f : NAN,
+			.humidity = i % 3 == 0 ? 55.5f + i : NAN,
+			.pm25 = i == 4 ? 17 : READING_PM_MISSING,
+			.pm10 = READING_PM_MISSING};
+
+		backlog_push(&data);
+	}
+
+	vector.length = backlog_encode(device_id, 0, backlog_count(), vector.buffer, sizeof(vector.buffer));
+	CHECK(vector.length > 0);
+
+	for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++) {
+		const backlog_column_t *column = &backlog_columns[c];
+
+		for (size_t i = 0; i < backlog_count(); i++) {
+			const backlog_entry_t *entry = backlog_peek(i);
+			int32_t value = column->value(&entry->data);
+
+			if (value != BACKLOG_MISSING)
+				expect(&vector, column->sensor, column->parameter, column->scale, entry->timestamp, value);
+		}
+	}
+
+	CHECK(vector.count == 3 + 2 + 1);
+	emit(&vector);
+	backlog_drop(backlog_count());
+}
+
+// A full upload chunk - every parameter of CONFIG_SYNC_BLOCK_MAX_READINGS readings in the buffer sync.c sizes for it
+static void maximum_readings() {
+	static vector_t vector = {.name = "maximum_readings"};
+
+	backlog_drop(backlog_count());
+	for (int i = 0; i < CONFIG_SYNC_BLOCK_MAX_READINGS; i++) {
+		shared_data_t data = {
+			.temperature = i % 2 == 0 ? -40.0f : 80.0f,
+			.humidity = i % 2 == 0 ? 0.0f : 100.0f,
+			.pm25 = i % 2 == 0 ? 0 : 999,
+			.pm10 = i % 2 == 0 ? 0 : UINT16_MAX - 1};
+
+		backlog_push(&data);
+	}
+
+	vector.length = backlog_encode(device_id, 0, backlog_count(), vector.buffer, sizeof(vector.buffer));
+	CHECK(vector.length > 0);
+
+	for (size_t c = 0; c < BACKLOG_COLUMN_COUNT; c++)
+		for (size_t i = 0; i < backlog_count(); i++) {
+			const backlog_entry_t *entry = backlog_peek(i);
+			expect(&vector, backlog_columns[c].sensor, backlog_columns[c].parameter, backlog_columns[c].scale, entry->timestamp, backlog_columns[c].value(&entry->data));
+		}
+
+	CHECK(vector.count == BACKLOG_COLUMN_COUNT * CONFIG_SYNC_BLOCK_MAX_READINGS);
+	emit(&vector);
+	backlog_drop(backlog_count());
+}
+
+// Largest header and column the format allows - every varint at its longest, so the size macros must hold
+static void worst_case() {
+	static vector_t vector = {.name = "worst_case"};
+	static uint8_t buffer[BLOCK_HEADER_MAX_LEN + BLOCK_COLUMN_MAX_LEN(WORST_CASE_SAMPLES)];
+
+	block_encoder_t encoder;
+	block_encoder_init(&encoder, buffer, sizeof(buffer), device_id, 1);
+	block_encoder_begin_column(&encoder, UINT16_MAX, UINT8_MAX, 3, WORST_CASE_SAMPLES);
+
+	for (int i = 0; i < WORST_CASE_SAMPLES; i++) {
+		uint32_t timestamp = i % 2 == 0 ? 0 : 0x80000000u;
+		int32_t value = i % 2 == 0 ? -1000000000 : 1000000000;
+
+		block_encoder_append(&encoder, timestamp, value);
+		expect(&vector, UINT16_MAX, UINT8_MAX, 3, timestamp, value);
+	}
+
+	size_t length = block_encoder_finish(&encoder);
+	CHECK(length > 0);
+	CHECK(length <= sizeof(buffer));
+
+	// The same block in a buffer one byte short must be refused, not truncated
+	block_encoder_t short_encoder;
+	block_encoder_init(&short_encoder, buffer, length - 1, device_id, 1);
+	block_encoder_begin_column(&short_encoder, UINT16_MAX, UINT8_MAX, 3, WORST_CASE_SAMPLES);
+	for (size_t i = 0; i < vector.count; i++)
+		block_encoder_append(&short_encoder, vector.expected[i].timestamp, vector.expected[i].raw);
+	CHECK(block_encoder_finish(&short_encoder) == 0);
+
+	// Re-encoded, as the short attempt wrote over the buffer
+	block_encoder_init(&encoder, vector.buffer, sizeof(vector.buffer), device_id, 1);
+	block_encoder_begin_column(&encoder, UINT16_MAX, UINT8_MAX, 3, WORST_CASE_SAMPLES);
+	for (size_t i = 0; i < vector.count; i++)
+		block_encoder_append(&encoder, vector.expected[i].timestamp, vector.expected[i].raw);
+
+	vector.length = block_encoder_finish(&encoder);
+	CHECK(vector.length == length);
+	emit(&vector);
+}
+
+// Leaf readings stamped with the time since boot, moved onto the gateway's clock - the same block as if encoded with the shifted times
+static void restamped() {
+	static vector_t vector = {.name = "restamped"};
+	static const uint32_t timestamps[] = {5, 605, 1205, 1805};
+	static const int32_t values[] = {215, 214, -3, 0};
+	const int32_t offset = 1760000000 - 1805;
+
+	uint8_t block[BLOCK_HEADER_MAX_LEN + 3 * BLOCK_COLUMN_MAX_LEN(4)];
+	uint8_t shifted[sizeof(block)];
+	block_encoder_t encoder;
+	block_encoder_t shifted_encoder;
+
+	block_encoder_init(&encoder, block, sizeof(block), device_id, 3);
+	block_encoder_init(&shifted_encoder, shifted, sizeof(shifted), device_id, 3);
+
+	// Both parameters of a sensor, and one not due this time
+	for (uint8_t parameter = 1; parameter <= 2; parameter++) {
+		block_encoder_begin_column(&encoder, 0x01, parameter, 1, 4);
+		block_encoder_begin_column(&shifted_encoder, 0x01, parameter, 1, 4);
+
+		for (int i = 0; i < 4; i++) {
+			block_encoder_append(&encoder, timestamps[i], values[i] * parameter);
+			block_encoder_append(&shifted_encoder, timestamps[i] + offset, values[i] * parameter);
+			expect(&vector, 0x01, parameter, 1, timestamps[i] + offset, values[i] * parameter);
+		}
+	}
+
+	block_encoder_begin_column(&encoder, 0x02, 0x01, 0, 0);
+	block_encoder_begin_column(&shifted_encoder, 0x02, 0x01, 0, 0);
+
+	size_t length = block_encoder_finish(&encoder);
+	size_t shifted_length = block_encoder_finish(&shifted_encoder);
+	CHECK(length > 0 && shifted_length > 0);
+	CHECK(shifted_length <= length + BLOCK_RESTAMP_MAX_GROWTH(3));
+
+	vector.length = block_restamp(block, length, offset, vector.buffer, sizeof(vector.buffer));
+	CHECK(vector.length == shifted_length);
+	CHECK(memcmp(vector.buffer, shifted, shifted_length) == 0);
+	emit(&vector);
+
+	// And back - a negative offset
+	uint8_t restored[sizeof(block)];
+	CHECK(block_restamp(vector.buffer, vector.length, -offset, restored, sizeof(restored)) == length);
+	CHECK(memcmp(restored, block, length) == 0);
+
+	// Too small a buffer, a cut block and trailing bytes are refused
+	CHECK(block_restamp(block, length, offset, restored, shifted_length - 1) == 0);
+	for (size_t cut = 0; cut < length; cut++)
+		CHECK(block_restamp(block, cut, offset, restored, sizeof(restored)) == 0);
+
+	block[length] = 0;
+	CHECK(block_restamp(block, length + 1, offset, restored, sizeof(restored)) == 0);
+
+	block[0] = 'X';
+	CHECK(block_restamp(block, length, offset, restored, sizeof(restored)) == 0);
+}
+
+// Column counts that don't match the appended samples make the whole block invalid
+static void incomplete_columns() {
+	uint8_t buffer[64];
+	block_encoder_t encoder;
+
+	block_encoder_init(&encoder, buffer, sizeof(buffer), device_id, 1);
+	block_encoder_begin_column(&encoder, 1, 1, 1, 2);
+	block_encoder_append(&encoder, 1, 1);
+	CHECK(block_encoder_finish(&encoder) == 0);
+
+	block_encoder_init(&encoder, buffer, sizeof(buffer), device_id, 2);
+	block_encoder_begin_column(&encoder, 1, 1, 1, 2);
+	block_encoder_append(&encoder, 1, 1);
+	block_encoder_begin_column(&encoder, 1, 2, 1, 0);
+	CHECK(block_encoder_finish(&encoder) == 0);
+
+	block_encoder_init(&encoder, buffer, sizeof(buffer), device_id, 1);
+	block_encoder_begin_column(&encoder, 1, 1, 1, 1);
+	block_encoder_append(&encoder, 1, 1);
+	block_encoder_append(&encoder, 2, 2);
+	CHECK(block_encoder_finish(&encoder) == 0);
+}
+
+int main(int argc, char **argv) {
+	print_vectors = argc > 1 && strcmp(argv[1], "--vectors") == 0;
+
+	negative_deltas();
+	missing_values();
+	maximum_readings();
+	worst_case();
+	restamped();
+	incomplete_columns();
+
+	return CHECK_RESULT();
+}
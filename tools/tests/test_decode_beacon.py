@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Advertisements encoded by the firmware through tools/decode_beacon.py.
+
+	test_decode_beacon.py build/tests/test_beacon
+"""
+
+import json
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import decode_beacon  # noqa: E402
+
+
+def expected_values(expected):
+	if expected is None:
+		return None
+
+	sequence, temperature, humidity, pm25, pm10 = expected
+	values = {}
+
+	if temperature is not None:
+		values["temperature"] = temperature / 100
+	if humidity is not None:
+		values["humidity"] = humidity / 100
+	if pm25 is not None:
+		values["pm25"] = pm25
+	if pm10 is not None:
+		values["pm10"] = pm10
+
+	return sequence, values
+
+
+def main():
+	output = subprocess.run([sys.argv[1], "--vectors"], check=True, capture_output=True, text=True).stdout
+	vectors = [json.loads(line) for line in output.splitlines()]
+
+	if not vectors:
+		sys.exit("no vectors")
+
+	failed = []
+	for vector in vectors:
+		decoded = decode_beacon.decode(bytes.fromhex(vector["adv"]), vector["company_id"])
+		expected = expected_values(vector["expected"])
+
+		if decoded != expected:
+			print(f"{vector['name']}: decoded {decoded}, expected {expected}")
+			failed.append(vector["name"])
+
+	if failed:
+		sys.exit(f"failed: {', '.join(failed)}")
+
+	print(f"{len(vectors)} advertisements decoded")
+
+
+if __name__ == "__main__":
+	main()
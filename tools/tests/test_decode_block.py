@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Round trip of the blocks encoded by the firmware through tools/decode_block.py.
+
+	test_decode_block.py build/tests/test_block
+"""
+
+import json
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import decode_block  # noqa: E402
+
+ADDRESS = "24:6F:28:AB:CD:EF"
+
+
+def check_vector(vector):
+	readings = decode_block.decode(bytes.fromhex(vector["block"]))
+	expected = [
+		{
+			"address": ADDRESS,
+			"sensor": sensor,
+			"parameter": parameter,
+			"value": raw / 10**scale,
+			"timestamp": timestamp,
+		}
+		for sensor, parameter, scale, timestamp, raw in vector["readings"]
+	]
+
+	if readings != expected:
+		print(f"{vector['name']}: decoded {readings}, expected {expected}")
+		return False
+
+	# Any cut of the block is an error, never a shorter list of readings
+	data = bytes.fromhex(vector["block"])
+	for length in range(len(data)):
+		try:
+			decode_block.decode(data[:length])
+		except ValueError:
+			continue
+
+		print(f"{vector['name']}: block cut to {length} bytes decoded without an error")
+		return False
+
+	return True
+
+
+def main():
+	output = subprocess.run([sys.argv[1], "--vectors"], check=True, capture_output=True, text=True).stdout
+	vectors = [json.loads(line) for line in output.splitlines()]
+
+	if not vectors:
+		sys.exit("no vectors")
+
+	failed = [vector["name"] for vector in vectors if not check_vector(vector)]
+	if failed:
+		sys.exit(f"failed: {', '.join(failed)}")
+
+	print(f"{len(vectors)} blocks decoded")
+
+
+if __name__ == "__main__":
+	main()
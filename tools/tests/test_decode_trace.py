@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""Trace ring dumps of the firmware through tools/decode_trace.py.
+
+	test_decode_trace.py build/tests/test_trace
+"""
+
+import json
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.join(os.path.dirname(__file__), ".."))
+
+import decode_trace  # noqa: E402
+
+
+def check_vector(vector, events):
+	data = bytes.fromhex(vector["dump"])
+	overwritten, records = decode_trace.decode(data, events)
+	expected = [tuple(record) for record in vector["records"]]
+
+	if overwritten != vector["overwritten"]:
+		print(f"{vector['name']}: {overwritten} records overwritten, expected {vector['overwritten']}")
+		return False
+
+	if records != expected:
+		print(f"{vector['name']}: decoded {records}, expected {expected}")
+		return False
+
+	# A cut dump must be refused, never decoded into fewer records
+	for length in range(len(data)):
+		try:
+			decode_trace.decode(data[:length], events)
+		except ValueError:
+			continue
+
+		print(f"{vector['name']}: dump cut to {length} bytes decoded without an error")
+		return False
+
+	return True
+
+
+def main():
+	output = subprocess.run([sys.argv[1], "--vectors"], check=True, capture_output=True, text=True).stdout
+	vectors = [json.loads(line) for line in output.splitlines()]
+
+	if not vectors:
+		sys.exit("no vectors")
+
+	events = decode_trace.load_events(decode_trace.EVENTS_PATH)
+	failed = [vector["name"] for vector in vectors if not check_vector(vector, events)]
+	if failed:
+		sys.exit(f"failed: {', '.join(failed)}")
+
+	print(f"{len(vectors)} dumps decoded")
+
+
+if __name__ == "__main__":
+	main()
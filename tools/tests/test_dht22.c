@@ -0,0 +1,112 @@
+// DHT22 pulse decoder against captured and constructed traces of high pulse durations (us)
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "sensors.h"
+
+#define TRACE_LEN (2 + DHT22_BITS)
+
+// RMT capture as used by the benchmark: a glitch and the 80 us response, then 65.2 % and 35.1 C
+static const uint16_t recorded[TRACE_LEN] = {
+	31, 81,
+	27, 28, 26, 27, 28, 27, 69, 28, 70, 28, 26, 27, 71, 70, 26, 28,
+	27, 28, 26, 27, 28, 27, 26, 71, 27, 71, 26, 70, 71, 70, 69, 71,
+	70, 71, 69, 27, 71, 70, 69, 28};
+
+// Response handshake and 40 bits of `data`, with the few microseconds of jitter a capture shows
+static void build_trace(const uint8_t data[5], uint16_t trace[TRACE_LEN]) {
+	static const uint8_t jitter[] = {0, 1, 2, 1, 0, 2};
+
+	trace[0] = 30;
+	trace[1] = 80;
+
+	for (int i = 0; i < DHT22_BITS; i++) {
+		bool one = (data[i / 8] >> (7 - i % 8)) & 1;
+		trace[2 + i] = (one ? 69 : 26) + jitter[i % sizeof(jitter)];
+	}
+}
+
+static bool near(float value, float expected) {
+	return fabsf(value - expected) < 0.01f;
+}
+
+static void good_frame() {
+	float temperature = 0, humidity = 0;
+
+	CHECK(dht22_decode(recorded, TRACE_LEN, &temperature, &humidity) == ESP_OK);
+	CHECK(near(temperature, 35.1f));
+	CHECK(near(humidity, 65.2f));
+
+	// Handshake already dropped by the capture - the data bits alone decode the same
+	temperature = humidity = 0;
+	CHECK(dht22_decode(recorded + 2, DHT22_BITS, &temperature, &humidity) == ESP_OK);
+	CHECK(near(temperature, 35.1f));
+	CHECK(near(humidity, 65.2f));
+}
+
+static void checksum_failure() {
+	uint16_t trace[TRACE_LEN];
+	memcpy(trace, recorded, sizeof(trace));
+	trace[2 + 20] = 70; // A 0 bit of the temperature read as 1
+
+	float temperature = -1, humidity = -1;
+	CHECK(dht22_decode(trace, TRACE_LEN, &temperature, &humidity) == ESP_ERR_INVALID_CRC);
+	CHECK(temperature == -1 && humidity == -1);
+}
+
+static void missing_edge() {
+	float temperature = -1, humidity = -1;
+
+	// The falling edge after bit 10 was lost - its high, the 50 us low and the next high read as one pulse
+	uint16_t merged[TRACE_LEN - 1];
+	memcpy(merged, recorded, 12 * sizeof(uint16_t));
+	merged[12] = recorded[12] + 50 + recorded[13];
+	memcpy(merged + 13, recorded + 14, (TRACE_LEN - 14) * sizeof(uint16_t));
+	CHECK(dht22_decode(merged, TRACE_LEN - 1, &temperature, &humidity) == ESP_ERR_INVALID_RESPONSE);
+
+	// The last edge never came - without the handshake only 39 bits are left
+	CHECK(dht22_decode(recorded + 2, DHT22_BITS - 1, &temperature, &humidity) == ESP_ERR_INVALID_SIZE);
+
+	// A glitch shorter than any bit
+	uint16_t glitch[TRACE_LEN];
+	memcpy(glitch, recorded, sizeof(glitch));
+	glitch[30] = 4;
+	CHECK(dht22_decode(glitch, TRACE_LEN, &temperature, &humidity) == ESP_ERR_INVALID_RESPONSE);
+
+	CHECK(temperature == -1 && humidity == -1);
+}
+
+static void negative_temperature() {
+	// 48.3 %, -10.1 C - sign in the top bit of the temperature, not two's complement
+	uint8_t data[5] = {483 >> 8, 483 & 0xFF, 0x80 | (101 >> 8), 101 & 0xFF, 0};
+	data[4] = data[0] + data[1] + data[2] + data[3];
+
+	uint16_t trace[TRACE_LEN];
+	build_trace(data, trace);
+
+	float temperature = 0, humidity = 0;
+	CHECK(dht22_decode(trace, TRACE_LEN, &temperature, &humidity) == ESP_OK);
+	CHECK(near(temperature, -10.1f));
+	CHECK(near(humidity, 48.3f));
+
+	// Below -25.5 C the magnitude spills into the high byte
+	uint8_t cold[5] = {0x01, 0x00, 0x80 | (400 >> 8), 400 & 0xFF, 0};
+	cold[4] = cold[0] + cold[1] + cold[2] + cold[3];
+	build_trace(cold, trace);
+
+	CHECK(dht22_decode(trace, TRACE_LEN, &temperature, &humidity) == ESP_OK);
+	CHECK(near(temperature, -40.0f));
+	CHECK(near(humidity, 25.6f));
+}
+
+int main() {
+	good_frame();
+	checksum_failure();
+	missing_edge();
+	negative_temperature();
+
+	return CHECK_RESULT();
+}
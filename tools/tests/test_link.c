@@ -0,0 +1,250 @@
+// Leaf -> gateway protocol over a simulated link - frames and ACKs are lost on purpose
+//
+// The transport delivers a leaf frame to the gateway's link_receive() synchronously and queues the ACK
+// for the leaf's next receive(). A timeout is an empty queue, so the tests run without waiting.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "check.h"
+#include "link_protocol.h"
+
+#define ATTEMPTS 3
+#define ACK_TIMEOUT_MS 50
+#define RELAY_SLOTS 2
+#define MAX_PEERS 2
+#define QUEUE_LEN 4
+
+typedef struct {
+	uint8_t data[LINK_MAX_FRAME_LEN];
+	size_t len;
+} frame_t;
+
+// Gateway side - relay slots emptied by its MQTT sync, like link_relay_drop()
+typedef struct {
+	link_receiver_t receiver;
+	link_peer_t peers[MAX_PEERS];
+	frame_t slots[RELAY_SLOTS];
+	size_t used;
+	size_t delivered; // Payloads taken over the whole test
+} gateway_t;
+
+typedef struct {
+	gateway_t *gateway;
+	uint8_t address[LINK_ADDRESS_LEN];
+
+	// Bit n set: the n-th frame (counted from 0) in that direction is lost
+	uint32_t drop_data;
+	uint32_t drop_ack;
+	size_t data_sent;
+	size_t acks_sent;
+
+	frame_t queue[QUEUE_LEN]; // Frames on their way to the leaf
+	size_t queued;
+} link_sim_t;
+
+static bool relay_push(void *ctx, const uint8_t address[LINK_ADDRESS_LEN], const uint8_t *payload, size_t len) {
+	gateway_t *gateway = ctx;
+	if (gateway->used == RELAY_SLOTS)
+		return false;
+
+	memcpy(gateway->slots[gateway->used].data, payload, len);
+	gateway->slots[gateway->used].len = len;
+	gateway->used++;
+	gateway->delivered++;
+	return true;
+}
+
+static void gateway_init(gateway_t *gateway) {
+	memset(gateway, 0, sizeof(*gateway));
+	link_receiver_init(&gateway->receiver, gateway->peers, MAX_PEERS);
+}
+
+static void queue_to_leaf(link_sim_t *sim, const uint8_t *frame, size_t len) {
+	if (sim->queued == QUEUE_LEN)
+		return;
+
+	memcpy(sim->queue[sim->queued].data, frame, len);
+	sim->queue[sim->queued].len = len;
+	sim->queued++;
+}
+
+static bool sim_send(void *ctx, const uint8_t *frame, size_t len) {
+	link_sim_t *sim = ctx;
+
+	if (sim->drop_data & (1u << sim->data_sent++))
+		return true; // Sent, but never arrived
+
+	uint8_t ack[LINK_HEADER_LEN];
+	link_rx_status_t status = link_receive(&sim->gateway->receiver, sim->address, frame, len, relay_push, sim->gateway, ack);
+
+	if ((status == LINK_RX_NEW || status == LINK_RX_DUPLICATE) && !(sim->drop_ack & (1u << sim->acks_sent++)))
+		queue_to_leaf(sim, ack, LINK_HEADER_LEN);
+
+	return true;
+}
+
+static size_t sim_receive(void *ctx, uint8_t *frame, size_t capacity, uint32_t timeout_ms) {
+	link_sim_t *sim = ctx;
+	if (sim->queued == 0)
+		return 0;
+
+	size_t len = sim->queue[0].len < capacity ? sim->queue[0].len : capacity;
+	memcpy(frame, sim->queue[0].data, len);
+
+	sim->queued--;
+	memmove(sim->queue, sim->queue + 1, sim->queued * sizeof(frame_t));
+	return len;
+}
+
+static void sim_init(link_sim_t *sim, gateway_t *gateway, uint8_t leaf) {
+	memset(sim, 0, sizeof(*sim));
+	sim->gateway = gateway;
+	memcpy(sim->address, (uint8_t[LINK_ADDRESS_LEN]){0x24, 0x6F, 0x28, 0, 0, leaf}, LINK_ADDRESS_LEN);
+}
+
+static link_result_t send_payload(link_sim_t *sim, uint16_t seq, const char *payload) {
+	link_transport_t transport = {.send = sim_send, .receive = sim_receive, .ctx = sim};
+	return link_send(&transport, seq, (const uint8_t *)payload, strlen(payload), ATTEMPTS, ACK_TIMEOUT_MS);
+}
+
+static void clean_link() {
+	gateway_t gateway;
+	link_sim_t leaf;
+	gateway_init(&gateway);
+	sim_init(&leaf, &gateway, 1);
+
+	CHECK(send_payload(&leaf, 1, "block 1") == LINK_DELIVERED);
+	CHECK(leaf.data_sent == 1);
+	CHECK(gateway.delivered == 1);
+	CHECK(gateway.slots[0].len == 7 && memcmp(gateway.slots[0].data, "block 1", 7) == 0);
+}
+
+// The gateway took the frame but its ACK was lost - the retransmit is acknowledged, not forwarded again
+static void lost_ack() {
+	gateway_t gateway;
+	link_sim_t leaf;
+	gateway_init(&gateway);
+	sim_init(&leaf, &gateway, 1);
+	leaf.drop_ack = 1u << 0;
+
+	CHECK(send_payload(&leaf, 7, "block 7") == LINK_DELIVERED);
+	CHECK(leaf.data_sent == 2);
+	CHECK(gateway.delivered == 1);
+
+	// The next block has a new sequence and is forwarded as usual
+	CHECK(send_payload(&leaf, 8, "block 8") == LINK_DELIVERED);
+	CHECK(gateway.delivered == 2);
+}
+
+static void lost_data() {
+	gateway_t gateway;
+	link_sim_t leaf;
+	gateway_init(&gateway);
+	sim_init(&leaf, &gateway, 1);
+	leaf.drop_data = 1u << 0 | 1u << 1;
+
+	CHECK(send_payload(&leaf, 3, "block 3") == LINK_DELIVERED);
+	CHECK(leaf.data_sent == 3);
+	CHECK(gateway.delivered == 1);
+}
+
+// Every ACK lost - the leaf gives up and keeps its readings, the gateway still forwards the block only once
+static void no_ack() {
+	gateway_t gateway;
+	link_sim_t leaf;
+	gateway_init(&gateway);
+	sim_init(&leaf, &gateway, 1);
+	leaf.drop_ack = UINT32_MAX;
+
+	CHECK(send_payload(&leaf, 5, "block 5") == LINK_NO_ACK);
+	CHECK(leaf.data_sent == ATTEMPTS);
+	CHECK(gateway.delivered == 1);
+
+	// Next wake retries the same frame - still a duplicate
+	leaf.drop_ack = 0;
+	CHECK(send_payload(&leaf, 5, "block 5") == LINK_DELIVERED);
+	CHECK(gateway.delivered == 1);
+}
+
+// An ACK of an earlier frame arriving late must not confirm the current one
+static void late_ack() {
+	gateway_t gateway;
+	link_sim_t leaf;
+	gateway_init(&gateway);
+	sim_init(&leaf, &gateway, 1);
+
+	uint8_t stale[LINK_HEADER_LEN];
+	link_frame_encode(stale, LINK_FRAME_ACK, 10, NULL, 0);
+	queue_to_leaf(&leaf, stale, sizeof(stale));
+	leaf.drop_ack = 1u << 0;
+
+	CHECK(send_payload(&leaf, 11, "block 11") == LINK_DELIVERED);
+	CHECK(leaf.data_sent == 2);
+	CHECK(gateway.delivered == 1);
+}
+
+// Relay slots full - no ACK, so the leaf keeps the block and it is forwarded once the gateway has synced
+static void relay_overflow() {
+	gateway_t gateway;
+	link_sim_t first, second;
+	gateway_init(&gateway);
+	sim_init(&first, &gateway, 1);
+	sim_init(&second, &gateway, 2);
+
+	CHECK(send_payload(&first, 1, "leaf 1 block 1") == LINK_DELIVERED);
+	CHECK(send_payload(&first, 2, "leaf 1 block 2") == LINK_DELIVERED);
+	CHECK(gateway.used == RELAY_SLOTS);
+
+	CHECK(send_payload(&second, 1, "leaf 2 block 1") == LINK_NO_ACK);
+	CHECK(second.data_sent == ATTEMPTS);
+	CHECK(gateway.delivered == 2);
+
+	uint8_t frame[LINK_MAX_FRAME_LEN];
+	uint8_t ack[LINK_HEADER_LEN];
+	size_t len = link_frame_encode(frame, LINK_FRAME_DATA, 1, (const uint8_t *)"x", 1);
+	CHECK(link_receive(&gateway.receiver, second.address, frame, len, relay_push, &gateway, ack) == LINK_RX_REJECTED);
+
+	// Gateway sync drained the slots - the rejected block was never accepted, so it is new, not a duplicate
+	gateway.used = 0;
+	CHECK(send_payload(&second, 1, "leaf 2 block 1") == LINK_DELIVERED);
+	CHECK(gateway.delivered == 3);
+	CHECK(memcmp(gateway.slots[0].data, "leaf 2 block 1", 14) == 0);
+}
+
+static void invalid_frames() {
+	gateway_t gateway;
+	gateway_init(&gateway);
+
+	static const uint8_t address[LINK_ADDRESS_LEN] = {1, 2, 3, 4, 5, 6};
+	uint8_t frame[LINK_MAX_FRAME_LEN + 1] = {0};
+	uint8_t ack[LINK_HEADER_LEN];
+
+	size_t len = link_frame_encode(frame, LINK_FRAME_DATA, 1, (const uint8_t *)"ok", 2);
+	frame[0] = 'X';
+	CHECK(link_receive(&gateway.receiver, address, frame, len, relay_push, &gateway, ack) == LINK_RX_INVALID);
+
+	len = link_frame_encode(frame, LINK_FRAME_ACK, 1, NULL, 0);
+	CHECK(link_receive(&gateway.receiver, address, frame, len, relay_push, &gateway, ack) == LINK_RX_INVALID);
+	CHECK(link_receive(&gateway.receiver, address, frame, LINK_HEADER_LEN - 1, relay_push, &gateway, ack) == LINK_RX_INVALID);
+	CHECK(gateway.delivered == 0);
+
+	static uint8_t large[LINK_MAX_PAYLOAD_LEN + 1];
+	link_sim_t leaf;
+	sim_init(&leaf, &gateway, 1);
+	link_transport_t transport = {.send = sim_send, .receive = sim_receive, .ctx = &leaf};
+	CHECK(link_send(&transport, 1, large, sizeof(large), ATTEMPTS, ACK_TIMEOUT_MS) == LINK_TOO_LARGE);
+	CHECK(link_send(&transport, 1, large, sizeof(large) - 1, ATTEMPTS, ACK_TIMEOUT_MS) == LINK_DELIVERED);
+}
+
+int main() {
+	clean_link();
+	lost_ack();
+	lost_data();
+	no_ack();
+	late_ack();
+	relay_overflow();
+	invalid_frames();
+
+	return CHECK_RESULT();
+}
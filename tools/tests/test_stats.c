@@ -0,0 +1,120 @@
+// Running bulk statistics (Welford) against a two-pass reference, and the sequential stopping rule
+//
+// Built with CONFIG_SENSORS_SEQUENTIAL_MIN_SAMPLES 3, the Kconfig default
+
+#include <math.h>
+#include <stddef.h>
+
+#include "check.h"
+#include "sensors.h"
+
+// Two passes in double - the textbook mean and standard error of the mean
+static void reference(const float *values, size_t count, double *mean, double *standard_error) {
+	double sum = 0;
+	for (size_t i = 0; i < count; i++)
+		sum += values[i];
+
+	*mean = sum / count;
+
+	double squares = 0;
+	for (size_t i = 0; i < count; i++)
+		squares += (values[i] - *mean) * (values[i] - *mean);
+
+	*standard_error = sqrt(squares / ((count - 1) * count));
+}
+
+static void add_all(sample_stats_t *stats, const float *values, size_t count) {
+	sample_stats_reset(stats);
+	for (size_t i = 0; i < count; i++)
+		sample_stats_add(stats, values[i]);
+}
+
+static bool close_to(double value, double expected, double tolerance) {
+	return fabs(value - expected) <= tolerance;
+}
+
+static void matches_reference() {
+	static const float temperatures[] = {21.3f, 21.5f, 21.4f, 21.8f, 21.2f, 21.6f, 21.4f, 21.5f, 21.3f, 21.7f};
+	sample_stats_t stats;
+	double mean;
+	double standard_error;
+
+	for (size_t count = 2; count <= sizeof(temperatures) / sizeof(temperatures[0]); count++) {
+		add_all(&stats, temperatures, count);
+		reference(temperatures, count, &mean, &standard_error);
+
+		CHECK(stats.count == (int)count);
+		CHECK(close_to(sample_stats_mean(&stats), mean, 1e-4));
+		CHECK(close_to(sample_stats_standard_error(&stats), standard_error, 1e-4));
+	}
+}
+
+// Small spread on a large level - a sum of squares in float would cancel to noise or below zero
+static void large_offset() {
+	float values[50];
+	for (int i = 0; i < 50; i++)
+		values[i] = 999.0f + (i % 5) * 0.1f;
+
+	sample_stats_t stats;
+	double mean;
+	double standard_error;
+	add_all(&stats, values, 50);
+	reference(values, 50, &mean, &standard_error);
+
+	CHECK(close_to(sample_stats_mean(&stats), mean, 1e-3));
+	CHECK(close_to(sample_stats_standard_error(&stats), standard_error, standard_error * 0.01));
+}
+
+static void degenerate() {
+	sample_stats_t stats;
+	sample_stats_reset(&stats);
+	CHECK(isinf(sample_stats_standard_error(&stats)));
+
+	sample_stats_add(&stats, 12.5f);
+	CHECK(sample_stats_mean(&stats) == 12.5f);
+	CHECK(isinf(sample_stats_standard_error(&stats)));
+
+	// Identical readings - no spread at all
+	sample_stats_add(&stats, 12.5f);
+	sample_stats_add(&stats, 12.5f);
+	CHECK(sample_stats_standard_error(&stats) == 0);
+}
+
+static void convergence() {
+	sample_stats_t stats;
+	sample_stats_reset(&stats);
+
+	// Never before the minimum, however stable
+	sample_stats_add(&stats, 48.0f);
+	CHECK(!sample_stats_converged(&stats, 1.0f));
+	sample_stats_add(&stats, 48.0f);
+	CHECK(!sample_stats_converged(&stats, 1.0f));
+	sample_stats_add(&stats, 48.0f);
+	CHECK(sample_stats_converged(&stats, 0.0f));
+
+	// Noisy PM readings: standard error sqrt(80 / 12) = 2.58 after 4 samples, met by a target of 2.6 but not 2.5
+	static const float pm[] = {10, 14, 18, 22};
+	add_all(&stats, pm, 4);
+	CHECK(close_to(sample_stats_standard_error(&stats), sqrt(80.0 / 12), 1e-4));
+	CHECK(sample_stats_converged(&stats, 2.6f));
+	CHECK(!sample_stats_converged(&stats, 2.5f));
+
+	// More samples of the same spread shrink the error until the target is met
+	int samples = 4;
+	while (!sample_stats_converged(&stats, 1.0f) && samples < 100) {
+		sample_stats_add(&stats, pm[samples % 4]);
+		samples++;
+	}
+
+	CHECK(samples > 4 && samples < 100);
+	CHECK(sample_stats_standard_error(&stats) <= 1.0f);
+}
+
+int main() {
+	matches_reference();
+	large_offset();
+	degenerate();
+	convergence();
+
+	return CHECK_RESULT();
+}
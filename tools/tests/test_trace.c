@@ -0,0 +1,220 @@
+// Trace ring checks - with --vectors, prints the ring dumps for test_decode_trace.py instead
+//
+// One vector per line: {"name": ..., "dump": hex, "overwritten": n, "records": [[wake, ms, tag, message], ...]}
+//
+// The ring lives in file-scope state like in RTC memory, so the vectors run in order on one ring and the
+// expected records are the newest ones of everything written since the first trace_begin_cycle()
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "check.h"
+#include "trace.h"
+
+#define MAX_WRITTEN 512
+#define TEXT_LEN 128
+
+typedef struct {
+	trace_event_t event;
+	uint32_t args[TRACE_MAX_ARGS];
+	size_t count;
+	uint16_t wake;
+	uint32_t ms;
+	const char *tag;
+	char message[TEXT_LEN];
+} written_t;
+
+int shim_log_level = 0;
+
+static bool print_vectors = false;
+
+static uint32_t now_ms;
+static uint16_t wake;
+static written_t written[MAX_WRITTEN];
+static size_t written_count;
+
+uint32_t esp_log_timestamp(void) {
+	return now_ms;
+}
+
+static size_t record_len(const written_t *record) {
+	return TRACE_RECORD_HEADER_LEN + record->count * sizeof(uint32_t);
+}
+
+static void begin_cycle() {
+	trace_begin_cycle();
+	wake++;
+}
+
+// Writes one record and keeps the message tools/decode_trace.py must print for it
+static void record(trace_event_t event, const char *tag, const uint32_t *args, size_t count, const char *format, ...) {
+	written_t *entry = &written[written_count++];
+	*entry = (written_t){.event = event, .count = count, .wake = wake, .ms = now_ms, .tag = tag};
+	memcpy(entry->args, args, count * sizeof(uint32_t));
+
+	va_list list;
+	va_start(list, format);
+	vsnprintf(entry->message, sizeof(entry->message), format, list);
+	va_end(list);
+
+	trace_write(event, args, count);
+}
+
+static uint32_t get_u32(const uint8_t *buffer) {
+	return buffer[0] | buffer[1] << 8 | buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+}
+
+// Newest records that fit the ring - whole records are overwritten oldest first
+static size_t first_kept() {
+	size_t used = 0;
+	size_t first = written_count;
+
+	while (first > 0 && used + record_len(&written[first - 1]) <= CONFIG_TRACE_RING_SIZE)
+		used += record_len(&written[--first]);
+
+	return first;
+}
+
+// Parses the dump and compares every record with what was written
+static void check_dump(const uint8_t *dump, size_t len) {
+	size_t first = first_kept();
+
+	CHECK(len >= TRACE_DUMP_HEADER_LEN);
+	CHECK(dump[0] == TRACE_MAGIC_0 && dump[1] == TRACE_MAGIC_1 && dump[2] == TRACE_VERSION);
+	CHECK(get_u32(dump + 4) == first);
+	CHECK((size_t)(dump[8] | dump[9] << 8) == len - TRACE_DUMP_HEADER_LEN);
+	CHECK(len - TRACE_DUMP_HEADER_LEN <= CONFIG_TRACE_RING_SIZE);
+
+	size_t pos = TRACE_DUMP_HEADER_LEN;
+	for (size_t i = first; i < written_count; i++) {
+		const written_t *expected = &written[i];
+		if (pos + record_len(expected) > len) {
+			CHECK(pos + record_len(expected) <= len);
+			return;
+		}
+
+		CHECK(dump[pos] == expected->event);
+		CHECK(dump[pos + 1] == expected->count);
+		CHECK((dump[pos + 2] | dump[pos + 3] << 8) == expected->wake);
+		CHECK(get_u32(dump + pos + 4) == expected->ms);
+
+		for (size_t a = 0; a < expected->count; a++)
+			CHECK(get_u32(dump + pos + TRACE_RECORD_HEADER_LEN + a * sizeof(uint32_t)) == expected->args[a]);
+
+		pos += record_len(expected);
+	}
+
+	CHECK(pos == len);
+}
+
+static void print_json_string(const char *text) {
+	putchar('"');
+	for (const char *c = text; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			putchar('\\');
+		putchar(*c);
+	}
+	putchar('"');
+}
+
+static void emit(const char *name) {
+	static uint8_t dump[TRACE_DUMP_MAX_LEN];
+	size_t len = trace_dump(dump, sizeof(dump));
+
+	CHECK(len > 0);
+	check_dump(dump, len);
+
+	if (!print_vectors)
+		return;
+
+	size_t first = first_kept();
+
+	printf("{\"name\": \"%s\", \"dump\": \"", name);
+	for (size_t i = 0; i < len; i++)
+		printf("%02x", dump[i]);
+
+	printf("\", \"overwritten\": %u, \"records\": [", (unsigned int)first);
+	for (size_t i = first; i < written_count; i++) {
+		printf("%s[%u, %lu, ", i > first ? ", " : "", written[i].wake, (unsigned long)written[i].ms);
+		print_json_string(written[i].tag);
+		printf(", ");
+		print_json_string(written[i].message);
+		printf("]");
+	}
+
+	printf("]}\n");
+}
+
+// Cold boot - the ring starts over, nothing to decode but the header
+static void empty() {
+	begin_cycle();
+	emit("empty");
+}
+
+// One record of every argument kind - signed, unsigned, floats, a literal %, and arguments missing from the record
+static void mixed() {
+	now_ms = 1520;
+	record(TRACE_DHT22_MEASURED, "dht22", (const uint32_t[]){1, 5, trace_float(-12.5f), trace_float(65.25f)}, 4,
+		   "Measured [%d/%d]: temperature=%.2fC, humidity=%.2f%%", 1, 5, -12.5, 65.25);
+
+	now_ms = 2048;
+	record(TRACE_SDS011_MEASURED, "sds011", (const uint32_t[]){2, 5, trace_float(12.3f), trace_float(45.6f)}, 4,
+		   "Measured [%d/%d]: PM2.5=%.1f, PM10=%.1f", 2, 5, 12.3f, 45.6f);
+
+	now_ms = 3000000000u;
+	record(TRACE_SYNC_PUBLISHED, "sync", (const uint32_t[]){1, 1, trace_float(21.5f), 1700000000}, 4,
+		   "Published sensor=%d parameter=%d value=%.2f timestamp=%u", 1, 1, 21.5, 1700000000u);
+
+	record(TRACE_SYNC_ACKNOWLEDGED, "sync", (const uint32_t[]){(uint32_t)-1}, 1, "Message %d acknowledged", -1);
+
+	record(TRACE_SDS011_WARMED_UP, "sds011", (const uint32_t[]){4000000000u}, 1, "Warmed up in %u ms (limit ? ms)", 4000000000u);
+
+	emit("mixed");
+}
+
+// Records of different lengths over several wakes until the oldest are overwritten and records straddle the end
+static void wrapped() {
+	for (int cycle = 0; cycle < 6; cycle++) {
+		begin_cycle();
+		now_ms = 10;
+
+		for (int i = 0; i < 12; i++) {
+			now_ms += 7;
+			record(TRACE_SYNC_ACKNOWLEDGED, "sync", (const uint32_t[]){cycle * 100 + i}, 1, "Message %d acknowledged", cycle * 100 + i);
+
+			if (i % 3 == 0)
+				record(TRACE_DHT22_CONVERGED, "dht22", (const uint32_t[]){i, 12}, 2, "Converged after %d of %d samples", i, 12);
+
+			if (i % 5 == 0)
+				record(TRACE_SYNC_PUBLISHED, "sync", (const uint32_t[]){2, 3, trace_float(i * 0.5f), 1700000000 + i}, 4,
+					   "Published sensor=%d parameter=%d value=%.2f timestamp=%u", 2, 3, i * 0.5, 1700000000u + i);
+		}
+	}
+
+	CHECK(first_kept() > 0);
+	emit("wrapped");
+}
+
+// A buffer short of the ring contents gets nothing, not a truncated dump
+static void short_buffer() {
+	static uint8_t dump[TRACE_DUMP_MAX_LEN];
+	size_t len = trace_dump(dump, sizeof(dump));
+
+	CHECK(len > TRACE_DUMP_HEADER_LEN);
+	CHECK(trace_dump(dump, len - 1) == 0);
+	CHECK(trace_dump(dump, len) == len);
+}
+
+int main(int argc, char **argv) {
+	print_vectors = argc > 1 && strcmp(argv[1], "--vectors") == 0;
+
+	empty();
+	mixed();
+	wrapped();
+	short_buffer();
+
+	return CHECK_RESULT();
+}